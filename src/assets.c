@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "assets.h"
+
+typedef struct asset
+{
+  const asset_type_t *type;
+  char *path; // NULL for a free slot
+  void *data;
+  size_t size;
+  int ref_count;
+} asset_t;
+
+static asset_t assets[MAX_NUM_ASSETS] = {};
+static int cache_hits = 0;
+static int cache_misses = 0;
+
+static bool is_valid_asset_handle(asset_handle_t handle)
+{
+  return handle >= 0 && handle < MAX_NUM_ASSETS && assets[handle].path != NULL;
+}
+
+static asset_handle_t find_asset(const asset_type_t *type, const char *path)
+{
+  for (int i = 0; i < MAX_NUM_ASSETS; i++)
+  {
+    if (assets[i].path != NULL && assets[i].type == type && strcmp(assets[i].path, path) == 0)
+    {
+      return i;
+    }
+  }
+  return INVALID_ASSET_HANDLE;
+}
+
+static asset_handle_t find_free_asset(void)
+{
+  for (int i = 0; i < MAX_NUM_ASSETS; i++)
+  {
+    if (assets[i].path == NULL)
+    {
+      return i;
+    }
+  }
+  return INVALID_ASSET_HANDLE;
+}
+
+asset_handle_t acquire_asset(const asset_type_t *type, const char *path)
+{
+  asset_handle_t handle = find_asset(type, path);
+  if (handle != INVALID_ASSET_HANDLE)
+  {
+    assets[handle].ref_count++;
+    cache_hits++;
+    return handle;
+  }
+  cache_misses++;
+
+  handle = find_free_asset();
+  if (handle == INVALID_ASSET_HANDLE)
+  {
+    fprintf(stderr, "ERROR: Asset %s could not be loaded. Maximum number of assets (%d) is already met.\n", path, MAX_NUM_ASSETS);
+    return INVALID_ASSET_HANDLE;
+  }
+  size_t path_length = strlen(path);
+  char *path_copy = (char *)malloc(path_length + 1);
+  if (path_copy == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the asset path.\n");
+    return INVALID_ASSET_HANDLE;
+  }
+  memcpy(path_copy, path, path_length + 1);
+
+  size_t size = 0;
+  void *data = type->load(path, &size);
+  if (data == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to load %s %s.\n", type->name, path);
+    free(path_copy);
+    return INVALID_ASSET_HANDLE;
+  }
+  assets[handle] = (asset_t){.type = type, .path = path_copy, .data = data, .size = size, .ref_count = 1};
+  return handle;
+}
+
+void release_asset(asset_handle_t handle)
+{
+  if (!is_valid_asset_handle(handle))
+  {
+    return;
+  }
+  asset_t *asset = &assets[handle];
+  if (--asset->ref_count > 0)
+  {
+    return;
+  }
+  asset->type->free(asset->data);
+  free(asset->path);
+  *asset = (asset_t){};
+}
+
+void *get_asset_data(asset_handle_t handle)
+{
+  return is_valid_asset_handle(handle) ? assets[handle].data : NULL;
+}
+
+int get_asset_cache_hits(void)
+{
+  return cache_hits;
+}
+
+int get_asset_cache_misses(void)
+{
+  return cache_misses;
+}
+
+size_t get_asset_loaded_bytes(const asset_type_t *type)
+{
+  size_t bytes = 0;
+  for (int i = 0; i < MAX_NUM_ASSETS; i++)
+  {
+    if (assets[i].path != NULL && (type == NULL || assets[i].type == type))
+    {
+      bytes += assets[i].size;
+    }
+  }
+  return bytes;
+}
+
+size_t get_asset_shared_bytes(void)
+{
+  size_t bytes = 0;
+  for (int i = 0; i < MAX_NUM_ASSETS; i++)
+  {
+    if (assets[i].path != NULL)
+    {
+      bytes += assets[i].size * (assets[i].ref_count - 1);
+    }
+  }
+  return bytes;
+}
+
+void print_asset_cache_stats(void)
+{
+  printf("asset cache: %d hits, %d misses, %zu bytes loaded, %zu bytes shared\n", cache_hits, cache_misses,
+         get_asset_loaded_bytes(NULL), get_asset_shared_bytes());
+}
@@ -0,0 +1,39 @@
+#ifndef ASSETS_RENENGINE_SFW
+#define ASSETS_RENENGINE_SFW
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define MAX_NUM_ASSETS 64
+
+/**
+ * Assets
+ * A reference-counted registry of the assets loaded from files, keyed by their path.
+ * The first acquire of a path loads it; later ones share the loaded data until its last reference is released.
+ */
+
+// How one kind of asset is loaded from a file and freed. The loader returns NULL on failure and sets the bytes it
+// allocated in size.
+typedef struct asset_type
+{
+  const char *name;
+  void *(*load)(const char *path, size_t *size);
+  void (*free)(void *data);
+} asset_type_t;
+
+// Index of an asset in the registry, or INVALID_ASSET_HANDLE when it could not be loaded
+typedef int asset_handle_t;
+#define INVALID_ASSET_HANDLE -1
+
+asset_handle_t acquire_asset(const asset_type_t *type, const char *path);
+void release_asset(asset_handle_t handle); // Frees the asset with its last reference
+void *get_asset_data(asset_handle_t handle); // NULL for INVALID_ASSET_HANDLE
+
+// Cache statistics since startup: hits are acquires that shared an asset already loaded
+int get_asset_cache_hits(void);
+int get_asset_cache_misses(void);
+size_t get_asset_loaded_bytes(const asset_type_t *type); // Bytes of the assets of a type currently loaded, NULL for all
+size_t get_asset_shared_bytes(void); // Bytes that loading every current reference separately would have added
+void print_asset_cache_stats(void);
+
+#endif
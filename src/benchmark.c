@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "benchmark.h"
+#include "array.h"
+#include "clipping.h"
+#include "display.h"
+#include "geometry.h"
+#include "mesh.h"
+#include "meshlet.h"
+#include "texture.h"
+#include "triangle.h"
+
+// The render methods, in the order of their keys 1 to 8
+static const RenderMethod render_method_keys[] = {
+    RENDER_WIREFRAME_DOT, RENDER_WIREFRAME, RENDER_TRIANGLE, RENDER_WIREFRAME_TRIANGLE, RENDER_TEXTURED_TRIANGLE,
+    RENDER_TEXTURED_WIREFRAME_TRIANGLE, RENDER_TEXTURED_TRIANGLE_DEFERRED, RENDER_TEXTURED_TRIANGLE_PREPASS};
+
+// 64-bit FNV-1a, to print a short fingerprint of a frame
+static uint64_t hash_bytes(const void *data, size_t size)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Each method is rendered once with the scalar kernel beforehand, so that every compared frame follows the same frame
+bool test_raster_kernels(void (*update)(void), void (*render)(void))
+{
+  size_t num_pixels = (size_t)get_window_width() * get_window_height();
+  size_t depth_size = num_pixels * get_depth_format_size(get_depth_format());
+  color_t *reference_colors = (color_t *)malloc(sizeof(color_t) * num_pixels);
+  color_t *colors = (color_t *)malloc(sizeof(color_t) * num_pixels);
+  uint8_t *reference_depths = (uint8_t *)malloc(depth_size);
+  uint8_t *depths = (uint8_t *)malloc(depth_size);
+  bool is_matching = reference_colors != NULL && colors != NULL && reference_depths != NULL && depths != NULL;
+  if (!is_matching)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the raster kernel test.\n");
+  }
+
+  int num_methods = sizeof(render_method_keys) / sizeof(render_method_keys[0]);
+  for (int key = 1; key <= num_methods && is_matching; key++)
+  {
+    set_render_method(render_method_keys[key - 1]);
+    update();
+    set_raster_kernel(RASTER_KERNEL_SCALAR);
+    render();
+    for (int kernel = 0; kernel <= (int)detect_raster_kernel(); kernel++)
+    {
+      set_raster_kernel(kernel);
+      render();
+      bool is_reference = kernel == RASTER_KERNEL_SCALAR;
+      read_framebuffer(is_reference ? reference_colors : colors, is_reference ? reference_depths : depths);
+      bool is_kernel_matching = is_reference || (memcmp(colors, reference_colors, sizeof(color_t) * num_pixels) == 0 &&
+                                                 memcmp(depths, reference_depths, depth_size) == 0);
+      printf("raster kernel test: mode %d %-6s color %016llx, depth %016llx, %s\n", key, get_raster_kernel_name(kernel),
+             (unsigned long long)hash_bytes(is_reference ? reference_colors : colors, sizeof(color_t) * num_pixels),
+             (unsigned long long)hash_bytes(is_reference ? reference_depths : depths, depth_size),
+             is_reference ? "reference" : is_kernel_matching ? "matches scalar" : "MISMATCH");
+      is_matching = is_matching && is_kernel_matching;
+    }
+  }
+  if (get_depth_format() != DEPTH_FORMAT_FLOAT)
+  {
+    printf("raster kernel test: only the float depth format has SIMD kernels, so every kernel ran the scalar spans\n");
+  }
+
+  free(reference_colors);
+  free(colors);
+  free(reference_depths);
+  free(depths);
+  return is_matching;
+}
+
+#define WATERTIGHT_TEST_PASSES 16
+
+// Adds the pixels the triangle covers to coverage, rasterizing it tile by tile with DRAW_FILLED_TRIANGLE's function.
+// Each tile is cleared first, so the triangle is alone in it and only the coverage rules decide its pixels.
+static void add_triangle_coverage(triangle_t triangle, uint8_t *coverage)
+{
+  const color_t covered_color = 0xFFFFFFFF;
+  int width = get_window_width();
+  int height = get_window_height();
+  float x_min = fminf(triangle.points[0].x, fminf(triangle.points[1].x, triangle.points[2].x));
+  float y_min = fminf(triangle.points[0].y, fminf(triangle.points[1].y, triangle.points[2].y));
+  float x_max = fmaxf(triangle.points[0].x, fmaxf(triangle.points[1].x, triangle.points[2].x));
+  float y_max = fmaxf(triangle.points[0].y, fmaxf(triangle.points[1].y, triangle.points[2].y));
+  int tile_x_min = (int)fmaxf(x_min, 0) / TILE_SIZE;
+  int tile_y_min = (int)fmaxf(y_min, 0) / TILE_SIZE;
+  int tile_x_max = (int)fminf(x_max, width - 1) / TILE_SIZE;
+  int tile_y_max = (int)fminf(y_max, height - 1) / TILE_SIZE;
+  for (int tile_y = tile_y_min; tile_y <= tile_y_max; tile_y++)
+  {
+    for (int tile_x = tile_x_min; tile_x <= tile_x_max; tile_x++)
+    {
+      int tile_x_end = (tile_x + 1) * TILE_SIZE;
+      int tile_y_end = (tile_y + 1) * TILE_SIZE;
+      tile_t tile = {tile_x * TILE_SIZE, tile_y * TILE_SIZE, tile_x_end < width ? tile_x_end : width, tile_y_end < height ? tile_y_end : height};
+      clear_z_buffer_tile(&tile);
+      draw_rect(tile.x_min, tile.y_min, tile.x_max - tile.x_min, tile.y_max - tile.y_min, 0, &tile);
+      draw_filled_triangle(triangle, covered_color, &tile);
+      for (int y = tile.y_min; y < tile.y_max; y++)
+      {
+        for (int x = tile.x_min; x < tile.x_max; x++)
+        {
+          coverage[width * y + x] += get_color_buffer_span(x, y)[x] == covered_color;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Rasterizes every triangle of the OBJ alone, with every span kernel, turning it between passes, and counts how many
+ * triangles cover each pixel. Each face is drawn in its own winding and then reversed, which the rasterizer only
+ * fills when the face is back-facing, so front and back faces are counted apart. The ray through a pixel of the
+ * silhouette of a closed convex mesh enters it through exactly one front face and leaves it through exactly one back
+ * face, so both counts must be 1 there: a 0 is a crack between triangles, and a 2 a pixel drawn twice on a shared
+ * edge or vertex. Returns false if any pixel breaks that rule, or if the OBJ cannot be tested.
+ */
+bool test_watertight_rasterization(char *obj_path, const mat4_t *projection)
+{
+  mesh_t mesh = load_obj_from_file(obj_path);
+  int num_vertices = array_length(mesh.vertices);
+  int num_faces = array_length(mesh.faces);
+  if (num_faces == 0)
+  {
+    fprintf(stderr, "ERROR: Could not load %s for the watertight test.\n", obj_path);
+    return false;
+  }
+
+  size_t num_pixels = (size_t)get_window_width() * get_window_height();
+  vertex_soa_t transformed = {}, projected = {};
+  clip_outcode_t *outcodes = (clip_outcode_t *)malloc(sizeof(clip_outcode_t) * num_vertices);
+  uint8_t *front_coverage = (uint8_t *)malloc(num_pixels);
+  uint8_t *back_coverage = (uint8_t *)malloc(num_pixels);
+  bool is_allocated = allocate_vertex_soa(&transformed, num_vertices) && allocate_vertex_soa(&projected, num_vertices) &&
+                      outcodes != NULL && front_coverage != NULL && back_coverage != NULL;
+  bool is_watertight = is_allocated;
+  if (!is_allocated)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the watertight test.\n");
+  }
+
+  for (int kernel = 0; kernel <= (int)detect_raster_kernel() && is_allocated; kernel++)
+  {
+    set_raster_kernel(kernel);
+    long num_silhouette_pixels = 0, num_cracks = 0, num_overlaps = 0;
+    int num_passes_tested = 0;
+    for (int pass = 0; pass < WATERTIGHT_TEST_PASSES; pass++)
+    {
+      // Turned and shifted by fractions of a pixel, so that vertices and edges fall on pixel centers and between them
+      mat4_t view_world = mat4_matmul_mat4(mat4_make_translation(pass * 0.0123, pass * -0.0071, 5),
+                                           mat4_matmul_mat4(mat4_make_rotation_x(pass * 0.37), mat4_make_rotation_y(pass * 0.61)));
+      transform_vertices(&view_world, mesh.vertices, num_vertices, &transformed);
+      project_vertices(projection, &transformed, num_vertices, &projected, outcodes);
+
+      // A clipped triangle would open the mesh, so only the views it is entirely inside of are tested
+      bool is_inside = true;
+      for (int i = 0; i < num_vertices; i++)
+      {
+        is_inside = is_inside && outcodes[i] == 0;
+      }
+      if (!is_inside)
+      {
+        continue;
+      }
+      num_passes_tested++;
+
+      memset(front_coverage, 0, num_pixels);
+      memset(back_coverage, 0, num_pixels);
+      for (int i = 0; i < num_faces; i++)
+      {
+        const face_t *face = &mesh.faces[i];
+        triangle_t triangle = {.points = {get_soa_vertex(&projected, face->a), get_soa_vertex(&projected, face->b), get_soa_vertex(&projected, face->c)}};
+        add_triangle_coverage(triangle, front_coverage);
+        triangle.points[1] = get_soa_vertex(&projected, face->c);
+        triangle.points[2] = get_soa_vertex(&projected, face->b);
+        add_triangle_coverage(triangle, back_coverage);
+      }
+      for (size_t i = 0; i < num_pixels; i++)
+      {
+        if (front_coverage[i] > 0 || back_coverage[i] > 0)
+        {
+          num_silhouette_pixels++;
+          num_cracks += front_coverage[i] == 0 || back_coverage[i] == 0;
+          num_overlaps += front_coverage[i] > 1 || back_coverage[i] > 1;
+        }
+      }
+    }
+    bool is_kernel_watertight = num_passes_tested > 0 && num_cracks == 0 && num_overlaps == 0;
+    printf("watertight test: %-6s %d views, %ld silhouette pixels, %ld cracks, %ld overlaps, %s\n", get_raster_kernel_name(kernel),
+           num_passes_tested, num_silhouette_pixels, num_cracks, num_overlaps, is_kernel_watertight ? "watertight" : "NOT WATERTIGHT");
+    is_watertight = is_watertight && is_kernel_watertight;
+  }
+
+  free_vertex_soa(&transformed);
+  free_vertex_soa(&projected);
+  free(outcodes);
+  free(front_coverage);
+  free(back_coverage);
+  array_free(mesh.vertices);
+  array_free(mesh.faces);
+  array_free(mesh.edges);
+  array_free(mesh.texcoords);
+  return is_watertight;
+}
+
+#define DEFERRED_TEST_PASSES 16
+
+// Draws the triangles into every tile of the screen with the tile commands of a textured render method
+static void draw_textured_frame(const triangle_t *triangles, int num_triangles, RenderMethod method)
+{
+  int width = get_window_width();
+  int height = get_window_height();
+  for (int y = 0; y < height; y += TILE_SIZE)
+  {
+    for (int x = 0; x < width; x += TILE_SIZE)
+    {
+      tile_t tile = {x, y, x + TILE_SIZE < width ? x + TILE_SIZE : width, y + TILE_SIZE < height ? y + TILE_SIZE : height};
+      clear_z_buffer_tile(&tile);
+      draw_rect(tile.x_min, tile.y_min, tile.x_max - tile.x_min, tile.y_max - tile.y_min, 0, &tile);
+      switch (method)
+      {
+      case RENDER_TEXTURED_TRIANGLE_DEFERRED:
+        clear_triangle_id_buffer(&tile);
+        for (int i = 0; i < num_triangles; i++)
+        {
+          draw_visibility_triangle(triangles[i], i, &tile);
+        }
+        resolve_visibility_buffer(triangles, &tile);
+        break;
+      case RENDER_TEXTURED_TRIANGLE_PREPASS:
+        for (int i = 0; i < num_triangles; i++)
+        {
+          draw_depth_triangle(triangles[i], &tile);
+        }
+        for (int i = 0; i < num_triangles; i++)
+        {
+          draw_textured_triangle_depth_equal(triangles[i], triangles[i].texture, &tile);
+        }
+        break;
+      default:
+        for (int i = 0; i < num_triangles; i++)
+        {
+          draw_textured_triangle(triangles[i], triangles[i].texture, &tile);
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Number of pixels whose colors differ between two frames
+static long count_differing_pixels(const color_t *colors, const color_t *reference_colors, size_t num_pixels)
+{
+  long num_differing = 0;
+  for (size_t i = 0; i < num_pixels; i++)
+  {
+    num_differing += colors[i] != reference_colors[i];
+  }
+  return num_differing;
+}
+
+/**
+ * Draws the textured OBJ with every span kernel, turning it and shrinking it between passes until most of its
+ * triangles take the small-triangle path, in the forward, deferred and Z-prepass render methods. The deferred resolve
+ * and the second pass of the Z-prepass must color every pixel exactly like the forward rasterizer, whatever the size
+ * of the triangles. Returns false if any pixel differs, or if the OBJ or PNG cannot be tested.
+ */
+bool test_deferred_shading(char *obj_path, char *png_path, const mat4_t *projection)
+{
+  mesh_t mesh = load_obj_from_file(obj_path);
+  mesh.texture = load_mesh_png(png_path);
+  int num_vertices = array_length(mesh.vertices);
+  int num_faces = array_length(mesh.faces);
+  size_t num_pixels = (size_t)get_window_width() * get_window_height();
+  vertex_soa_t transformed = {}, projected = {};
+  clip_outcode_t *outcodes = (clip_outcode_t *)malloc(sizeof(clip_outcode_t) * num_vertices);
+  triangle_t *triangles = (triangle_t *)malloc(sizeof(triangle_t) * num_faces);
+  color_t *reference_colors = (color_t *)malloc(sizeof(color_t) * num_pixels);
+  color_t *colors = (color_t *)malloc(sizeof(color_t) * num_pixels);
+  uint8_t *depths = (uint8_t *)malloc(num_pixels * get_depth_format_size(get_depth_format()));
+  bool is_loaded = num_faces > 0 && mesh.texture != NULL;
+  bool is_allocated = allocate_vertex_soa(&transformed, num_vertices) && allocate_vertex_soa(&projected, num_vertices) &&
+                      outcodes != NULL && triangles != NULL && reference_colors != NULL && colors != NULL && depths != NULL;
+  bool is_matching = is_loaded && is_allocated;
+  if (!is_loaded)
+  {
+    fprintf(stderr, "ERROR: Could not load %s and %s for the deferred test.\n", obj_path, png_path);
+  }
+  else if (!is_allocated)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the deferred test.\n");
+  }
+
+  for (int kernel = 0; kernel <= (int)detect_raster_kernel() && is_loaded && is_allocated; kernel++)
+  {
+    set_raster_kernel(kernel);
+    long num_triangles = 0, num_small_triangles = 0, num_deferred_differing = 0, num_prepass_differing = 0;
+    int num_passes_tested = 0;
+    for (int pass = 0; pass < DEFERRED_TEST_PASSES; pass++)
+    {
+      // From a few large triangles in the first pass to mostly small ones in the last
+      float scale = 0.4f / (1 + pass);
+      mat4_t view_world = mat4_matmul_mat4(mat4_make_translation(pass * 0.0123, pass * -0.0071, 5),
+                                           mat4_matmul_mat4(mat4_matmul_mat4(mat4_make_rotation_x(pass * 0.37), mat4_make_rotation_y(pass * 0.61)),
+                                                            mat4_make_scale(scale, scale, scale)));
+      transform_vertices(&view_world, mesh.vertices, num_vertices, &transformed);
+      project_vertices(projection, &transformed, num_vertices, &projected, outcodes);
+
+      // Clipped triangles would take a path the three methods share, so only the views the OBJ is inside of are tested
+      bool is_inside = true;
+      for (int i = 0; i < num_vertices; i++)
+      {
+        is_inside = is_inside && outcodes[i] == 0;
+      }
+      if (!is_inside)
+      {
+        continue;
+      }
+      num_passes_tested++;
+
+      for (int i = 0; i < num_faces; i++)
+      {
+        const face_t *face = &mesh.faces[i];
+        triangles[i] = (triangle_t){
+            .points = {get_soa_vertex(&projected, face->a), get_soa_vertex(&projected, face->b), get_soa_vertex(&projected, face->c)},
+            .texcoords = {face->a_uv, face->b_uv, face->c_uv},
+            .texture = mesh.texture};
+        tile_t pixel_bounds;
+        triangle_size_class size_class = classify_triangle_size(&triangles[i], &pixel_bounds);
+        num_triangles += size_class != TRIANGLE_EMPTY;
+        num_small_triangles += size_class == TRIANGLE_SMALL;
+      }
+
+      draw_textured_frame(triangles, num_faces, RENDER_TEXTURED_TRIANGLE);
+      read_framebuffer(reference_colors, depths);
+      draw_textured_frame(triangles, num_faces, RENDER_TEXTURED_TRIANGLE_DEFERRED);
+      read_framebuffer(colors, depths);
+      num_deferred_differing += count_differing_pixels(colors, reference_colors, num_pixels);
+      draw_textured_frame(triangles, num_faces, RENDER_TEXTURED_TRIANGLE_PREPASS);
+      read_framebuffer(colors, depths);
+      num_prepass_differing += count_differing_pixels(colors, reference_colors, num_pixels);
+    }
+    bool is_kernel_matching = num_passes_tested > 0 && num_deferred_differing == 0 && num_prepass_differing == 0;
+    printf("deferred test: %-6s %d views, %ld triangles, %.1f%% small, %ld pixels differ in deferred, %ld in prepass, %s\n",
+           get_raster_kernel_name(kernel), num_passes_tested, num_triangles, num_triangles > 0 ? 100.0 * num_small_triangles / num_triangles : 0.0,
+           num_deferred_differing, num_prepass_differing, is_kernel_matching ? "identical" : "MISMATCH");
+    is_matching = is_matching && is_kernel_matching;
+  }
+
+  free_vertex_soa(&transformed);
+  free_vertex_soa(&projected);
+  free(outcodes);
+  free(triangles);
+  free(reference_colors);
+  free(colors);
+  free(depths);
+  free_texture(mesh.texture);
+  array_free(mesh.vertices);
+  array_free(mesh.faces);
+  array_free(mesh.edges);
+  array_free(mesh.texcoords);
+  return is_matching;
+}
+
+// Samples the first level of the texture across a rotated 1024x1024 screen, like a textured span kernel would
+#define TEXTURE_BENCHMARK_SIZE 1024
+#define TEXTURE_BENCHMARK_PASSES 16
+
+static color_t benchmark_texture_sampling(const texture_level_t *level)
+{
+  const float cos_angle = cosf(M_PI / 6.0);
+  const float sin_angle = sinf(M_PI / 6.0);
+  color_t checksum = 0;
+  for (int pass = 0; pass < TEXTURE_BENCHMARK_PASSES; pass++)
+  {
+    for (int y = 0; y < TEXTURE_BENCHMARK_SIZE; y++)
+    {
+      for (int x = 0; x < TEXTURE_BENCHMARK_SIZE; x++)
+      {
+        float u = (x * cos_angle - y * sin_angle) / level->width;
+        float v = (x * sin_angle + y * cos_angle + pass) / level->height;
+        checksum ^= sample_texture(level, u, v);
+      }
+    }
+  }
+  return checksum;
+}
+
+// Root mean square difference of the RGB channels of two levels of the same size
+static double get_texture_level_error(const texture_level_t *level, const texture_level_t *reference)
+{
+  double sum = 0.0;
+  for (int i = 0; i < level->width * level->height; i++)
+  {
+    color_t a = fetch_texel(level, i);
+    color_t b = fetch_texel(reference, i);
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+      double difference = (double)((a >> shift) & 0xFF) - (double)((b >> shift) & 0xFF);
+      sum += difference * difference;
+    }
+  }
+  return sqrt(sum / (3.0 * level->width * level->height));
+}
+
+// Loads the PNG in every texture format and prints its memory, encoding time, error and sampling throughput
+void benchmark_texture_formats(char *png_path)
+{
+  texture_format requested_format = get_texture_format();
+  set_texture_format(TEXTURE_FORMAT_RGBA8888);
+  texture_t *reference = load_mesh_png(png_path);
+  if (reference == NULL)
+  {
+    fprintf(stderr, "ERROR: Could not load %s for the texture benchmark.\n", png_path);
+    return;
+  }
+  for (int format = 0; format < NUM_TEXTURE_FORMATS; format++)
+  {
+    set_texture_format(format);
+    uint64_t load_start = SDL_GetPerformanceCounter();
+    texture_t *texture = load_mesh_png(png_path);
+    double load_ms = (SDL_GetPerformanceCounter() - load_start) * 1000.0 / SDL_GetPerformanceFrequency();
+    if (texture == NULL)
+    {
+      continue;
+    }
+    uint64_t sample_start = SDL_GetPerformanceCounter();
+    color_t checksum = benchmark_texture_sampling(&texture->levels[0]);
+    double sample_s = (double)(SDL_GetPerformanceCounter() - sample_start) / SDL_GetPerformanceFrequency();
+    double num_samples = (double)TEXTURE_BENCHMARK_PASSES * TEXTURE_BENCHMARK_SIZE * TEXTURE_BENCHMARK_SIZE;
+    printf("texture benchmark: %-8s %9zu bytes, load %.1f ms, rms error %.2f, %.1f Msamples/s (checksum %08x)\n",
+           get_texture_format_name(format), get_texture_memory_size(texture), load_ms,
+           get_texture_level_error(&texture->levels[0], &reference->levels[0]), num_samples / sample_s / 1e6, checksum);
+    free_texture(texture);
+  }
+  free_texture(reference);
+  set_texture_format(requested_format);
+}
+
+#define GEOMETRY_BENCHMARK_PASSES 2000
+
+// The mesh in front of the camera, turned a little more every pass
+static mat4_t get_geometry_benchmark_view_world(int pass)
+{
+  return mat4_matmul_mat4(mat4_make_translation(0, 0, 5), mat4_matmul_mat4(mat4_make_rotation_x(pass * 0.0037), mat4_make_rotation_y(pass * 0.01)));
+}
+
+// Culls the mesh by meshlet and then face by face, timing it and checking that only faces that cull_faces() or
+// their outcodes would reject were rejected with their meshlet. Uses the selected geometry kernel.
+static void benchmark_meshlet_culling(const mesh_t *mesh, const mat4_t *projection, vertex_soa_t *transformed, vertex_soa_t *projected,
+                                      clip_outcode_t *outcodes, int *visible, vec3_t *normals, int *reference_visible,
+                                      vec3_t *reference_normals)
+{
+  int num_vertices = array_length(mesh->vertices);
+  int num_faces = array_length(mesh->faces);
+  int num_meshlets = array_length(mesh->meshlets);
+  meshlet_cull_counts_t total = {};
+  long num_visible_faces = 0;
+  uint64_t start = SDL_GetPerformanceCounter();
+  for (int pass = 0; pass < GEOMETRY_BENCHMARK_PASSES; pass++)
+  {
+    mat4_t view_world = get_geometry_benchmark_view_world(pass);
+    transform_vertices(&view_world, mesh->vertices, num_vertices, transformed);
+    project_vertices(projection, transformed, num_vertices, projected, outcodes);
+    meshlet_cull_counts_t counts;
+    num_visible_faces += cull_meshlet_faces(mesh->faces, mesh->meshlets, transformed, &view_world, true, true, true, visible, normals, &counts);
+    total.meshlets_outside_frustum += counts.meshlets_outside_frustum;
+    total.meshlets_back_facing += counts.meshlets_back_facing;
+    total.faces_rejected += counts.faces_rejected;
+  }
+  double pass_us = (SDL_GetPerformanceCounter() - start) * 1e6 / SDL_GetPerformanceFrequency() / GEOMETRY_BENCHMARK_PASSES;
+
+  bool is_conservative = true;
+  for (int pass = 0; pass < GEOMETRY_BENCHMARK_PASSES && is_conservative; pass++)
+  {
+    mat4_t view_world = get_geometry_benchmark_view_world(pass);
+    transform_vertices(&view_world, mesh->vertices, num_vertices, transformed);
+    project_vertices(projection, transformed, num_vertices, projected, outcodes);
+    meshlet_cull_counts_t counts;
+    int num_visible = cull_meshlet_faces(mesh->faces, mesh->meshlets, transformed, &view_world, true, true, true, visible, normals, &counts);
+    int num_reference_visible = cull_faces(mesh->faces, num_faces, transformed, true, reference_visible, reference_normals);
+    int j = 0;
+    for (int i = 0; i < num_reference_visible; i++)
+    {
+      const face_t *face = &mesh->faces[reference_visible[i]];
+      if (j < num_visible && visible[j] == reference_visible[i])
+      {
+        j++;
+      }
+      else if (classify_clip_outcodes(outcodes[face->a], outcodes[face->b], outcodes[face->c]) != CLIP_REJECT)
+      {
+        is_conservative = false;
+      }
+    }
+    is_conservative = is_conservative && j == num_visible;
+  }
+
+  double num_tests = (double)num_meshlets * GEOMETRY_BENCHMARK_PASSES;
+  printf("geometry benchmark: %-6s %d meshlets of %.1f faces, %.2f us per pass, %.1f%% outside frustum, %.1f%% back-facing, "
+         "%.1f%% of faces rejected by meshlet, %.1f faces visible, %s\n",
+         get_raster_kernel_name(get_geometry_kernel()), num_meshlets, (double)num_faces / num_meshlets, pass_us, 100.0 * total.meshlets_outside_frustum / num_tests,
+         100.0 * total.meshlets_back_facing / num_tests, 100.0 * total.faces_rejected / ((double)num_faces * GEOMETRY_BENCHMARK_PASSES),
+         (double)num_visible_faces / GEOMETRY_BENCHMARK_PASSES, is_conservative ? "conservative" : "NOT CONSERVATIVE");
+}
+
+// Transforms, projects and culls the OBJ with every geometry kernel, turning it a little every pass, and prints
+// their time per pass. The scalar kernel is the reference the others must match exactly. The meshlet culling is
+// then measured with geometry_kernel.
+void benchmark_geometry_kernels(char *obj_path, const mat4_t *projection, raster_kernel geometry_kernel)
+{
+  mesh_t mesh = load_obj_from_file(obj_path);
+  int num_vertices = array_length(mesh.vertices);
+  int num_faces = array_length(mesh.faces);
+  if (num_faces == 0)
+  {
+    fprintf(stderr, "ERROR: Could not load %s for the geometry benchmark.\n", obj_path);
+    return;
+  }
+  mesh.meshlets = build_meshlets(mesh.faces, mesh.vertices);
+
+  vertex_soa_t transformed = {}, projected = {}, reference_transformed = {}, reference_projected = {};
+  clip_outcode_t *outcodes = (clip_outcode_t *)malloc(sizeof(clip_outcode_t) * num_vertices);
+  clip_outcode_t *reference_outcodes = (clip_outcode_t *)malloc(sizeof(clip_outcode_t) * num_vertices);
+  int *visible = (int *)malloc(sizeof(int) * num_faces);
+  int *reference_visible = (int *)malloc(sizeof(int) * num_faces);
+  vec3_t *normals = (vec3_t *)malloc(sizeof(vec3_t) * num_faces);
+  vec3_t *reference_normals = (vec3_t *)malloc(sizeof(vec3_t) * num_faces);
+  if (allocate_vertex_soa(&transformed, num_vertices) && allocate_vertex_soa(&projected, num_vertices) &&
+      allocate_vertex_soa(&reference_transformed, num_vertices) && allocate_vertex_soa(&reference_projected, num_vertices) &&
+      outcodes != NULL && reference_outcodes != NULL && visible != NULL && reference_visible != NULL && normals != NULL && reference_normals != NULL)
+  {
+    double scalar_us = 0.0;
+    for (int kernel = 0; kernel <= (int)detect_raster_kernel(); kernel++)
+    {
+      set_geometry_kernel(kernel);
+      bool is_matching = true;
+      long num_visible_faces = 0;
+      uint64_t start = SDL_GetPerformanceCounter();
+      for (int pass = 0; pass < GEOMETRY_BENCHMARK_PASSES; pass++)
+      {
+        mat4_t view_world = get_geometry_benchmark_view_world(pass);
+        transform_vertices(&view_world, mesh.vertices, num_vertices, &transformed);
+        project_vertices(projection, &transformed, num_vertices, &projected, outcodes);
+        int num_visible = cull_faces(mesh.faces, num_faces, &transformed, true, visible, normals);
+        num_visible_faces += num_visible;
+
+        // Checking every pass against the scalar kernels would time them too, so only the first one is checked
+        if (pass == 0 && kernel != RASTER_KERNEL_SCALAR)
+        {
+          set_geometry_kernel(RASTER_KERNEL_SCALAR);
+          transform_vertices(&view_world, mesh.vertices, num_vertices, &reference_transformed);
+          project_vertices(projection, &reference_transformed, num_vertices, &reference_projected, reference_outcodes);
+          int num_reference_visible = cull_faces(mesh.faces, num_faces, &reference_transformed, true, reference_visible, reference_normals);
+          set_geometry_kernel(kernel);
+          is_matching = num_visible == num_reference_visible &&
+                        memcmp(outcodes, reference_outcodes, sizeof(clip_outcode_t) * num_vertices) == 0 &&
+                        memcmp(visible, reference_visible, sizeof(int) * num_visible) == 0 &&
+                        memcmp(normals, reference_normals, sizeof(vec3_t) * num_visible) == 0;
+          vertex_soa_t *soas[2][2] = {{&transformed, &reference_transformed}, {&projected, &reference_projected}};
+          for (int j = 0; j < 2; j++)
+          {
+            is_matching = is_matching && memcmp(soas[j][0]->x, soas[j][1]->x, sizeof(float) * num_vertices) == 0 &&
+                          memcmp(soas[j][0]->y, soas[j][1]->y, sizeof(float) * num_vertices) == 0 &&
+                          memcmp(soas[j][0]->z, soas[j][1]->z, sizeof(float) * num_vertices) == 0 &&
+                          memcmp(soas[j][0]->w, soas[j][1]->w, sizeof(float) * num_vertices) == 0;
+          }
+        }
+      }
+      double pass_us = (SDL_GetPerformanceCounter() - start) * 1e6 / SDL_GetPerformanceFrequency() / GEOMETRY_BENCHMARK_PASSES;
+      scalar_us = kernel == RASTER_KERNEL_SCALAR ? pass_us : scalar_us;
+      printf("geometry benchmark: %-6s %d vertices, %d faces, %.2f us per pass (%.2fx), %.1f faces visible, %s\n",
+             get_raster_kernel_name(kernel), num_vertices, num_faces, pass_us, scalar_us / pass_us,
+             (double)num_visible_faces / GEOMETRY_BENCHMARK_PASSES, is_matching ? "matches scalar" : "MISMATCH");
+    }
+    set_geometry_kernel(geometry_kernel);
+    benchmark_meshlet_culling(&mesh, projection, &transformed, &projected, outcodes, visible, normals, reference_visible, reference_normals);
+  }
+  else
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the geometry benchmark.\n");
+  }
+  free_vertex_soa(&transformed);
+  free_vertex_soa(&projected);
+  free_vertex_soa(&reference_transformed);
+  free_vertex_soa(&reference_projected);
+  free(outcodes);
+  free(reference_outcodes);
+  free(visible);
+  free(reference_visible);
+  free(normals);
+  free(reference_normals);
+  array_free(mesh.vertices);
+  array_free(mesh.faces);
+  array_free(mesh.edges);
+  array_free(mesh.texcoords);
+  array_free(mesh.meshlets);
+}
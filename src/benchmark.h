@@ -0,0 +1,35 @@
+#ifndef BENCHMARK_RENENGINE_SFW
+#define BENCHMARK_RENENGINE_SFW
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "triangle.h"
+
+/**
+ * Benchmark
+ * Self-checks and measurements run from the command line instead of the game loop. Each one prints a line per case,
+ * and the checks return false when a case fails, so that main() can exit with a failure status.
+ */
+
+// Renders the current view in every render method with every span kernel the CPU supports, and checks that their
+// color buffers and z-buffers are identical to the scalar kernel's. update and render are the game loop's.
+bool test_raster_kernels(void (*update)(void), void (*render)(void));
+
+// Rasterizes every triangle of a closed convex OBJ alone, with every span kernel, and checks that the triangles
+// cover every pixel of its silhouette exactly once
+bool test_watertight_rasterization(char *obj_path, const mat4_t *projection);
+
+// Draws the textured OBJ with every span kernel, shrunk until most of its triangles are small, and checks that the
+// deferred and Z-prepass render methods color every pixel like the forward one
+bool test_deferred_shading(char *obj_path, char *png_path, const mat4_t *projection);
+
+// Loads the PNG in every texture format and prints its memory, encoding time, error and sampling throughput
+void benchmark_texture_formats(char *png_path);
+
+// Transforms, projects and culls the OBJ with every geometry kernel, prints their time per pass, and checks them
+// against the scalar kernel. Then measures its meshlet culling with geometry_kernel, against the frustum planes that
+// were set up with the projection.
+void benchmark_geometry_kernels(char *obj_path, const mat4_t *projection, raster_kernel geometry_kernel);
+
+#endif
@@ -2,7 +2,8 @@
 
 plane_t frustum_planes[NUM_FRUSTUM_PLANES];
 
-void initialize_frustum_planes(float fovx, float fovy, float z_near, float z_far)
+// Sets the left, right, top and bottom planes through the camera for the given field of view
+static void initialize_side_planes(plane_t planes[], float fovx, float fovy)
 {
   float cos_half_angle_x = cos(fovx / 2);
   float sin_half_angle_x = sin(fovx / 2);
@@ -10,20 +11,25 @@ void initialize_frustum_planes(float fovx, float fovy, float z_near, float z_far
   float sin_half_angle_y = sin(fovy / 2);
 
   // Left Frustum Plane
-  frustum_planes[LEFT_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
-  frustum_planes[LEFT_FRUSTUM_PLANE].normal = vec3_create(cos_half_angle_x, 0, sin_half_angle_x);
+  planes[LEFT_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
+  planes[LEFT_FRUSTUM_PLANE].normal = vec3_create(cos_half_angle_x, 0, sin_half_angle_x);
 
   // Right Frustum Plane
-  frustum_planes[RIGHT_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
-  frustum_planes[RIGHT_FRUSTUM_PLANE].normal = vec3_create(-cos_half_angle_x, 0, sin_half_angle_x);
+  planes[RIGHT_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
+  planes[RIGHT_FRUSTUM_PLANE].normal = vec3_create(-cos_half_angle_x, 0, sin_half_angle_x);
 
   // Top Frustum Plane
-  frustum_planes[TOP_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
-  frustum_planes[TOP_FRUSTUM_PLANE].normal = vec3_create(0, -cos_half_angle_y, sin_half_angle_y);
+  planes[TOP_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
+  planes[TOP_FRUSTUM_PLANE].normal = vec3_create(0, -cos_half_angle_y, sin_half_angle_y);
 
   // Bottom Frustum Plane
-  frustum_planes[BOTTOM_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
-  frustum_planes[BOTTOM_FRUSTUM_PLANE].normal = vec3_create(0, cos_half_angle_y, sin_half_angle_y);
+  planes[BOTTOM_FRUSTUM_PLANE].point = vec3_create(0, 0, 0);
+  planes[BOTTOM_FRUSTUM_PLANE].normal = vec3_create(0, cos_half_angle_y, sin_half_angle_y);
+}
+
+void initialize_frustum_planes(float fovx, float fovy, float z_near, float z_far)
+{
+  initialize_side_planes(frustum_planes, fovx, fovy);
 
   // Near Frustum Plane
   frustum_planes[NEAR_FRUSTUM_PLANE].point = vec3_create(0, 0, z_near);
@@ -36,119 +42,266 @@ void initialize_frustum_planes(float fovx, float fovy, float z_near, float z_far
   return;
 }
 
-polygon_t polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t uv0, tex2_t uv1, tex2_t uv2)
+static float get_plane_distance(vec3_t vertex, plane_t plane)
 {
-  polygon_t triangle = {
-      .count = 3,
-      .vertices = {
-          v0, v1, v2},
-      .texcoords = {uv0, uv1, uv2}};
+  return vec3_dot(vec3_sub(vertex, plane.point), plane.normal);
+}
+
+// Margin of classify_bounds_clipping(), relative to the distance of the bounds, for the rounding of the vertices
+#define BOUNDS_CLIPPING_EPSILON 1e-4f
 
-  return triangle;
+clip_class classify_bounds_clipping(const bounds_t *bounds, const mat4_t *view_world_matrix, float scale)
+{
+  // The sphere decides most meshes, which are far from every plane
+  vec3_t center = vec3_from_vec4(mat4_matmul_vec(view_world_matrix, vec4_from_vec3(bounds->center)));
+  float radius = bounds->radius * scale;
+  float margin = BOUNDS_CLIPPING_EPSILON * (vec3_length(center) + radius);
+  bool is_sphere_inside = true;
+  for (int i = 0; i < NUM_FRUSTUM_PLANES; i++)
+  {
+    float distance = get_plane_distance(center, frustum_planes[i]);
+    if (distance < -radius - margin)
+    {
+      return CLIP_REJECT;
+    }
+    is_sphere_inside = is_sphere_inside && distance > radius + margin;
+  }
+  if (is_sphere_inside)
+  {
+    return CLIP_ACCEPT;
+  }
+
+  // Otherwise the corners of the box, whose distances to a plane bound those of the vertices inside it
+  vec3_t corners[8];
+  for (int i = 0; i < 8; i++)
+  {
+    vec4_t corner = {
+        .x = i & 1 ? bounds->max.x : bounds->min.x,
+        .y = i & 2 ? bounds->max.y : bounds->min.y,
+        .z = i & 4 ? bounds->max.z : bounds->min.z,
+        .w = 1.0};
+    corners[i] = vec3_from_vec4(mat4_matmul_vec(view_world_matrix, corner));
+  }
+  bool is_box_inside = true;
+  for (int i = 0; i < NUM_FRUSTUM_PLANES; i++)
+  {
+    int num_outside = 0;
+    int num_inside = 0;
+    for (int j = 0; j < 8; j++)
+    {
+      float distance = get_plane_distance(corners[j], frustum_planes[i]);
+      num_outside += distance < -margin;
+      num_inside += distance > margin;
+    }
+    if (num_outside == 8)
+    {
+      return CLIP_REJECT;
+    }
+    is_box_inside = is_box_inside && num_inside == 8;
+  }
+  return is_box_inside ? CLIP_ACCEPT : CLIP_POLYGON;
 }
 
-void clip_polygon_against_plane(polygon_t *polygon, plane_t plane)
+// A vertex of a triangle being clipped
+typedef struct clip_vertex
 {
-  vec3_t inside[MAX_NUM_POLYGON_VERTICES];
-  tex2_t inside_texcoords[MAX_NUM_POLYGON_VERTICES];
-  int inside_count = 0;
+  vec4_t point; // In clip space
+  tex2_t texcoord;
+} clip_vertex_t;
 
-  vec3_t previous_vertex = polygon->vertices[polygon->count - 1]; // Previous vertex starts at the last vertex
-  tex2_t previous_texcoord = polygon->texcoords[polygon->count - 1];
-  float previous_vertex_dot = vec3_dot(vec3_sub(previous_vertex, plane.point), plane.normal);
+// The planes clipped against, in order, with the outcode bit of the vertices outside them
+static const clip_outcode_t clip_plane_outcodes[] = {
+    CLIP_OUTCODE_GUARD_LEFT, CLIP_OUTCODE_GUARD_RIGHT, CLIP_OUTCODE_GUARD_TOP, CLIP_OUTCODE_GUARD_BOTTOM,
+    CLIP_OUTCODE_NEAR, CLIP_OUTCODE_FAR};
 
-  // Loop through each vertex
-  for (int i = 0; i < polygon->count; i++)
+// Signed distance of the clip-space point to the plane of the outcode bit, positive inside
+static float get_clip_plane_distance(vec4_t point, clip_outcode_t plane_outcode)
+{
+  switch (plane_outcode)
   {
-    vec3_t current_vertex = polygon->vertices[i];
-    tex2_t current_texcoord = polygon->texcoords[i];
-    float current_vertex_dot = vec3_dot(vec3_sub(current_vertex, plane.point), plane.normal);
+  case CLIP_OUTCODE_GUARD_LEFT:
+    return point.x + GUARD_BAND_SCALE * point.w;
+  case CLIP_OUTCODE_GUARD_RIGHT:
+    return GUARD_BAND_SCALE * point.w - point.x;
+  case CLIP_OUTCODE_GUARD_TOP:
+    return GUARD_BAND_SCALE * point.w - point.y;
+  case CLIP_OUTCODE_GUARD_BOTTOM:
+    return point.y + GUARD_BAND_SCALE * point.w;
+  case CLIP_OUTCODE_NEAR:
+    return point.z;
+  default:
+    return point.w - point.z;
+  }
+}
 
-    // If the previous is outside and the current is inside and vice versa
-    bool is_previous_different = previous_vertex_dot * current_vertex_dot < 0;
-    if (is_previous_different)
-    {
-      // Compute the interpolation point t; t = dot(Qp) / (dot(Qp) - dot(Qc))
-      float t = previous_vertex_dot / (previous_vertex_dot - current_vertex_dot);
-      // Using t, get the intersection point between the plane and the line formed by the two vertices:
-      // I = Qp + t(Qc - Qp) -- A linear interpolation between Qp and Qc using t as the interpolation factor
-      vec3_t intersection = vec3_lerp(previous_vertex, current_vertex, t);
-      tex2_t intersection_uv = {
-          .u = flerp(previous_texcoord.u, current_texcoord.u, t),
-          .v = flerp(previous_texcoord.v, current_texcoord.v, t)};
+// Sutherland-Hodgman: writes the part of the polygon strictly inside the plane to output and returns its vertex count
+static int clip_polygon_against_plane(const clip_vertex_t *input, int count, clip_outcode_t plane_outcode, clip_vertex_t *output)
+{
+  int output_count = 0;
+  const clip_vertex_t *previous = &input[count - 1]; // Previous vertex starts at the last vertex
+  float previous_distance = get_clip_plane_distance(previous->point, plane_outcode);
+  for (int i = 0; i < count; i++)
+  {
+    const clip_vertex_t *current = &input[i];
+    float current_distance = get_clip_plane_distance(current->point, plane_outcode);
 
-      inside[inside_count] = intersection;
-      inside_texcoords[inside_count] = intersection_uv;
-      inside_count++;
+    // If the previous is outside and the current is inside and vice versa, add the intersection
+    if (previous_distance * current_distance < 0)
+    {
+      // Distances to a plane are linear in clip space, so t = dQp / (dQp - dQc) interpolates the points and texcoords
+      float t = previous_distance / (previous_distance - current_distance);
+      output[output_count].point = vec4_lerp(previous->point, current->point, t);
+      output[output_count].texcoord = (tex2_t){
+          .u = flerp(previous->texcoord.u, current->texcoord.u, t),
+          .v = flerp(previous->texcoord.v, current->texcoord.v, t)};
+      output_count++;
     }
+    if (current_distance > 0.0)
+    {
+      output[output_count++] = *current;
+    }
+    previous = current;
+    previous_distance = current_distance;
+  }
+  return output_count;
+}
 
-    bool is_current_vertex_inside = current_vertex_dot > 0.0;
-    if (is_current_vertex_inside)
+int clip_triangle(const vec4_t points[3], const tex2_t texcoords[3], clip_outcode_t outcode_union,
+                  triangle_t triangles[MAX_NUM_POLYGON_TRIANGLES])
+{
+  // Each plane clips one buffer into the other, so the vertices are never copied back
+  clip_vertex_t buffers[2][MAX_NUM_POLYGON_VERTICES];
+  clip_vertex_t *input = buffers[0];
+  clip_vertex_t *output = buffers[1];
+  for (int i = 0; i < 3; i++)
+  {
+    input[i] = (clip_vertex_t){.point = points[i], .texcoord = texcoords[i]};
+  }
+  int count = 3;
+
+  // The planes every vertex is inside of leave the polygon as it is
+  for (size_t i = 0; i < sizeof(clip_plane_outcodes) / sizeof(clip_plane_outcodes[0]) && count >= 3; i++)
+  {
+    if ((outcode_union & clip_plane_outcodes[i]) != 0)
     {
-      inside[inside_count] = current_vertex;
-      inside_texcoords[inside_count] = current_texcoord;
-      inside_count++;
+      count = clip_polygon_against_plane(input, count, clip_plane_outcodes[i], output);
+      clip_vertex_t *swap = input;
+      input = output;
+      output = swap;
     }
+  }
 
-    previous_vertex = current_vertex;
-    previous_texcoord = current_texcoord;
-    previous_vertex_dot = current_vertex_dot;
+  // Break down the polygon back to a fan of triangles
+  int num_triangles = 0;
+  for (int i = 1; i + 1 < count; i++)
+  {
+    triangles[num_triangles++] = (triangle_t){
+        .points = {input[0].point, input[i].point, input[i + 1].point},
+        .texcoords = {input[0].texcoord, input[i].texcoord, input[i + 1].texcoord}};
   }
-  polygon->count = inside_count;
-  // memset(polygon->vertices, 0, sizeof(vec3_t) * MAX_NUM_POLYGON_VERTICES);
-  // Overwrite the current vertices of the polygon with all inside vertices
-  memcpy(polygon->vertices, inside, sizeof(vec3_t) * inside_count);
-  memcpy(polygon->texcoords, inside_texcoords, sizeof(tex2_t) * inside_count);
+  return num_triangles;
 }
 
-void triangles_from_polygon(polygon_t *polygon, triangle_t triangles_after_clipping[MAX_NUM_POLYGON_TRIANGLES], int *num_triangles_after_clipping)
+// Clips the view-space line ab so that it can be projected
+bool clip_line_against_near_far(vec3_t *a, vec3_t *b)
 {
-  if (!polygon)
+  const frustum_plane clip_planes[2] = {NEAR_FRUSTUM_PLANE, FAR_FRUSTUM_PLANE};
+  for (int i = 0; i < 2; i++)
   {
-    fprintf(stderr, "polygon not provided\n");
-    return;
+    plane_t plane = frustum_planes[clip_planes[i]];
+    float a_dot = get_plane_distance(*a, plane);
+    float b_dot = get_plane_distance(*b, plane);
+    if (a_dot <= 0 && b_dot <= 0)
+    {
+      return false;
+    }
+    if (a_dot < 0)
+    {
+      *a = vec3_lerp(*a, *b, a_dot / (a_dot - b_dot));
+    }
+    else if (b_dot < 0)
+    {
+      *b = vec3_lerp(*b, *a, b_dot / (b_dot - a_dot));
+    }
   }
-  if (!triangles_after_clipping)
+  return true;
+}
+
+// Outcodes of the Cohen-Sutherland algorithm: the sides of the rectangle a point is outside of
+#define OUTCODE_LEFT 1
+#define OUTCODE_RIGHT 2
+#define OUTCODE_TOP 4
+#define OUTCODE_BOTTOM 8
+
+static int get_outcode(vec2_t p, float x_min, float y_min, float x_max, float y_max)
+{
+  int outcode = 0;
+  if (p.x < x_min)
   {
-    fprintf(stderr, "triangles_after_clipping not provided\n");
-    return;
+    outcode |= OUTCODE_LEFT;
   }
-  if (!num_triangles_after_clipping)
+  else if (p.x > x_max)
   {
-    fprintf(stderr, "num_triangles_after_clipping not provided\n");
-    return;
+    outcode |= OUTCODE_RIGHT;
   }
-  (*num_triangles_after_clipping) = 0;
-
-  vec4_t v0;
-  tex2_t uv0;
-  if (polygon->count > 0)
+  if (p.y < y_min)
   {
-    v0 = vec4_from_vec3(polygon->vertices[0]);
-    uv0 = polygon->texcoords[0];
+    outcode |= OUTCODE_TOP;
   }
-  for (int i = 0; i < polygon->count - 2; i++)
+  else if (p.y > y_max)
   {
-    triangle_t triangle;
-    // (v1, v2), (v2, v3), (v3, v4)...
-    triangle.points[0] = v0;
-    triangle.points[1] = vec4_from_vec3(polygon->vertices[i + 1]);
-    triangle.points[2] = vec4_from_vec3(polygon->vertices[i + 2]);
-    triangle.texcoords[0] = uv0;
-    triangle.texcoords[1] = polygon->texcoords[i + 1];
-    triangle.texcoords[2] = polygon->texcoords[i + 2];
-    triangles_after_clipping[i] = triangle;
-    (*num_triangles_after_clipping) += 1;
+    outcode |= OUTCODE_BOTTOM;
   }
+  return outcode;
 }
 
-void clip_polygon(polygon_t *polygon)
+// Clips the screen-space line ab to the rectangle [x_min, x_max] x [y_min, y_max]
+bool clip_line_to_rect(vec2_t *a, vec2_t *b, float x_min, float y_min, float x_max, float y_max)
 {
-  // Previous clipping output is used as input for the next clipping
-  clip_polygon_against_plane(polygon, frustum_planes[LEFT_FRUSTUM_PLANE]);
-  clip_polygon_against_plane(polygon, frustum_planes[RIGHT_FRUSTUM_PLANE]);
-  clip_polygon_against_plane(polygon, frustum_planes[TOP_FRUSTUM_PLANE]);
-  clip_polygon_against_plane(polygon, frustum_planes[BOTTOM_FRUSTUM_PLANE]);
-  clip_polygon_against_plane(polygon, frustum_planes[NEAR_FRUSTUM_PLANE]);
-  clip_polygon_against_plane(polygon, frustum_planes[FAR_FRUSTUM_PLANE]);
-}
\ No newline at end of file
+  int a_outcode = get_outcode(*a, x_min, y_min, x_max, y_max);
+  int b_outcode = get_outcode(*b, x_min, y_min, x_max, y_max);
+  while (true)
+  {
+    if ((a_outcode | b_outcode) == 0) // Both inside
+    {
+      return true;
+    }
+    if ((a_outcode & b_outcode) != 0) // Both outside the same side
+    {
+      return false;
+    }
+
+    // Move an outside end point to the side it is outside of
+    int outcode = a_outcode != 0 ? a_outcode : b_outcode;
+    double dx = b->x - a->x;
+    double dy = b->y - a->y;
+    vec2_t p;
+    if (outcode & OUTCODE_TOP)
+    {
+      p = vec2_create(a->x + dx * (y_min - a->y) / dy, y_min);
+    }
+    else if (outcode & OUTCODE_BOTTOM)
+    {
+      p = vec2_create(a->x + dx * (y_max - a->y) / dy, y_max);
+    }
+    else if (outcode & OUTCODE_RIGHT)
+    {
+      p = vec2_create(x_max, a->y + dy * (x_max - a->x) / dx);
+    }
+    else
+    {
+      p = vec2_create(x_min, a->y + dy * (x_min - a->x) / dx);
+    }
+
+    if (outcode == a_outcode)
+    {
+      *a = p;
+      a_outcode = get_outcode(*a, x_min, y_min, x_max, y_max);
+    }
+    else
+    {
+      *b = p;
+      b_outcode = get_outcode(*b, x_min, y_min, x_max, y_max);
+    }
+  }
+}
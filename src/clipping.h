@@ -3,15 +3,21 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "vector.h"
+#include "matrix.h"
 #include "triangle.h"
 
 #define MAX_NUM_POLYGON_VERTICES 10
 #define MAX_NUM_POLYGON_TRIANGLES 10
 #define NUM_FRUSTUM_PLANES 6
 
+// The guard band extends the left, right, top and bottom frustum planes to this many times the view's width and height.
+// Triangles inside it are not clipped against those planes; the rasterizer scissors them to the screen instead.
+#define GUARD_BAND_SCALE 2.0f
+
 typedef enum frustum_plane
 {
   LEFT_FRUSTUM_PLANE,
@@ -28,19 +34,87 @@ typedef struct plane
   vec3_t normal;
 } plane_t;
 
-typedef struct polygon
+typedef enum clip_class
 {
-  vec3_t vertices[MAX_NUM_POLYGON_VERTICES];
-  tex2_t texcoords[MAX_NUM_POLYGON_VERTICES];
-  int count;
-} polygon_t;
+  CLIP_REJECT,  // Entirely outside one plane of the view frustum
+  CLIP_ACCEPT,  // Inside the near and far planes and the guard band, so it is rasterized as is
+  CLIP_POLYGON, // Crosses the near or far plane or leaves the guard band, so it is clipped with clip_triangle()
+} clip_class;
+
+// Clip-space outcodes: the planes a vertex is not strictly inside of, in the homogeneous coordinates of the projection,
+// where the view frustum is -w < x < w, -w < y < w and 0 < z < w. Computed once per vertex by project_vertices().
+#define CLIP_OUTCODE_LEFT 0x001
+#define CLIP_OUTCODE_RIGHT 0x002
+#define CLIP_OUTCODE_TOP 0x004
+#define CLIP_OUTCODE_BOTTOM 0x008
+#define CLIP_OUTCODE_NEAR 0x010
+#define CLIP_OUTCODE_FAR 0x020
+#define CLIP_OUTCODE_GUARD_LEFT 0x040 // The guard band is -G w < x < G w and -G w < y < G w, G = GUARD_BAND_SCALE
+#define CLIP_OUTCODE_GUARD_RIGHT 0x080
+#define CLIP_OUTCODE_GUARD_TOP 0x100
+#define CLIP_OUTCODE_GUARD_BOTTOM 0x200
+
+#define CLIP_OUTCODE_FRUSTUM 0x03f // A face with all its vertices outside one of these planes is invisible
+#define CLIP_OUTCODE_CLIPPED 0x3f0 // The planes faces are clipped against
+
+typedef uint16_t clip_outcode_t;
+
+static inline clip_outcode_t get_clip_outcode(vec4_t clip_point)
+{
+  float guard_band_w = GUARD_BAND_SCALE * clip_point.w;
+  return (clip_point.x <= -clip_point.w ? CLIP_OUTCODE_LEFT : 0) |
+         (clip_point.x >= clip_point.w ? CLIP_OUTCODE_RIGHT : 0) |
+         (clip_point.y >= clip_point.w ? CLIP_OUTCODE_TOP : 0) |
+         (clip_point.y <= -clip_point.w ? CLIP_OUTCODE_BOTTOM : 0) |
+         (clip_point.z <= 0.0f ? CLIP_OUTCODE_NEAR : 0) |
+         (clip_point.z >= clip_point.w ? CLIP_OUTCODE_FAR : 0) |
+         (clip_point.x <= -guard_band_w ? CLIP_OUTCODE_GUARD_LEFT : 0) |
+         (clip_point.x >= guard_band_w ? CLIP_OUTCODE_GUARD_RIGHT : 0) |
+         (clip_point.y >= guard_band_w ? CLIP_OUTCODE_GUARD_TOP : 0) |
+         (clip_point.y <= -guard_band_w ? CLIP_OUTCODE_GUARD_BOTTOM : 0);
+}
+
+// A face is rejected when the AND of its outcodes has a frustum plane, and skips the clipper when their OR has none
+// of the planes it is clipped against
+static inline clip_class classify_clip_outcodes(clip_outcode_t a, clip_outcode_t b, clip_outcode_t c)
+{
+  if ((a & b & c & CLIP_OUTCODE_FRUSTUM) != 0)
+  {
+    return CLIP_REJECT;
+  }
+  return ((a | b | c) & CLIP_OUTCODE_CLIPPED) != 0 ? CLIP_POLYGON : CLIP_ACCEPT;
+}
+
+// Bounding volumes of the vertices of a mesh
+typedef struct bounds
+{
+  vec3_t min; // Axis-aligned bounding box
+  vec3_t max;
+  vec3_t center; // Bounding sphere
+  float radius;
+} bounds_t;
 
 extern plane_t frustum_planes[NUM_FRUSTUM_PLANES];
 
 void initialize_frustum_planes(float fovx, float fovy, float z_near, float z_far);
-polygon_t polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t uv0, tex2_t uv1, tex2_t uv2);
-void clip_polygon_against_plane(polygon_t *polygon, plane_t plane);
-void clip_polygon(polygon_t *polygon);
-void triangles_from_polygon(polygon_t *polygon, triangle_t triangles_after_clipping[MAX_NUM_POLYGON_TRIANGLES], int *num_triangles_after_clipping);
+
+/**
+ * Classifies a whole mesh by its bounds, transformed to view space by the matrix, which scales them at most by scale.
+ * CLIP_REJECT when all of it is outside one plane of the frustum, CLIP_ACCEPT when all of it is inside every plane,
+ * so that classify_clip_outcodes() would accept every one of its faces, and CLIP_POLYGON otherwise.
+ */
+clip_class classify_bounds_clipping(const bounds_t *bounds, const mat4_t *view_world_matrix, float scale);
+
+/**
+ * Clips the clip-space triangle against the near and far planes and the guard band, only against the planes in
+ * outcode_union, the OR of the outcodes of its vertices. The triangles left, with clip-space points, are written to
+ * triangles; returns their number.
+ */
+int clip_triangle(const vec4_t points[3], const tex2_t texcoords[3], clip_outcode_t outcode_union,
+                  triangle_t triangles[MAX_NUM_POLYGON_TRIANGLES]);
+
+// Line clipping for the wireframe; both return false when nothing of the line is left
+bool clip_line_against_near_far(vec3_t *a, vec3_t *b);
+bool clip_line_to_rect(vec2_t *a, vec2_t *b, float x_min, float y_min, float x_max, float y_max); // Cohen-Sutherland
 
 #endif
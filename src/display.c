@@ -1,4 +1,9 @@
 #include "display.h"
+#include "stats.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 static RenderMethod current_render_method = RENDER_TEXTURED_TRIANGLE;
 static BackfaceCullingOption current_backface_culling_option = CULLING_BACKFACE;
@@ -9,8 +14,28 @@ static SDL_Window *window = NULL;
 static int window_width = 320;
 static int window_height = 200;
 
-static color_t *color_buffer = NULL;             // Raw pixel data
-static float *z_buffer = NULL;                   // Depth buffer
+static color_t *color_buffer = NULL;             // Raw pixel data, in current_framebuffer_layout
+static void *framebuffer_allocation = NULL;      // Allocation of the color buffer, which is aligned to cache lines
+static color_t *present_buffer = NULL;           // Linear copy of the color buffer, for SDL, unless it is linear already
+static framebuffer_layout current_framebuffer_layout = FRAMEBUFFER_LINEAR;
+static pixel_storage current_pixel_storage = PIXEL_STORAGE_SPLIT;
+static size_t framebuffer_size = 0;              // Pixels of the color buffer, padded to whole tiles when tiled
+static int framebuffer_stride = 0;               // Pixels per row of the linear layout
+static int framebuffer_tiles_x = 0;
+static size_t color_group_stride = 0;            // Bytes from a group of FRAMEBUFFER_BLOCK_SIZE colors to the next one
+static size_t depth_group_stride = 0;            // Bytes from a group of FRAMEBUFFER_BLOCK_SIZE depths to the next one
+static unsigned int morton_spread[TILE_SIZE / FRAMEBUFFER_BLOCK_SIZE]; // Bits of a block coordinate, spread to the even bits
+static color_t *background_buffer = NULL;        // Clear color and grid, copied into the tiles of the color buffer
+static void *z_buffer = NULL;                    // Depth buffer, in current_depth_format; inside the color buffer when interleaved
+static depth_format current_depth_format = DEPTH_FORMAT_FLOAT;
+static uint8_t *depth_epochs = NULL;             // Clear epoch of every tile, for DEPTH_FORMAT_UNORM24_EPOCH
+static int depth_epochs_width = 0;
+static float *coarse_z_buffer = NULL;            // Maximum depth of every Z_BUFFER_BLOCK_SIZE block of the z-buffer
+static int coarse_z_buffer_width = 0;
+static int coarse_z_buffer_height = 0;
+static int *triangle_id_buffer = NULL;           // Visibility buffer: nearest triangle of every pixel
+static float *alpha_buffer = NULL;               // Visibility buffer: barycentric coordinates of every pixel
+static float *beta_buffer = NULL;
 static SDL_Texture *color_buffer_texture = NULL; // Texture to be displayed to the render target
 
 int get_window_width(void)
@@ -47,6 +72,123 @@ size_t inline get_pixel(const size_t i, const size_t j)
   return (window_width * j) + i;
 }
 
+framebuffer_layout get_framebuffer_layout(void)
+{
+  return current_framebuffer_layout;
+}
+
+void set_framebuffer_layout(framebuffer_layout layout)
+{
+  current_framebuffer_layout = layout;
+}
+
+const char *get_framebuffer_layout_name(framebuffer_layout layout)
+{
+  switch (layout)
+  {
+  case FRAMEBUFFER_LINEAR:
+    return "linear";
+  case FRAMEBUFFER_TILED:
+    return "tiled";
+  default:
+    return "unknown";
+  }
+}
+
+pixel_storage get_pixel_storage(void)
+{
+  return current_pixel_storage;
+}
+
+void set_pixel_storage(pixel_storage storage)
+{
+  current_pixel_storage = storage;
+}
+
+const char *get_pixel_storage_name(pixel_storage storage)
+{
+  switch (storage)
+  {
+  case PIXEL_STORAGE_SPLIT:
+    return "split";
+  case PIXEL_STORAGE_INTERLEAVED:
+    return "interleaved";
+  default:
+    return "unknown";
+  }
+}
+
+// In the tiled layout, tiles are stored row-major, each as TILE_SIZE * TILE_SIZE contiguous pixels. Inside a tile,
+// the blocks are in Morton order, so that neighboring blocks are close in memory in both directions.
+size_t get_framebuffer_index(int x, int y)
+{
+  if (current_framebuffer_layout == FRAMEBUFFER_LINEAR)
+  {
+    return (size_t)framebuffer_stride * y + x;
+  }
+  // Pixels are never negative, and unsigned divisions by the power-of-two sizes are shifts
+  unsigned int ux = (unsigned int)x;
+  unsigned int uy = (unsigned int)y;
+  size_t tile = (size_t)framebuffer_tiles_x * (uy / TILE_SIZE) + ux / TILE_SIZE;
+  unsigned int block = morton_spread[(ux % TILE_SIZE) / FRAMEBUFFER_BLOCK_SIZE] | morton_spread[(uy % TILE_SIZE) / FRAMEBUFFER_BLOCK_SIZE] << 1;
+  return tile * TILE_SIZE * TILE_SIZE +
+         block * FRAMEBUFFER_BLOCK_SIZE * FRAMEBUFFER_BLOCK_SIZE +
+         (uy % FRAMEBUFFER_BLOCK_SIZE) * FRAMEBUFFER_BLOCK_SIZE + ux % FRAMEBUFFER_BLOCK_SIZE;
+}
+
+bool are_framebuffer_rows_contiguous(void)
+{
+  return current_framebuffer_layout == FRAMEBUFFER_LINEAR && current_pixel_storage == PIXEL_STORAGE_SPLIT;
+}
+
+// The colors and depths of the pixel at index in the color buffer and z-buffer. Both are stored in groups of
+// FRAMEBUFFER_BLOCK_SIZE consecutive indices, which are interleaved with each other when the storage is.
+static color_t *get_color_buffer_at(size_t index)
+{
+  return (color_t *)((uint8_t *)color_buffer + index / FRAMEBUFFER_BLOCK_SIZE * color_group_stride) + index % FRAMEBUFFER_BLOCK_SIZE;
+}
+static void *get_depth_buffer_at(size_t index)
+{
+  return (uint8_t *)z_buffer + index / FRAMEBUFFER_BLOCK_SIZE * depth_group_stride +
+         index % FRAMEBUFFER_BLOCK_SIZE * get_depth_format_size(current_depth_format);
+}
+
+// Prepares the layout of the color buffer and z-buffer for the window size
+static void initialize_framebuffer_layout(void)
+{
+  framebuffer_tiles_x = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+  color_group_stride = sizeof(color_t) * FRAMEBUFFER_BLOCK_SIZE;
+  depth_group_stride = (size_t)get_depth_format_size(current_depth_format) * FRAMEBUFFER_BLOCK_SIZE;
+  if (current_pixel_storage == PIXEL_STORAGE_INTERLEAVED)
+  {
+    // Groups are padded to whole cache lines, or 16-bit depths would make 48-byte groups straddling two lines
+    color_group_stride = (color_group_stride + depth_group_stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    depth_group_stride = color_group_stride;
+  }
+
+  if (current_framebuffer_layout == FRAMEBUFFER_LINEAR)
+  {
+    // Interleaved groups must not straddle two rows
+    framebuffer_stride = window_width;
+    if (current_pixel_storage == PIXEL_STORAGE_INTERLEAVED)
+    {
+      framebuffer_stride = (window_width + FRAMEBUFFER_BLOCK_SIZE - 1) / FRAMEBUFFER_BLOCK_SIZE * FRAMEBUFFER_BLOCK_SIZE;
+    }
+    framebuffer_size = (size_t)framebuffer_stride * window_height;
+    return;
+  }
+  // Partial tiles at the right and bottom of the screen are padded, so that every tile is the same size
+  framebuffer_size = (size_t)framebuffer_tiles_x * TILE_SIZE * ((window_height + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE;
+  for (int i = 0; i < TILE_SIZE / FRAMEBUFFER_BLOCK_SIZE; i++)
+  {
+    morton_spread[i] = 0;
+    for (int bit = 0; (i >> bit) != 0; bit++)
+    {
+      morton_spread[i] |= (unsigned int)((i >> bit) & 1) << (2 * bit);
+    }
+  }
+}
+
 bool initialize_window(void)
 {
   if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
@@ -91,26 +233,84 @@ bool initialize_window(void)
 
   // SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 
+  initialize_framebuffer_layout();
+
   // Allocate memory for the color buffer
-  // This is a contiguous block of memory but we will interpret it as a 2D array
-  color_buffer = (color_t *)malloc(sizeof(color_t) * window_width * window_height);
+  // This is a contiguous block of memory but we will interpret it as a 2D array.
+  // When interleaved, it holds the z-buffer too, and every group of colors and depths starts a cache line.
+  framebuffer_allocation = malloc(color_group_stride * (framebuffer_size / FRAMEBUFFER_BLOCK_SIZE) + CACHE_LINE_SIZE);
 
-  if (color_buffer == NULL)
+  if (framebuffer_allocation == NULL)
   {
     fprintf(stderr, "ERROR: Failed to allocate memory for the color buffer.");
     return false;
   }
+  color_buffer = (color_t *)(((uintptr_t)framebuffer_allocation + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+
+  // SDL expects a linear image of only colors, so the color buffer is copied into one before it is displayed
+  if (current_framebuffer_layout != FRAMEBUFFER_LINEAR || current_pixel_storage != PIXEL_STORAGE_SPLIT)
+  {
+    present_buffer = (color_t *)malloc(sizeof(color_t) * window_width * window_height);
+
+    if (present_buffer == NULL)
+    {
+      fprintf(stderr, "ERROR: Failed to allocate memory for the present buffer.");
+      return false;
+    }
+  }
+
+  // Allocate memory for the background layer, of the same layout as the color buffer
+  background_buffer = (color_t *)malloc(sizeof(color_t) * framebuffer_size);
+
+  if (background_buffer == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the background.");
+    return false;
+  }
 
   // Allocate memory for the z-buffer
   // Also a contiguous block of memory interpreted as a 2D array
-  z_buffer = (float *)malloc(sizeof(float) * window_width * window_height);
+  if (current_pixel_storage == PIXEL_STORAGE_INTERLEAVED)
+  {
+    z_buffer = (uint8_t *)color_buffer + sizeof(color_t) * FRAMEBUFFER_BLOCK_SIZE;
+  }
+  else
+  {
+    z_buffer = malloc(get_depth_format_size(current_depth_format) * framebuffer_size);
+  }
+
+  // Epochs start at 0, so that the first clear of every tile really clears it
+  depth_epochs_width = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+  depth_epochs = (uint8_t *)calloc(depth_epochs_width * ((window_height + TILE_SIZE - 1) / TILE_SIZE), sizeof(uint8_t));
 
-  if (z_buffer == NULL)
+  if (z_buffer == NULL || depth_epochs == NULL)
   {
     fprintf(stderr, "ERROR: Failed to allocate memory for the z-buffer.");
     return false;
   }
 
+  // Allocate memory for the coarse z-buffer, one depth per block of pixels
+  coarse_z_buffer_width = (window_width + Z_BUFFER_BLOCK_SIZE - 1) / Z_BUFFER_BLOCK_SIZE;
+  coarse_z_buffer_height = (window_height + Z_BUFFER_BLOCK_SIZE - 1) / Z_BUFFER_BLOCK_SIZE;
+  coarse_z_buffer = (float *)malloc(sizeof(float) * coarse_z_buffer_width * coarse_z_buffer_height);
+
+  if (coarse_z_buffer == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the coarse z-buffer.");
+    return false;
+  }
+
+  // Allocate memory for the visibility buffer, kept as separate arrays so the span kernels can store whole vectors
+  triangle_id_buffer = (int *)malloc(sizeof(int) * window_width * window_height);
+  alpha_buffer = (float *)malloc(sizeof(float) * window_width * window_height);
+  beta_buffer = (float *)malloc(sizeof(float) * window_width * window_height);
+
+  if (triangle_id_buffer == NULL || alpha_buffer == NULL || beta_buffer == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the visibility buffer.");
+    return false;
+  }
+
   // Create the SDL Texture to display the color buffer
   color_buffer_texture = SDL_CreateTexture(
       renderer,
@@ -125,11 +325,32 @@ bool initialize_window(void)
 }
 void destroy_window(void)
 {
-  free(z_buffer);
+  free(triangle_id_buffer);
+  triangle_id_buffer = NULL;
+  free(alpha_buffer);
+  alpha_buffer = NULL;
+  free(beta_buffer);
+  beta_buffer = NULL;
+
+  free(coarse_z_buffer);
+  coarse_z_buffer = NULL;
+
+  if (current_pixel_storage == PIXEL_STORAGE_SPLIT)
+  {
+    free(z_buffer);
+  }
   z_buffer = NULL;
+  free(depth_epochs);
+  depth_epochs = NULL;
 
-  free(color_buffer);
+  free(framebuffer_allocation);
+  framebuffer_allocation = NULL;
   color_buffer = NULL;
+  free(present_buffer);
+  present_buffer = NULL;
+
+  free(background_buffer);
+  background_buffer = NULL;
 
   SDL_DestroyRenderer(renderer);
   renderer = NULL;
@@ -140,12 +361,81 @@ void destroy_window(void)
   SDL_Quit();
 }
 
+// Copies one row of a block, of count pixels, into the present buffer
+static void copy_block_row(color_t *destination, const color_t *source, int count)
+{
+#if defined(__SSE2__)
+  if (count == FRAMEBUFFER_BLOCK_SIZE)
+  {
+    for (int i = 0; i < FRAMEBUFFER_BLOCK_SIZE; i += 4)
+    {
+      _mm_storeu_si128((__m128i *)&destination[i], _mm_loadu_si128((const __m128i *)&source[i]));
+    }
+    return;
+  }
+#endif
+  memcpy(destination, source, sizeof(color_t) * count);
+}
+
+// Copies the colors of the tiled color buffer into the linear present buffer. The blocks of every tile are read in the order
+// they are stored, so the source is read sequentially; the padding outside the screen is skipped.
+static void detile_color_buffer(void)
+{
+  for (int tile_y = 0; tile_y < window_height; tile_y += TILE_SIZE)
+  {
+    for (int tile_x = 0; tile_x < window_width; tile_x += TILE_SIZE)
+    {
+      size_t tile_start = get_framebuffer_index(tile_x, tile_y);
+      for (int block_y = 0; block_y < TILE_SIZE / FRAMEBUFFER_BLOCK_SIZE; block_y++)
+      {
+        int y_start = tile_y + block_y * FRAMEBUFFER_BLOCK_SIZE;
+        int rows = window_height - y_start < FRAMEBUFFER_BLOCK_SIZE ? window_height - y_start : FRAMEBUFFER_BLOCK_SIZE;
+        for (int block_x = 0; block_x < TILE_SIZE / FRAMEBUFFER_BLOCK_SIZE && rows > 0; block_x++)
+        {
+          int x_start = tile_x + block_x * FRAMEBUFFER_BLOCK_SIZE;
+          int columns = window_width - x_start < FRAMEBUFFER_BLOCK_SIZE ? window_width - x_start : FRAMEBUFFER_BLOCK_SIZE;
+          if (columns <= 0)
+          {
+            break;
+          }
+          size_t block = tile_start + (morton_spread[block_x] | morton_spread[block_y] << 1) * FRAMEBUFFER_BLOCK_SIZE * FRAMEBUFFER_BLOCK_SIZE;
+          for (int row = 0; row < rows; row++)
+          {
+            copy_block_row(&present_buffer[get_pixel(x_start, y_start + row)], get_color_buffer_at(block + row * FRAMEBUFFER_BLOCK_SIZE), columns);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Copies the colors out of the linear interleaved color buffer, one group at a time
+static void deinterleave_color_buffer(void)
+{
+  for (int y = 0; y < window_height; y++)
+  {
+    for (int x = 0; x < window_width; x += FRAMEBUFFER_BLOCK_SIZE)
+    {
+      int columns = window_width - x < FRAMEBUFFER_BLOCK_SIZE ? window_width - x : FRAMEBUFFER_BLOCK_SIZE;
+      copy_block_row(&present_buffer[get_pixel(x, y)], get_color_buffer_at(get_framebuffer_index(x, y)), columns);
+    }
+  }
+}
+
 void render_color_buffer(void)
 {
+  if (current_framebuffer_layout == FRAMEBUFFER_TILED)
+  {
+    detile_color_buffer();
+  }
+  else if (current_pixel_storage == PIXEL_STORAGE_INTERLEAVED)
+  {
+    deinterleave_color_buffer();
+  }
   SDL_UpdateTexture(
       color_buffer_texture,
       NULL,
-      color_buffer,
+      present_buffer != NULL ? present_buffer : color_buffer,
       (int)(window_width * sizeof(color_t)));
   SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -156,110 +446,464 @@ void render_color_buffer(void)
  */
 void clear_color_buffer(color_t color)
 {
-  memset(color_buffer, color, sizeof(color_t) * window_width * window_height);
+  // memset() isn't possible here unless all four bytes of the color are the same
+  for (size_t i = 0; i < framebuffer_size; i++)
+  {
+    *get_color_buffer_at(i) = color;
+  }
+}
+
+depth_format get_depth_format(void)
+{
+  return current_depth_format;
+}
+
+void set_depth_format(depth_format format)
+{
+  current_depth_format = format;
+}
+
+const char *get_depth_format_name(depth_format format)
+{
+  switch (format)
+  {
+  case DEPTH_FORMAT_FLOAT:
+    return "float";
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+    return "reverse-float";
+  case DEPTH_FORMAT_UNORM16:
+    return "unorm16";
+  case DEPTH_FORMAT_UNORM24:
+    return "unorm24";
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+    return "unorm24-epoch";
+  default:
+    return "unknown";
+  }
+}
+
+int get_depth_format_size(depth_format format)
+{
+  return format == DEPTH_FORMAT_UNORM16 ? sizeof(uint16_t) : sizeof(uint32_t);
 }
 
-void clear_z_buffer(void)
+uint32_t get_depth_epoch_tag(int x, int y)
 {
-  for (int j = 0; j < window_height; j++)
+  if (current_depth_format != DEPTH_FORMAT_UNORM24_EPOCH)
   {
-    for (int i = 0; i < window_width; i++)
+    return 0;
+  }
+  return (uint32_t)depth_epochs[depth_epochs_width * (y / TILE_SIZE) + x / TILE_SIZE] << DEPTH_EPOCH_SHIFT;
+}
+
+// Prebuilds the background layer: the clear color with a grid line every GRID_SPACING pixels.
+// The padding of the tiled layout is filled too, since whole tiles are copied from it.
+void initialize_background(color_t color)
+{
+  int width = current_framebuffer_layout == FRAMEBUFFER_TILED ? framebuffer_tiles_x * TILE_SIZE : window_width;
+  int height = (int)(framebuffer_size / width);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
     {
-      z_buffer[get_pixel(i, j)] = 1.0;
+      background_buffer[get_framebuffer_index(x, y)] = x % GRID_SPACING == 0 || y % GRID_SPACING == 0 ? GRID_COLOR : color;
     }
   }
-  // memset() isn't possible here since floats are multibyte types.
 }
 
-float get_z_buffer_at(int x, int y)
+// Copies a row of pixels; streaming stores write around the cache, for pixels that won't be read again soon
+static void copy_pixel_row(color_t *destination, const color_t *source, int count, bool is_streaming)
 {
-  if (!is_valid_pixel(x, y))
+#if defined(__SSE2__)
+  if (is_streaming)
   {
-    return 1.0;
+    int x = 0;
+    for (; x < count && ((uintptr_t)&destination[x] & 15) != 0; x++)
+    {
+      destination[x] = source[x];
+    }
+    for (; x + 4 <= count; x += 4)
+    {
+      _mm_stream_si128((__m128i *)&destination[x], _mm_loadu_si128((const __m128i *)&source[x]));
+    }
+    for (; x < count; x++)
+    {
+      destination[x] = source[x];
+    }
+    return;
   }
-  return z_buffer[get_pixel(x, y)];
+#endif
+  memcpy(destination, source, sizeof(color_t) * count);
 }
-void update_z_buffer_at(int x, int y, float value)
+
+// Copies count consecutive pixel indices, starting at start, of the background layer into the color buffer.
+// Interleaved colors are only contiguous within a group, so they are copied a group at a time.
+static void copy_background_pixels(size_t start, int count, bool is_streaming)
 {
-  if (!is_valid_pixel(x, y))
+  size_t end = start + count;
+  size_t chunk = current_pixel_storage == PIXEL_STORAGE_INTERLEAVED ? FRAMEBUFFER_BLOCK_SIZE : end;
+  for (size_t i = start; i < end;)
   {
-    return;
+    size_t chunk_end = i - i % chunk + chunk < end ? i - i % chunk + chunk : end;
+    copy_pixel_row(get_color_buffer_at(i), &background_buffer[i], (int)(chunk_end - i), is_streaming);
+    i = chunk_end;
   }
-  z_buffer[get_pixel(x, y)] = value;
 }
 
-bool inline is_valid_pixel(int x, int y)
+void clear_color_buffer_tile(const tile_t *tile, bool is_streaming)
 {
-  return x < window_width && y < window_height && x >= 0 && y >= 0;
+  if (current_framebuffer_layout == FRAMEBUFFER_TILED)
+  {
+    copy_background_pixels(get_framebuffer_index(tile->x_min, tile->y_min), TILE_SIZE * TILE_SIZE, is_streaming);
+  }
+  else
+  {
+    for (int y = tile->y_min; y < tile->y_max; y++)
+    {
+      copy_background_pixels(get_framebuffer_index(tile->x_min, y), tile->x_max - tile->x_min, is_streaming);
+    }
+  }
+#if defined(__SSE2__)
+  if (is_streaming)
+  {
+    _mm_sfence(); // Streaming stores are weakly ordered; make them visible before the tile is presented
+  }
+#endif
 }
-void draw_pixel(int x, int y, color_t color)
+
+// Fills count contiguous depths with the farthest depth of the current format
+static void fill_depths(void *depths, int count)
+{
+  if (current_depth_format == DEPTH_FORMAT_UNORM16)
+  {
+    uint16_t *z = (uint16_t *)depths;
+    for (int i = 0; i < count; i++)
+    {
+      z[i] = DEPTH_UNORM16_MAX;
+    }
+  }
+  else if (current_depth_format == DEPTH_FORMAT_UNORM24 || current_depth_format == DEPTH_FORMAT_UNORM24_EPOCH)
+  {
+    uint32_t *z = (uint32_t *)depths;
+    for (int i = 0; i < count; i++)
+    {
+      z[i] = 0xFFFFFFFF;
+    }
+  }
+  else
+  {
+    float *z = (float *)depths;
+    float farthest_depth = current_depth_format == DEPTH_FORMAT_REVERSE_FLOAT ? 0.0f : 1.0f;
+    for (int i = 0; i < count; i++)
+    {
+      z[i] = farthest_depth;
+    }
+  }
+}
+
+// Fills the depths of count consecutive pixel indices, starting at start, a group at a time when interleaved
+static void fill_z_buffer_pixels(size_t start, int count)
+{
+  size_t end = start + count;
+  size_t chunk = current_pixel_storage == PIXEL_STORAGE_INTERLEAVED ? FRAMEBUFFER_BLOCK_SIZE : end;
+  for (size_t i = start; i < end;)
+  {
+    size_t chunk_end = i - i % chunk + chunk < end ? i - i % chunk + chunk : end;
+    fill_depths(get_depth_buffer_at(i), (int)(chunk_end - i));
+    i = chunk_end;
+  }
+  add_render_stat(STAT_DEPTH_BYTES_CLEARED, get_depth_format_size(current_depth_format) * count);
+}
+
+static void fill_z_buffer_tile(const tile_t *tile)
 {
-  if (!is_valid_pixel(x, y))
+  if (current_framebuffer_layout == FRAMEBUFFER_TILED)
   {
+    fill_z_buffer_pixels(get_framebuffer_index(tile->x_min, tile->y_min), TILE_SIZE * TILE_SIZE);
     return;
   }
-  color_buffer[get_pixel(x, y)] = color;
+  for (int y = tile->y_min; y < tile->y_max; y++)
+  {
+    fill_z_buffer_pixels(get_framebuffer_index(tile->x_min, y), tile->x_max - tile->x_min);
+  }
 }
-void draw_rect(int x, int y, int width, int height, color_t color)
+
+void clear_z_buffer_tile(const tile_t *tile)
 {
-  for (int current_x = 0; current_x < width; current_x++)
+  uint8_t *epoch = &depth_epochs[depth_epochs_width * (tile->y_min / TILE_SIZE) + tile->x_min / TILE_SIZE];
+  if (current_depth_format == DEPTH_FORMAT_UNORM24_EPOCH && *epoch > 0)
+  {
+    (*epoch)--;
+  }
+  else
   {
-    for (int current_y = 0; current_y < height; current_y++)
+    fill_z_buffer_tile(tile);
+    *epoch = DEPTH_EPOCH_MAX;
+  }
+
+  // Tiles are made of whole blocks, except for the partial blocks at the right and bottom of the screen
+  for (int block_y = tile->y_min / Z_BUFFER_BLOCK_SIZE; block_y < (tile->y_max + Z_BUFFER_BLOCK_SIZE - 1) / Z_BUFFER_BLOCK_SIZE; block_y++)
+  {
+    for (int block_x = tile->x_min / Z_BUFFER_BLOCK_SIZE; block_x < (tile->x_max + Z_BUFFER_BLOCK_SIZE - 1) / Z_BUFFER_BLOCK_SIZE; block_x++)
     {
-      draw_pixel(current_x + x, current_y + y, color);
+      coarse_z_buffer[coarse_z_buffer_width * block_y + block_x] = 1.0;
     }
   }
 }
-void draw_grid(void)
+
+// Marks the pixels of a tile as not covered by any triangle
+void clear_triangle_id_buffer(const tile_t *tile)
 {
-  for (int y = 0; y < window_height; y++)
+  for (int y = tile->y_min; y < tile->y_max; y++)
   {
-    for (int x = 0; x < window_width; x++)
+    int *triangle_id_row = get_triangle_id_buffer_row(y);
+    for (int x = tile->x_min; x < tile->x_max; x++)
+    {
+      triangle_id_row[x] = -1;
+    }
+  }
+}
+
+// Depth of the pixel as 1 - 1/w, rounded up so that the coarse z-buffer stays conservative
+static float get_depth_upper_bound(const void *depth_row, int x, uint32_t epoch_tag)
+{
+  switch (current_depth_format)
+  {
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+    return 1.0f - ((const float *)depth_row)[x];
+  case DEPTH_FORMAT_UNORM16:
+    return (((const uint16_t *)depth_row)[x] + 1.0f) / DEPTH_UNORM16_MAX;
+  case DEPTH_FORMAT_UNORM24:
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+  {
+    uint32_t depth = ((const uint32_t *)depth_row)[x];
+    if ((depth & ~(uint32_t)DEPTH_UNORM24_MAX) != epoch_tag)
+    {
+      return 1.0f; // Cleared, or written in an earlier epoch
+    }
+    return ((depth & DEPTH_UNORM24_MAX) + 1.0f) / DEPTH_UNORM24_MAX;
+  }
+  default:
+    return ((const float *)depth_row)[x];
+  }
+}
+
+float get_coarse_z_buffer_at(int block_x, int block_y)
+{
+  return coarse_z_buffer[coarse_z_buffer_width * block_y + block_x];
+}
+
+// Maximum depth of the blocks overlapping the pixels [x_min, x_max] x [y_min, y_max]
+float get_coarse_z_buffer_max(int x_min, int y_min, int x_max, int y_max)
+{
+  float max_depth = 0.0;
+  for (int block_y = y_min / Z_BUFFER_BLOCK_SIZE; block_y <= y_max / Z_BUFFER_BLOCK_SIZE; block_y++)
+  {
+    for (int block_x = x_min / Z_BUFFER_BLOCK_SIZE; block_x <= x_max / Z_BUFFER_BLOCK_SIZE; block_x++)
     {
-      if (x % 50 == 0 || y % 50 == 0)
+      float depth = get_coarse_z_buffer_at(block_x, block_y);
+      max_depth = depth > max_depth ? depth : max_depth;
+    }
+  }
+  return max_depth;
+}
+
+// Recomputes the maximum depth of a block after pixels in it were written
+void update_coarse_z_buffer_at(int block_x, int block_y)
+{
+  int x_start = block_x * Z_BUFFER_BLOCK_SIZE;
+  int y_start = block_y * Z_BUFFER_BLOCK_SIZE;
+  int x_end = x_start + Z_BUFFER_BLOCK_SIZE < window_width ? x_start + Z_BUFFER_BLOCK_SIZE : window_width;
+  int y_end = y_start + Z_BUFFER_BLOCK_SIZE < window_height ? y_start + Z_BUFFER_BLOCK_SIZE : window_height;
+
+  float max_depth = 0.0;
+  if (current_depth_format == DEPTH_FORMAT_FLOAT)
+  {
+    for (int y = y_start; y < y_end; y++)
+    {
+      const float *z_row = get_z_buffer_span(x_start, y);
+      for (int x = x_start; x < x_end; x++)
       {
-        draw_pixel(x, y, 0xFF444444);
+        max_depth = z_row[x] > max_depth ? z_row[x] : max_depth;
       }
     }
   }
+  else
+  {
+    uint32_t epoch_tag = get_depth_epoch_tag(x_start, y_start);
+    for (int y = y_start; y < y_end; y++)
+    {
+      const void *depth_row = get_depth_buffer_span(x_start, y);
+      for (int x = x_start; x < x_end; x++)
+      {
+        float depth = get_depth_upper_bound(depth_row, x, epoch_tag);
+        max_depth = depth > max_depth ? depth : max_depth;
+      }
+    }
+  }
+  coarse_z_buffer[coarse_z_buffer_width * block_y + block_x] = max_depth;
+}
+
+// The pointers stay inside the buffers: a block's index is at least its x, and groups are at least as large as their colors
+color_t *get_color_buffer_span(int x, int y)
+{
+  int block_x = x - x % FRAMEBUFFER_BLOCK_SIZE;
+  return get_color_buffer_at(get_framebuffer_index(block_x, y)) - block_x;
 }
-// Digital Differential Analyzer algorithm for drawing lines
-void draw_line(int x0, int y0, int x1, int y1, color_t color)
+void *get_depth_buffer_span(int x, int y)
 {
-  int delta_x = x1 - x0;
-  int delta_y = y1 - y0;
+  int block_x = x - x % FRAMEBUFFER_BLOCK_SIZE;
+  return (uint8_t *)get_depth_buffer_at(get_framebuffer_index(block_x, y)) - (size_t)get_depth_format_size(current_depth_format) * block_x;
+}
+float *get_z_buffer_span(int x, int y)
+{
+  return (float *)get_depth_buffer_span(x, y);
+}
 
-  // Get the longest side
-  int longest_side_length = abs(delta_x) >= abs(delta_y) ? abs(delta_x) : abs(delta_y);
+int *get_triangle_id_buffer_row(int y)
+{
+  return &triangle_id_buffer[get_pixel(0, y)];
+}
+float *get_alpha_buffer_row(int y)
+{
+  return &alpha_buffer[get_pixel(0, y)];
+}
+float *get_beta_buffer_row(int y)
+{
+  return &beta_buffer[get_pixel(0, y)];
+}
 
-  // Find out how much we should increment in both x and y each step
-  float x_inc = delta_x / (float)longest_side_length;
-  float y_inc = delta_y / (float)longest_side_length;
+void read_framebuffer(color_t *colors, void *depths)
+{
+  int depth_size = get_depth_format_size(current_depth_format);
+  uint8_t *depth = (uint8_t *)depths;
+  for (int y = 0; y < window_height; y++)
+  {
+    for (int x = 0; x < window_width; x++)
+    {
+      size_t index = get_framebuffer_index(x, y);
+      *colors++ = *get_color_buffer_at(index);
+      memcpy(depth, get_depth_buffer_at(index), depth_size);
+      if (current_depth_format == DEPTH_FORMAT_UNORM24_EPOCH)
+      {
+        *(uint32_t *)depth &= DEPTH_UNORM24_MAX;
+      }
+      depth += depth_size;
+    }
+  }
+}
 
-  float x_i = x0;
-  float y_i = y0;
+bool inline is_valid_pixel(int x, int y)
+{
+  return x < window_width && y < window_height && x >= 0 && y >= 0;
+}
+bool inline is_pixel_in_tile(int x, int y, const tile_t *tile)
+{
+  return x < tile->x_max && y < tile->y_max && x >= tile->x_min && y >= tile->y_min;
+}
+void draw_pixel(int x, int y, color_t color)
+{
+  *get_color_buffer_at(get_framebuffer_index(x, y)) = color;
+}
+// Only the part of the rectangle that overlaps the tile is drawn
+void draw_rect(int x, int y, int width, int height, color_t color, const tile_t *tile)
+{
+  int x_start = x > tile->x_min ? x : tile->x_min;
+  int y_start = y > tile->y_min ? y : tile->y_min;
+  int x_end = x + width < tile->x_max ? x + width : tile->x_max;
+  int y_end = y + height < tile->y_max ? y + height : tile->y_max;
+  for (int current_x = x_start; current_x < x_end; current_x++)
+  {
+    for (int current_y = y_start; current_y < y_end; current_y++)
+    {
+      draw_pixel(current_x, current_y, color);
+    }
+  }
+}
+// Bresenham's algorithm for drawing lines, in integers only.
+// The minor coordinate at step i along the major axis is minor_0 + round(i * minor_length / major_length), rounding
+// halves up. The first step inside the tile starts from that formula, so each tile only steps through its own part of
+// the line and the pixels it covers do not depend on the tile.
+void draw_line(int x0, int y0, int x1, int y1, color_t color, const tile_t *tile)
+{
+  int delta_x = abs(x1 - x0);
+  int delta_y = abs(y1 - y0);
+  int step_x = x1 >= x0 ? 1 : -1;
+  int step_y = y1 >= y0 ? 1 : -1;
+
+  if (delta_x == 0 && delta_y == 0)
+  {
+    if (is_pixel_in_tile(x0, y0, tile))
+    {
+      *get_color_buffer_at(get_framebuffer_index(x0, y0)) = color;
+      add_render_stat(STAT_LINE_PIXELS, 1);
+    }
+    return;
+  }
 
-  for (int i = 0; i <= longest_side_length; i++)
+  // Get the longest side
+  bool is_x_major = delta_x >= delta_y;
+  int major_length = is_x_major ? delta_x : delta_y;
+  int minor_length = is_x_major ? delta_y : delta_x;
+  int major_start = is_x_major ? x0 : y0;
+  int minor_start = is_x_major ? y0 : x0;
+  int major_step = is_x_major ? step_x : step_y;
+  int minor_step = is_x_major ? step_y : step_x;
+  int major_min = is_x_major ? tile->x_min : tile->y_min;
+  int major_max = is_x_major ? tile->x_max : tile->y_max;
+  int minor_min = is_x_major ? tile->y_min : tile->x_min;
+  int minor_max = is_x_major ? tile->y_max : tile->x_max;
+
+  // Steps of the line whose major coordinate is inside the tile
+  int first_step = major_step > 0 ? major_min - major_start : major_start - (major_max - 1);
+  int last_step = major_step > 0 ? major_max - 1 - major_start : major_start - major_min;
+  first_step = first_step > 0 ? first_step : 0;
+  last_step = last_step < major_length ? last_step : major_length;
+
+  int64_t denominator = 2 * (int64_t)major_length;
+  int64_t numerator = 2 * (int64_t)first_step * minor_length + major_length;
+  int minor = minor_start + minor_step * (int)(numerator / denominator);
+  int64_t error = numerator % denominator;
+
+  int pixels_drawn = 0;
+  for (int i = first_step; i <= last_step; i++)
   {
-    draw_pixel(round(x_i), round(y_i), color);
-    x_i += x_inc;
-    y_i += y_inc;
+    int major = major_start + major_step * i;
+    if (minor >= minor_min && minor < minor_max)
+    {
+      int x = is_x_major ? major : minor;
+      int y = is_x_major ? minor : major;
+      *get_color_buffer_at(get_framebuffer_index(x, y)) = color;
+      pixels_drawn++;
+    }
+    else if ((minor_step > 0) == (minor >= minor_max))
+    {
+      break; // The line has left the tile for good
+    }
+
+    error += 2 * minor_length;
+    if (error >= denominator)
+    {
+      error -= denominator;
+      minor += minor_step;
+    }
   }
+  add_render_stat(STAT_LINE_PIXELS, pixels_drawn);
 }
 
-void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, color_t color)
+void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, color_t color, const tile_t *tile)
 {
   draw_line(x0,
             y0,
             x1,
             y1,
-            color);
+            color, tile);
   draw_line(x1,
             y1,
             x2,
-            y2, color);
+            y2, color, tile);
   draw_line(x2,
             y2,
             x0,
-            y0, color);
+            y0, color, tile);
 }
\ No newline at end of file
@@ -11,6 +11,55 @@
 #define FPS 200
 #define FRAME_TIME (1000 / FPS)
 
+// Screen tiles are 64x64 so that a tile's slice of the color buffer and z-buffer (16KB each) stays in L2
+#define TILE_SIZE 64
+
+// The coarse z-buffer keeps one conservative maximum depth per block of 8x8 pixels
+#define Z_BUFFER_BLOCK_SIZE 8
+
+// Framebuffer layouts of the color buffer, its background layer and the z-buffer
+typedef enum framebuffer_layout
+{
+  FRAMEBUFFER_LINEAR, // Row-major, as SDL expects
+  FRAMEBUFFER_TILED,  // Every screen tile is contiguous, made of blocks in Morton order, each stored row-major
+  NUM_FRAMEBUFFER_LAYOUTS
+} framebuffer_layout;
+
+// In the tiled layout, the pixels of a block row are the only contiguous ones. The blocks line up with the raster
+// blocks, so the pixels of a raster block share cache lines. TILE_SIZE / FRAMEBUFFER_BLOCK_SIZE must be a power of two.
+#define FRAMEBUFFER_BLOCK_SIZE Z_BUFFER_BLOCK_SIZE
+
+// How the colors and depths of the pixels are stored, in either framebuffer layout
+typedef enum pixel_storage
+{
+  PIXEL_STORAGE_SPLIT,       // Separate color buffer and z-buffer
+  PIXEL_STORAGE_INTERLEAVED, // The colors then the depths of every group of FRAMEBUFFER_BLOCK_SIZE pixels of a block row
+                             // share a cache line, padded to a whole one, so a depth test and its color write touch one line
+  NUM_PIXEL_STORAGES
+} pixel_storage;
+
+#define CACHE_LINE_SIZE 64
+
+// Depth formats. All but the reverse float store 1 - 1/w, so that nearer pixels have smaller depths.
+typedef enum depth_format
+{
+  DEPTH_FORMAT_FLOAT,         // 32-bit float 1 - 1/w
+  DEPTH_FORMAT_REVERSE_FLOAT, // 32-bit float 1/w, which is more precise far away; nearer pixels have greater depths
+  DEPTH_FORMAT_UNORM16,       // 16-bit unsigned normalized, half the bandwidth
+  DEPTH_FORMAT_UNORM24,       // 24-bit unsigned normalized, in the low bits of 32-bit words
+  DEPTH_FORMAT_UNORM24_EPOCH, // 24-bit with the tile's clear epoch in the top 8 bits, so that clearing is O(1)
+  NUM_DEPTH_FORMATS
+} depth_format;
+
+#define DEPTH_UNORM16_MAX 0xFFFF
+#define DEPTH_UNORM24_MAX 0xFFFFFF
+#define DEPTH_EPOCH_SHIFT 24
+#define DEPTH_EPOCH_MAX 0xFE // 0xFF is left for the cleared depth 0xFFFFFFFF
+
+// Background grid
+#define GRID_SPACING 50
+#define GRID_COLOR 0xFF444444
+
 /**
  * Display
  * Contains functions for displaying the window and the color buffer.
@@ -24,6 +73,8 @@ typedef enum RenderMethod
   RENDER_TRIANGLE,
   RENDER_TEXTURED_TRIANGLE,
   RENDER_TEXTURED_WIREFRAME_TRIANGLE,
+  RENDER_TEXTURED_TRIANGLE_DEFERRED, // Rasterizes a visibility buffer, then textures every pixel once
+  RENDER_TEXTURED_TRIANGLE_PREPASS,  // Rasterizes depth only, then textures the triangles again where their depth is equal
 } RenderMethod;
 
 typedef enum BackfaceCullingOption
@@ -34,6 +85,15 @@ typedef enum BackfaceCullingOption
 
 typedef uint32_t color_t;
 
+// A rectangular region of the screen, [x_min, x_max) x [y_min, y_max)
+typedef struct tile
+{
+  int x_min;
+  int y_min;
+  int x_max;
+  int y_max;
+} tile_t;
+
 int get_window_width(void);
 int get_window_height(void);
 
@@ -42,21 +102,66 @@ BackfaceCullingOption get_backface_culling_option(void);
 void set_render_method(RenderMethod render_method);
 void set_backface_culling_option(BackfaceCullingOption backface_culling_option);
 
-size_t get_pixel(const size_t i, const size_t j);
+size_t get_pixel(const size_t i, const size_t j); // Row-major index, used by the visibility buffer
 bool initialize_window(void);
 void destroy_window(void);
 void render_color_buffer(void);
 void clear_color_buffer(color_t color);
-void clear_z_buffer(void);
+void clear_triangle_id_buffer(const tile_t *tile);
+
+// Lazy clearing: the tile binner clears only the tiles it draws this frame or drew last frame, from a prebuilt
+// background layer
+void initialize_background(color_t color);
+void clear_color_buffer_tile(const tile_t *tile, bool is_streaming); // Copies the background layer into the tile
+void clear_z_buffer_tile(const tile_t *tile);
 
 // Drawing Functions
 bool is_valid_pixel(int x, int y);
-void draw_pixel(int x, int y, color_t color);
-void draw_rect(int x, int y, int width, int height, color_t color);
-void draw_grid(void);
-void draw_line(int x0, int y0, int x1, int y1, color_t color);
-void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, color_t color);
-
-float get_z_buffer_at(int x, int y);
-void update_z_buffer_at(int x, int y, float value);
+bool is_pixel_in_tile(int x, int y, const tile_t *tile);
+void draw_pixel(int x, int y, color_t color); // (x, y) must be on screen: callers clip to their tile or the screen
+void draw_rect(int x, int y, int width, int height, color_t color, const tile_t *tile);
+void draw_line(int x0, int y0, int x1, int y1, color_t color, const tile_t *tile);
+void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, color_t color, const tile_t *tile);
+
+framebuffer_layout get_framebuffer_layout(void);
+void set_framebuffer_layout(framebuffer_layout layout); // Must be set before initialize_window()
+const char *get_framebuffer_layout_name(framebuffer_layout layout);
+size_t get_framebuffer_index(int x, int y); // Index of the pixel in the color buffer and z-buffer, in the current layout
+pixel_storage get_pixel_storage(void);
+void set_pixel_storage(pixel_storage storage); // Must be set before initialize_window()
+const char *get_pixel_storage_name(pixel_storage storage);
+
+depth_format get_depth_format(void);
+void set_depth_format(depth_format format); // Must be set before initialize_window()
+const char *get_depth_format_name(depth_format format);
+int get_depth_format_size(depth_format format); // Bytes per pixel
+
+// Epoch of the tile containing (x, y) in the top bits, to be added to the depths written into it this frame.
+// With DEPTH_FORMAT_UNORM24_EPOCH, every clear of the tile lowers its epoch rather than writing its pixels, which
+// makes the depths of earlier epochs compare as farther than any new one. The tile is only really cleared when its
+// epoch runs out. The other formats have no epochs and return 0.
+uint32_t get_depth_epoch_tag(int x, int y);
+
+// Coarse z-buffer: depths are only ever lowered between clears, so a block's maximum stays conservative
+// until update_coarse_z_buffer_at() tightens it again from the pixels of that block
+float get_coarse_z_buffer_at(int block_x, int block_y);
+float get_coarse_z_buffer_max(int x_min, int y_min, int x_max, int y_max);
+void update_coarse_z_buffer_at(int block_x, int block_y);
+
+// Direct access to the buffers, for the rasterizer's span kernels.
+// Returns a pointer p such that p[x'] is the pixel (x', y) for every x' in the same FRAMEBUFFER_BLOCK_SIZE block as x.
+// When the framebuffer rows are contiguous, in the linear layout with split storage, that is the whole row.
+bool are_framebuffer_rows_contiguous(void);
+color_t *get_color_buffer_span(int x, int y);
+void *get_depth_buffer_span(int x, int y); // In the current depth format
+float *get_z_buffer_span(int x, int y);    // Only for DEPTH_FORMAT_FLOAT
+
+// Visibility buffer: the nearest triangle of every pixel (-1 for none) and its barycentric coordinates there
+int *get_triangle_id_buffer_row(int y);
+float *get_alpha_buffer_row(int y);
+float *get_beta_buffer_row(int y);
+
+// Copies the colors and depths of the screen row by row, whatever the framebuffer layout and pixel storage, to compare
+// frames. depths receives get_depth_format_size() bytes per pixel, without the epoch tags, which every clear changes.
+void read_framebuffer(color_t *colors, void *depths);
 #endif
\ No newline at end of file
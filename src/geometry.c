@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include "geometry.h"
+#include "display.h"
+#include "array.h"
+
+static raster_kernel current_geometry_kernel = RASTER_KERNEL_SCALAR;
+
+raster_kernel get_geometry_kernel(void)
+{
+  return current_geometry_kernel;
+}
+
+// Kernels wider than what the CPU supports fall back to the best supported one
+void set_geometry_kernel(raster_kernel kernel)
+{
+  raster_kernel supported_kernel = detect_raster_kernel();
+  if (kernel > supported_kernel)
+  {
+    fprintf(stderr, "WARNING: %s geometry is not supported on this CPU, using %s.\n",
+            get_raster_kernel_name(kernel), get_raster_kernel_name(supported_kernel));
+    kernel = supported_kernel;
+  }
+  current_geometry_kernel = kernel;
+}
+
+bool allocate_vertex_soa(vertex_soa_t *soa, int capacity)
+{
+  soa->x = (float *)malloc(sizeof(float) * capacity);
+  soa->y = (float *)malloc(sizeof(float) * capacity);
+  soa->z = (float *)malloc(sizeof(float) * capacity);
+  soa->w = (float *)malloc(sizeof(float) * capacity);
+  soa->capacity = capacity;
+  if (soa->x == NULL || soa->y == NULL || soa->z == NULL || soa->w == NULL)
+  {
+    free_vertex_soa(soa);
+    return false;
+  }
+  return true;
+}
+
+void free_vertex_soa(vertex_soa_t *soa)
+{
+  free(soa->x);
+  free(soa->y);
+  free(soa->z);
+  free(soa->w);
+  *soa = (vertex_soa_t){};
+}
+
+vec4_t clip_to_screen(vec4_t projected_point)
+{
+  // +-------------+
+  // | Image Space |  <------ Apply perspective divide, mapping values from -1.0 to 1.0.
+  // +-------------+
+
+  // Perspective Divide
+  if (projected_point.w != 0.0)
+  {
+    projected_point.x /= projected_point.w;
+    projected_point.y /= projected_point.w;
+    projected_point.z /= projected_point.w;
+  }
+
+  // Invert the y values since the y value in screen space grows downward from the top
+  projected_point.y *= -1;
+
+  // +--------------+
+  // | Screen Space |  <------ Mapping values from [-1.0, 1.0] to [0, screen dimensions].
+  // +--------------+
+
+  // Scale into the view
+  projected_point.x *= (get_window_width() / 2.0);
+  projected_point.y *= (get_window_height() / 2.0);
+
+  // Translate projected points to the middle of the screen
+  projected_point.x += (get_window_width() / 2.0);
+  projected_point.y += (get_window_height() / 2.0);
+
+  return projected_point;
+}
+
+vec4_t project_to_screen(const mat4_t *projection, vec4_t point)
+{
+  // +------------+
+  // | Projection |  <------ Project to a "screen (2D)", simulating perspective
+  // +------------+
+  return clip_to_screen(mat4_matmul_vec_project(projection, point));
+}
+
+void transform_vertices_scalar(const mat4_t *matrix, const vec3_t *vertices, int first, int num_vertices, vertex_soa_t *transformed)
+{
+  for (int i = first; i < num_vertices; i++)
+  {
+    set_soa_vertex(transformed, i, mat4_matmul_vec(matrix, vec4_from_vec3(vertices[i])));
+  }
+}
+
+void project_vertices_scalar(const mat4_t *projection, const vertex_soa_t *vertices, int first, int num_vertices, vertex_soa_t *projected,
+                             clip_outcode_t *outcodes)
+{
+  for (int i = first; i < num_vertices; i++)
+  {
+    vec4_t clip_point = mat4_matmul_vec_project(projection, get_soa_vertex(vertices, i));
+    outcodes[i] = get_clip_outcode(clip_point);
+    set_soa_vertex(projected, i, clip_to_screen(clip_point));
+  }
+}
+
+int cull_faces_scalar(const face_t *faces, int first, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                      int *visible_faces, vec3_t *normals, int num_visible)
+{
+  for (int i = first; i < num_faces; i++)
+  {
+    vec4_t points[3] = {get_soa_vertex(vertices, faces[i].a), get_soa_vertex(vertices, faces[i].b), get_soa_vertex(vertices, faces[i].c)};
+    vec3_t normal = compute_triangle_normal(points);
+
+    // The camera ray is the camera_position - vertex.
+    // There is no need to use the camera position for the camera ray.
+    // By the end of view matrix multiplication, the camera WILL be at the origin.
+    vec3_t camera_ray = vec3_mul(vec3_from_vec4(points[0]), -1.0); // Vector from camera (now the origin) to point A
+    float dot = vec3_dot(normal, camera_ray);
+    if (is_backface_culling && dot < 0.0) // If dot < 0, then it should not be rendered
+    {
+      continue;
+    }
+    visible_faces[num_visible] = i;
+    normals[num_visible] = normal;
+    num_visible++;
+  }
+  return num_visible;
+}
+
+void transform_vertices(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed)
+{
+  switch (current_geometry_kernel)
+  {
+#if RASTER_HAS_X86_SIMD
+  case RASTER_KERNEL_AVX2:
+    transform_vertices_avx2(matrix, vertices, num_vertices, transformed);
+    break;
+  case RASTER_KERNEL_SSE2:
+    transform_vertices_sse2(matrix, vertices, num_vertices, transformed);
+    break;
+#endif
+  default:
+    transform_vertices_scalar(matrix, vertices, 0, num_vertices, transformed);
+    break;
+  }
+}
+
+void project_vertices(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                      clip_outcode_t *outcodes)
+{
+  switch (current_geometry_kernel)
+  {
+#if RASTER_HAS_X86_SIMD
+  case RASTER_KERNEL_AVX2:
+    project_vertices_avx2(projection, vertices, num_vertices, projected, outcodes);
+    break;
+  case RASTER_KERNEL_SSE2:
+    project_vertices_sse2(projection, vertices, num_vertices, projected, outcodes);
+    break;
+#endif
+  default:
+    project_vertices_scalar(projection, vertices, 0, num_vertices, projected, outcodes);
+    break;
+  }
+}
+
+int cull_faces(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+               int *visible_faces, vec3_t *normals)
+{
+  switch (current_geometry_kernel)
+  {
+#if RASTER_HAS_X86_SIMD
+  case RASTER_KERNEL_AVX2:
+    return cull_faces_avx2(faces, num_faces, vertices, is_backface_culling, visible_faces, normals);
+  case RASTER_KERNEL_SSE2:
+    return cull_faces_sse2(faces, num_faces, vertices, is_backface_culling, visible_faces, normals);
+#endif
+  default:
+    return cull_faces_scalar(faces, 0, num_faces, vertices, is_backface_culling, visible_faces, normals, 0);
+  }
+}
+
+// cull_faces() of the faces first..first + count - 1, appended after the num_visible faces already kept
+static int cull_face_range(const face_t *faces, int first, int count, const vertex_soa_t *vertices, bool is_backface_culling,
+                           int *visible_faces, vec3_t *normals, int num_visible)
+{
+  int num_range_visible = cull_faces(faces + first, count, vertices, is_backface_culling, visible_faces + num_visible, normals + num_visible);
+  for (int i = num_visible; i < num_visible + num_range_visible; i++)
+  {
+    visible_faces[i] += first;
+  }
+  return num_visible + num_range_visible;
+}
+
+int cull_meshlet_faces(const face_t *faces, const meshlet_t *meshlets, const vertex_soa_t *vertices, const mat4_t *view_world_matrix,
+                       bool is_backface_culling, bool is_frustum_culling, bool is_cone_culling, int *visible_faces,
+                       vec3_t *normals, meshlet_cull_counts_t *counts)
+{
+  *counts = (meshlet_cull_counts_t){};
+  float scale = get_matrix_max_scale(view_world_matrix);
+  int num_meshlets = array_length((void *)meshlets);
+  int num_visible = 0;
+
+  // The faces of consecutive meshlets that are not rejected are contiguous, so they are culled together in full packets
+  int range_first = 0;
+  int range_count = 0;
+  for (int i = 0; i < num_meshlets; i++)
+  {
+    const meshlet_t *meshlet = &meshlets[i];
+    meshlet_visibility visibility = classify_meshlet(meshlet, view_world_matrix, scale, is_frustum_culling, is_cone_culling);
+    if (visibility == MESHLET_VISIBLE)
+    {
+      counts->faces_tested += meshlet->num_faces;
+      if (range_count > 0 && range_first + range_count == meshlet->first_face)
+      {
+        range_count += meshlet->num_faces;
+        continue;
+      }
+      num_visible = cull_face_range(faces, range_first, range_count, vertices, is_backface_culling, visible_faces, normals, num_visible);
+      range_first = meshlet->first_face;
+      range_count = meshlet->num_faces;
+      continue;
+    }
+    counts->meshlets_outside_frustum += visibility == MESHLET_OUTSIDE_FRUSTUM;
+    counts->meshlets_back_facing += visibility == MESHLET_BACK_FACING;
+    counts->faces_rejected += meshlet->num_faces;
+  }
+  return cull_face_range(faces, range_first, range_count, vertices, is_backface_culling, visible_faces, normals, num_visible);
+}
@@ -0,0 +1,113 @@
+#ifndef GEOMETRY_RENENGINE_SFW
+#define GEOMETRY_RENENGINE_SFW
+
+#include <stdbool.h>
+
+#include "vector.h"
+#include "matrix.h"
+#include "triangle.h"
+#include "meshlet.h"
+#include "clipping.h"
+
+/**
+ * Geometry
+ * The per-vertex and per-face stages of the geometry pipeline: transforming the vertices of a mesh to view space,
+ * projecting them to the screen with their clip-space outcodes, and culling its back faces. The SSE2 and AVX2 kernels process packets of 4 or 8
+ * vertices or faces in structure-of-arrays registers. Like the span kernels, they must match the scalar kernels
+ * bit for bit, so every float operation is performed in the same order and precision.
+ */
+
+#define GEOMETRY_PACKET_SIZE 8
+
+// Vertices in structure-of-arrays form
+typedef struct vertex_soa
+{
+  float *x;
+  float *y;
+  float *z;
+  float *w;
+  int capacity;
+} vertex_soa_t;
+
+bool allocate_vertex_soa(vertex_soa_t *soa, int capacity);
+void free_vertex_soa(vertex_soa_t *soa);
+
+static inline vec4_t get_soa_vertex(const vertex_soa_t *soa, int i)
+{
+  vec4_t vertex = {.x = soa->x[i], .y = soa->y[i], .z = soa->z[i], .w = soa->w[i]};
+  return vertex;
+}
+
+static inline void set_soa_vertex(vertex_soa_t *soa, int i, vec4_t vertex)
+{
+  soa->x[i] = vertex.x;
+  soa->y[i] = vertex.y;
+  soa->z[i] = vertex.z;
+  soa->w[i] = vertex.w;
+}
+
+// Geometry kernels share the names and CPU support of the raster kernels
+raster_kernel get_geometry_kernel(void);
+void set_geometry_kernel(raster_kernel kernel);
+
+// Projects a view-space point to the screen, keeping w for perspective-correct interpolation. The reference of
+// project_vertices().
+vec4_t project_to_screen(const mat4_t *projection, vec4_t point);
+
+// The perspective divide and screen mapping of project_to_screen(), for a point already in clip space
+vec4_t clip_to_screen(vec4_t clip_point);
+
+// Multiplies every vertex, with w = 1, by the matrix
+void transform_vertices(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed);
+
+// project_to_screen() of every vertex, and the get_clip_outcode() of its clip-space point into outcodes
+void project_vertices(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                      clip_outcode_t *outcodes);
+
+/**
+ * Computes the normal of every face from its view-space vertices, as compute_triangle_normal() does, and keeps the
+ * faces that face the camera, or all of them when is_backface_culling is false. The indices of the faces kept are
+ * compacted into visible_faces, in order, and their normals into normals. Returns the number of faces kept.
+ */
+int cull_faces(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+               int *visible_faces, vec3_t *normals);
+
+// What cull_meshlet_faces() rejected
+typedef struct meshlet_cull_counts
+{
+  int meshlets_outside_frustum;
+  int meshlets_back_facing;
+  int faces_rejected; // Faces of the rejected meshlets
+  int faces_tested;   // Faces of the other meshlets, culled face by face
+} meshlet_cull_counts_t;
+
+/**
+ * cull_faces() of the faces of the meshlets not rejected as a whole by classify_meshlet(). The frustum is only
+ * tested when is_frustum_culling is set, and the normal cones when is_cone_culling is set, which requires
+ * is_backface_culling and a view-world matrix that rotates, translates and scales uniformly.
+ */
+int cull_meshlet_faces(const face_t *faces, const meshlet_t *meshlets, const vertex_soa_t *vertices, const mat4_t *view_world_matrix,
+                       bool is_backface_culling, bool is_frustum_culling, bool is_cone_culling, int *visible_faces,
+                       vec3_t *normals, meshlet_cull_counts_t *counts);
+
+// Kernels of the stages for the vertices or faces first..count - 1. The cull kernels append to visible_faces and
+// normals after the num_visible faces already there and return the new number of faces kept.
+void transform_vertices_scalar(const mat4_t *matrix, const vec3_t *vertices, int first, int num_vertices, vertex_soa_t *transformed);
+void project_vertices_scalar(const mat4_t *projection, const vertex_soa_t *vertices, int first, int num_vertices, vertex_soa_t *projected,
+                             clip_outcode_t *outcodes);
+int cull_faces_scalar(const face_t *faces, int first, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                      int *visible_faces, vec3_t *normals, int num_visible);
+#if RASTER_HAS_X86_SIMD
+void transform_vertices_sse2(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed);
+void project_vertices_sse2(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                           clip_outcode_t *outcodes);
+int cull_faces_sse2(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                    int *visible_faces, vec3_t *normals);
+void transform_vertices_avx2(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed);
+void project_vertices_avx2(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                           clip_outcode_t *outcodes);
+int cull_faces_avx2(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                    int *visible_faces, vec3_t *normals);
+#endif
+
+#endif
@@ -0,0 +1,377 @@
+#include <stddef.h>
+#include "geometry.h"
+#include "display.h"
+
+/**
+ * SIMD geometry kernels, in structure-of-arrays registers: 4 (SSE2) or 8 (AVX2) vertices or faces per iteration.
+ * They match the scalar kernels of geometry.c bit for bit: sums are added in the same order, square roots and
+ * divisions are IEEE exact like the scalar ones, the screen mapping is performed in double like in
+ * project_to_screen(), the outcodes compare the same clip-space points as get_clip_outcode(), and the vertices or
+ * faces left over at the end are handed to the scalar kernels.
+ */
+
+#if RASTER_HAS_X86_SIMD
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// The faces are gathered as arrays of ints, so a face is this many ints apart from the next
+#define FACE_STRIDE ((int)(sizeof(face_t) / sizeof(int)))
+
+//--------------------------------------------
+// SSE2: 4 vertices or faces per iteration
+//--------------------------------------------
+
+// SSE2 has no blendv: the lanes of mask take a, the others b
+static inline __m128 select_ps_sse2(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// One row of mat4_matmul_vec, added in the same order
+static inline __m128 matmul_row_sse2(const mat4_t *matrix, int row, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+  return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(matrix->m[row][0]), x),
+                                          _mm_mul_ps(_mm_set1_ps(matrix->m[row][1]), y)),
+                               _mm_mul_ps(_mm_set1_ps(matrix->m[row][2]), z)),
+                    _mm_mul_ps(_mm_set1_ps(matrix->m[row][3]), w));
+}
+
+// (float)((double)value * half_size), then (float)((double)value + half_size), the screen mapping of project_to_screen
+static inline __m128 map_to_screen_sse2(__m128 value, double half_size)
+{
+  const __m128d half = _mm_set1_pd(half_size);
+  __m128d low = _mm_cvtps_pd(value);
+  __m128d high = _mm_cvtps_pd(_mm_movehl_ps(value, value));
+  __m128 scaled = _mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(low, half)), _mm_cvtpd_ps(_mm_mul_pd(high, half)));
+  low = _mm_cvtps_pd(scaled);
+  high = _mm_cvtps_pd(_mm_movehl_ps(scaled, scaled));
+  return _mm_movelh_ps(_mm_cvtpd_ps(_mm_add_pd(low, half)), _mm_cvtpd_ps(_mm_add_pd(high, half)));
+}
+
+// The lanes of mask as the outcode bit, the others as 0
+static inline __m128i outcode_bit_sse2(__m128 mask, clip_outcode_t bit)
+{
+  return _mm_and_si128(_mm_castps_si128(mask), _mm_set1_epi32(bit));
+}
+
+// get_clip_outcode() of the 4 clip-space points, stored as 4 outcodes
+static inline void store_outcodes_sse2(clip_outcode_t *outcodes, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 minus_w = _mm_xor_ps(w, sign);
+  __m128 guard_band_w = _mm_mul_ps(_mm_set1_ps(GUARD_BAND_SCALE), w);
+  __m128 minus_guard_band_w = _mm_xor_ps(guard_band_w, sign);
+  __m128i codes = _mm_or_si128(_mm_or_si128(outcode_bit_sse2(_mm_cmple_ps(x, minus_w), CLIP_OUTCODE_LEFT),
+                                            outcode_bit_sse2(_mm_cmpge_ps(x, w), CLIP_OUTCODE_RIGHT)),
+                               _mm_or_si128(outcode_bit_sse2(_mm_cmpge_ps(y, w), CLIP_OUTCODE_TOP),
+                                            outcode_bit_sse2(_mm_cmple_ps(y, minus_w), CLIP_OUTCODE_BOTTOM)));
+  codes = _mm_or_si128(codes, _mm_or_si128(outcode_bit_sse2(_mm_cmple_ps(z, _mm_setzero_ps()), CLIP_OUTCODE_NEAR),
+                                           outcode_bit_sse2(_mm_cmpge_ps(z, w), CLIP_OUTCODE_FAR)));
+  codes = _mm_or_si128(codes, _mm_or_si128(_mm_or_si128(outcode_bit_sse2(_mm_cmple_ps(x, minus_guard_band_w), CLIP_OUTCODE_GUARD_LEFT),
+                                                        outcode_bit_sse2(_mm_cmpge_ps(x, guard_band_w), CLIP_OUTCODE_GUARD_RIGHT)),
+                                           _mm_or_si128(outcode_bit_sse2(_mm_cmpge_ps(y, guard_band_w), CLIP_OUTCODE_GUARD_TOP),
+                                                        outcode_bit_sse2(_mm_cmple_ps(y, minus_guard_band_w), CLIP_OUTCODE_GUARD_BOTTOM))));
+  _mm_storel_epi64((__m128i *)outcodes, _mm_packs_epi32(codes, codes));
+}
+
+static inline void store_vertices_sse2(vertex_soa_t *soa, int i, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+  _mm_storeu_ps(soa->x + i, x);
+  _mm_storeu_ps(soa->y + i, y);
+  _mm_storeu_ps(soa->z + i, z);
+  _mm_storeu_ps(soa->w + i, w);
+}
+
+// vec3_normalize: divides by the length, whose float sum is rounded by sqrt like the double sqrt of vec3_length
+static inline void normalize_sse2(__m128 *x, __m128 *y, __m128 *z)
+{
+  __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(*x, *x), _mm_mul_ps(*y, *y)), _mm_mul_ps(*z, *z)));
+  *x = _mm_div_ps(*x, length);
+  *y = _mm_div_ps(*y, length);
+  *z = _mm_div_ps(*z, length);
+}
+
+void transform_vertices_sse2(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  int i = 0;
+  for (; i + 4 <= num_vertices; i += 4)
+  {
+    const vec3_t *v = &vertices[i];
+    __m128 x = _mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x);
+    __m128 y = _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y);
+    __m128 z = _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z);
+    store_vertices_sse2(transformed, i,
+                        matmul_row_sse2(matrix, 0, x, y, z, one), matmul_row_sse2(matrix, 1, x, y, z, one),
+                        matmul_row_sse2(matrix, 2, x, y, z, one), matmul_row_sse2(matrix, 3, x, y, z, one));
+  }
+  transform_vertices_scalar(matrix, vertices, i, num_vertices, transformed);
+}
+
+void project_vertices_sse2(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                           clip_outcode_t *outcodes)
+{
+  const double half_width = get_window_width() / 2.0;
+  const double half_height = get_window_height() / 2.0;
+  int i = 0;
+  for (; i + 4 <= num_vertices; i += 4)
+  {
+    __m128 x = _mm_loadu_ps(vertices->x + i);
+    __m128 y = _mm_loadu_ps(vertices->y + i);
+    __m128 z = _mm_loadu_ps(vertices->z + i);
+    __m128 w = _mm_loadu_ps(vertices->w + i);
+    __m128 px = matmul_row_sse2(projection, 0, x, y, z, w);
+    __m128 py = matmul_row_sse2(projection, 1, x, y, z, w);
+    __m128 pz = matmul_row_sse2(projection, 2, x, y, z, w);
+    __m128 pw = matmul_row_sse2(projection, 3, x, y, z, w);
+    store_outcodes_sse2(outcodes + i, px, py, pz, pw);
+
+    // Perspective divide, except where w is 0
+    __m128 has_w = _mm_cmpneq_ps(pw, _mm_setzero_ps());
+    px = select_ps_sse2(has_w, _mm_div_ps(px, pw), px);
+    py = select_ps_sse2(has_w, _mm_div_ps(py, pw), py);
+    pz = select_ps_sse2(has_w, _mm_div_ps(pz, pw), pz);
+
+    py = _mm_mul_ps(py, _mm_set1_ps(-1.0f));
+    store_vertices_sse2(projected, i, map_to_screen_sse2(px, half_width), map_to_screen_sse2(py, half_height), pz, pw);
+  }
+  project_vertices_scalar(projection, vertices, i, num_vertices, projected, outcodes);
+}
+
+int cull_faces_sse2(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                    int *visible_faces, vec3_t *normals)
+{
+  int num_visible = 0;
+  int i = 0;
+  for (; i + 4 <= num_faces; i += 4)
+  {
+    const face_t *f = &faces[i];
+    __m128 ax = _mm_setr_ps(vertices->x[f[0].a], vertices->x[f[1].a], vertices->x[f[2].a], vertices->x[f[3].a]);
+    __m128 ay = _mm_setr_ps(vertices->y[f[0].a], vertices->y[f[1].a], vertices->y[f[2].a], vertices->y[f[3].a]);
+    __m128 az = _mm_setr_ps(vertices->z[f[0].a], vertices->z[f[1].a], vertices->z[f[2].a], vertices->z[f[3].a]);
+    __m128 bx = _mm_setr_ps(vertices->x[f[0].b], vertices->x[f[1].b], vertices->x[f[2].b], vertices->x[f[3].b]);
+    __m128 by = _mm_setr_ps(vertices->y[f[0].b], vertices->y[f[1].b], vertices->y[f[2].b], vertices->y[f[3].b]);
+    __m128 bz = _mm_setr_ps(vertices->z[f[0].b], vertices->z[f[1].b], vertices->z[f[2].b], vertices->z[f[3].b]);
+    __m128 cx = _mm_setr_ps(vertices->x[f[0].c], vertices->x[f[1].c], vertices->x[f[2].c], vertices->x[f[3].c]);
+    __m128 cy = _mm_setr_ps(vertices->y[f[0].c], vertices->y[f[1].c], vertices->y[f[2].c], vertices->y[f[3].c]);
+    __m128 cz = _mm_setr_ps(vertices->z[f[0].c], vertices->z[f[1].c], vertices->z[f[2].c], vertices->z[f[3].c]);
+
+    // compute_triangle_normal
+    __m128 abx = _mm_sub_ps(bx, ax);
+    __m128 aby = _mm_sub_ps(by, ay);
+    __m128 abz = _mm_sub_ps(bz, az);
+    __m128 acx = _mm_sub_ps(cx, ax);
+    __m128 acy = _mm_sub_ps(cy, ay);
+    __m128 acz = _mm_sub_ps(cz, az);
+    normalize_sse2(&abx, &aby, &abz);
+    normalize_sse2(&acx, &acy, &acz);
+    __m128 nx = _mm_sub_ps(_mm_mul_ps(aby, acz), _mm_mul_ps(abz, acy));
+    __m128 ny = _mm_sub_ps(_mm_mul_ps(abz, acx), _mm_mul_ps(abx, acz));
+    __m128 nz = _mm_sub_ps(_mm_mul_ps(abx, acy), _mm_mul_ps(aby, acx));
+    normalize_sse2(&nx, &ny, &nz);
+
+    // Dot product with the camera ray, -a
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_mul_ps(minus_one, ax)), _mm_mul_ps(ny, _mm_mul_ps(minus_one, ay))),
+                            _mm_mul_ps(nz, _mm_mul_ps(minus_one, az)));
+    int visible_bits = is_backface_culling ? ~_mm_movemask_ps(_mm_cmplt_ps(dot, _mm_setzero_ps())) & 0xF : 0xF;
+
+    float lane_x[4];
+    float lane_y[4];
+    float lane_z[4];
+    _mm_storeu_ps(lane_x, nx);
+    _mm_storeu_ps(lane_y, ny);
+    _mm_storeu_ps(lane_z, nz);
+    for (int lane = 0; lane < 4; lane++)
+    {
+      if (visible_bits & (1 << lane))
+      {
+        visible_faces[num_visible] = i + lane;
+        normals[num_visible] = vec3_create(lane_x[lane], lane_y[lane], lane_z[lane]);
+        num_visible++;
+      }
+    }
+  }
+  return cull_faces_scalar(faces, i, num_faces, vertices, is_backface_culling, visible_faces, normals, num_visible);
+}
+
+//--------------------------------------------
+// AVX2: 8 vertices or faces per iteration
+//--------------------------------------------
+
+AVX2_TARGET static inline __m256 matmul_row_avx2(const mat4_t *matrix, int row, __m256 x, __m256 y, __m256 z, __m256 w)
+{
+  return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(matrix->m[row][0]), x),
+                                                   _mm256_mul_ps(_mm256_set1_ps(matrix->m[row][1]), y)),
+                                     _mm256_mul_ps(_mm256_set1_ps(matrix->m[row][2]), z)),
+                       _mm256_mul_ps(_mm256_set1_ps(matrix->m[row][3]), w));
+}
+
+AVX2_TARGET static inline __m256 map_to_screen_avx2(__m256 value, double half_size)
+{
+  const __m256d half = _mm256_set1_pd(half_size);
+  __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(value));
+  __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(value, 1));
+  __m256 scaled = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_mul_pd(low, half))),
+                                       _mm256_cvtpd_ps(_mm256_mul_pd(high, half)), 1);
+  low = _mm256_cvtps_pd(_mm256_castps256_ps128(scaled));
+  high = _mm256_cvtps_pd(_mm256_extractf128_ps(scaled, 1));
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_add_pd(low, half))),
+                              _mm256_cvtpd_ps(_mm256_add_pd(high, half)), 1);
+}
+
+AVX2_TARGET static inline __m256i outcode_bit_avx2(__m256 mask, clip_outcode_t bit)
+{
+  return _mm256_and_si256(_mm256_castps_si256(mask), _mm256_set1_epi32(bit));
+}
+
+AVX2_TARGET static inline void store_outcodes_avx2(clip_outcode_t *outcodes, __m256 x, __m256 y, __m256 z, __m256 w)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 minus_w = _mm256_xor_ps(w, sign);
+  __m256 guard_band_w = _mm256_mul_ps(_mm256_set1_ps(GUARD_BAND_SCALE), w);
+  __m256 minus_guard_band_w = _mm256_xor_ps(guard_band_w, sign);
+  __m256i codes = _mm256_or_si256(_mm256_or_si256(outcode_bit_avx2(_mm256_cmp_ps(x, minus_w, _CMP_LE_OQ), CLIP_OUTCODE_LEFT),
+                                                  outcode_bit_avx2(_mm256_cmp_ps(x, w, _CMP_GE_OQ), CLIP_OUTCODE_RIGHT)),
+                                  _mm256_or_si256(outcode_bit_avx2(_mm256_cmp_ps(y, w, _CMP_GE_OQ), CLIP_OUTCODE_TOP),
+                                                  outcode_bit_avx2(_mm256_cmp_ps(y, minus_w, _CMP_LE_OQ), CLIP_OUTCODE_BOTTOM)));
+  codes = _mm256_or_si256(codes, _mm256_or_si256(outcode_bit_avx2(_mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LE_OQ), CLIP_OUTCODE_NEAR),
+                                                 outcode_bit_avx2(_mm256_cmp_ps(z, w, _CMP_GE_OQ), CLIP_OUTCODE_FAR)));
+  codes = _mm256_or_si256(codes, _mm256_or_si256(_mm256_or_si256(outcode_bit_avx2(_mm256_cmp_ps(x, minus_guard_band_w, _CMP_LE_OQ), CLIP_OUTCODE_GUARD_LEFT),
+                                                                 outcode_bit_avx2(_mm256_cmp_ps(x, guard_band_w, _CMP_GE_OQ), CLIP_OUTCODE_GUARD_RIGHT)),
+                                                 _mm256_or_si256(outcode_bit_avx2(_mm256_cmp_ps(y, guard_band_w, _CMP_GE_OQ), CLIP_OUTCODE_GUARD_TOP),
+                                                                 outcode_bit_avx2(_mm256_cmp_ps(y, minus_guard_band_w, _CMP_LE_OQ), CLIP_OUTCODE_GUARD_BOTTOM))));
+  // The 8 codes fit in 16 bits, so the two halves are packed without saturating
+  _mm_storeu_si128((__m128i *)outcodes, _mm_packs_epi32(_mm256_castsi256_si128(codes), _mm256_extracti128_si256(codes, 1)));
+}
+
+AVX2_TARGET static inline void store_vertices_avx2(vertex_soa_t *soa, int i, __m256 x, __m256 y, __m256 z, __m256 w)
+{
+  _mm256_storeu_ps(soa->x + i, x);
+  _mm256_storeu_ps(soa->y + i, y);
+  _mm256_storeu_ps(soa->z + i, z);
+  _mm256_storeu_ps(soa->w + i, w);
+}
+
+AVX2_TARGET static inline void normalize_avx2(__m256 *x, __m256 *y, __m256 *z)
+{
+  __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(*x, *x), _mm256_mul_ps(*y, *y)), _mm256_mul_ps(*z, *z)));
+  *x = _mm256_div_ps(*x, length);
+  *y = _mm256_div_ps(*y, length);
+  *z = _mm256_div_ps(*z, length);
+}
+
+AVX2_TARGET void transform_vertices_avx2(const mat4_t *matrix, const vec3_t *vertices, int num_vertices, vertex_soa_t *transformed)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21); // vec3_t is 3 floats
+  int i = 0;
+  for (; i + 8 <= num_vertices; i += 8)
+  {
+    const float *v = &vertices[i].x;
+    __m256 x = _mm256_i32gather_ps(v, offsets, 4);
+    __m256 y = _mm256_i32gather_ps(v + 1, offsets, 4);
+    __m256 z = _mm256_i32gather_ps(v + 2, offsets, 4);
+    store_vertices_avx2(transformed, i,
+                        matmul_row_avx2(matrix, 0, x, y, z, one), matmul_row_avx2(matrix, 1, x, y, z, one),
+                        matmul_row_avx2(matrix, 2, x, y, z, one), matmul_row_avx2(matrix, 3, x, y, z, one));
+  }
+  transform_vertices_scalar(matrix, vertices, i, num_vertices, transformed);
+}
+
+AVX2_TARGET void project_vertices_avx2(const mat4_t *projection, const vertex_soa_t *vertices, int num_vertices, vertex_soa_t *projected,
+                                       clip_outcode_t *outcodes)
+{
+  const double half_width = get_window_width() / 2.0;
+  const double half_height = get_window_height() / 2.0;
+  int i = 0;
+  for (; i + 8 <= num_vertices; i += 8)
+  {
+    __m256 x = _mm256_loadu_ps(vertices->x + i);
+    __m256 y = _mm256_loadu_ps(vertices->y + i);
+    __m256 z = _mm256_loadu_ps(vertices->z + i);
+    __m256 w = _mm256_loadu_ps(vertices->w + i);
+    __m256 px = matmul_row_avx2(projection, 0, x, y, z, w);
+    __m256 py = matmul_row_avx2(projection, 1, x, y, z, w);
+    __m256 pz = matmul_row_avx2(projection, 2, x, y, z, w);
+    __m256 pw = matmul_row_avx2(projection, 3, x, y, z, w);
+    store_outcodes_avx2(outcodes + i, px, py, pz, pw);
+
+    __m256 has_w = _mm256_cmp_ps(pw, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+    px = _mm256_blendv_ps(px, _mm256_div_ps(px, pw), has_w);
+    py = _mm256_blendv_ps(py, _mm256_div_ps(py, pw), has_w);
+    pz = _mm256_blendv_ps(pz, _mm256_div_ps(pz, pw), has_w);
+
+    py = _mm256_mul_ps(py, _mm256_set1_ps(-1.0f));
+    store_vertices_avx2(projected, i, map_to_screen_avx2(px, half_width), map_to_screen_avx2(py, half_height), pz, pw);
+  }
+  project_vertices_scalar(projection, vertices, i, num_vertices, projected, outcodes);
+}
+
+AVX2_TARGET int cull_faces_avx2(const face_t *faces, int num_faces, const vertex_soa_t *vertices, bool is_backface_culling,
+                                int *visible_faces, vec3_t *normals)
+{
+  const __m256i lane_offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(FACE_STRIDE));
+  const int *face_ints = (const int *)faces;
+  int num_visible = 0;
+  int i = 0;
+  for (; i + 8 <= num_faces; i += 8)
+  {
+    __m256i face_offsets = _mm256_add_epi32(_mm256_set1_epi32(i * FACE_STRIDE), lane_offsets);
+    __m256i a = _mm256_i32gather_epi32(face_ints + offsetof(face_t, a) / sizeof(int), face_offsets, 4);
+    __m256i b = _mm256_i32gather_epi32(face_ints + offsetof(face_t, b) / sizeof(int), face_offsets, 4);
+    __m256i c = _mm256_i32gather_epi32(face_ints + offsetof(face_t, c) / sizeof(int), face_offsets, 4);
+    __m256 ax = _mm256_i32gather_ps(vertices->x, a, 4);
+    __m256 ay = _mm256_i32gather_ps(vertices->y, a, 4);
+    __m256 az = _mm256_i32gather_ps(vertices->z, a, 4);
+    __m256 bx = _mm256_i32gather_ps(vertices->x, b, 4);
+    __m256 by = _mm256_i32gather_ps(vertices->y, b, 4);
+    __m256 bz = _mm256_i32gather_ps(vertices->z, b, 4);
+    __m256 cx = _mm256_i32gather_ps(vertices->x, c, 4);
+    __m256 cy = _mm256_i32gather_ps(vertices->y, c, 4);
+    __m256 cz = _mm256_i32gather_ps(vertices->z, c, 4);
+
+    __m256 abx = _mm256_sub_ps(bx, ax);
+    __m256 aby = _mm256_sub_ps(by, ay);
+    __m256 abz = _mm256_sub_ps(bz, az);
+    __m256 acx = _mm256_sub_ps(cx, ax);
+    __m256 acy = _mm256_sub_ps(cy, ay);
+    __m256 acz = _mm256_sub_ps(cz, az);
+    normalize_avx2(&abx, &aby, &abz);
+    normalize_avx2(&acx, &acy, &acz);
+    __m256 nx = _mm256_sub_ps(_mm256_mul_ps(aby, acz), _mm256_mul_ps(abz, acy));
+    __m256 ny = _mm256_sub_ps(_mm256_mul_ps(abz, acx), _mm256_mul_ps(abx, acz));
+    __m256 nz = _mm256_sub_ps(_mm256_mul_ps(abx, acy), _mm256_mul_ps(aby, acx));
+    normalize_avx2(&nx, &ny, &nz);
+
+    const __m256 minus_one = _mm256_set1_ps(-1.0f);
+    __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_mul_ps(minus_one, ax)), _mm256_mul_ps(ny, _mm256_mul_ps(minus_one, ay))),
+                               _mm256_mul_ps(nz, _mm256_mul_ps(minus_one, az)));
+    int visible_bits = is_backface_culling ? ~_mm256_movemask_ps(_mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_LT_OQ)) & 0xFF : 0xFF;
+
+    float lane_x[8];
+    float lane_y[8];
+    float lane_z[8];
+    _mm256_storeu_ps(lane_x, nx);
+    _mm256_storeu_ps(lane_y, ny);
+    _mm256_storeu_ps(lane_z, nz);
+    for (int lane = 0; lane < 8; lane++)
+    {
+      if (visible_bits & (1 << lane))
+      {
+        visible_faces[num_visible] = i + lane;
+        normals[num_visible] = vec3_create(lane_x[lane], lane_y[lane], lane_z[lane]);
+        num_visible++;
+      }
+    }
+  }
+  return cull_faces_scalar(faces, i, num_faces, vertices, is_backface_culling, visible_faces, normals, num_visible);
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -13,6 +14,10 @@
 #include "mesh.h"
 #include "camera.h"
 #include "light.h"
+#include "tiles.h"
+#include "stats.h"
+#include "geometry.h"
+#include "benchmark.h"
 
 bool is_running = false;
 uint64_t previous_frame_time = 0;
@@ -22,19 +27,71 @@ float delta_time = 0;
 triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
 int num_triangles_to_render = 0;
 
+// Wireframe lines in screen space, clipped to the screen. Each edge of a mesh is drawn once, even when shared by two
+// visible faces.
+#define MAX_LINES_TO_RENDER (3 * MAX_TRIANGLES_PER_MESH)
+typedef struct line
+{
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+} line_t;
+line_t lines_to_render[MAX_LINES_TO_RENDER];
+int num_lines_to_render = 0;
+
+// Per-mesh post-transform vertex cache, sized for the largest mesh at setup. Every vertex of the mesh is transformed
+// to view space and projected to the screen once, with its clip-space outcode, then the faces are assembled from them
+// by index. The faces that face the camera are compacted into visible_faces, with their normals.
+vertex_soa_t view_vertices = {};
+vertex_soa_t screen_vertices = {};
+clip_outcode_t *vertex_outcodes = NULL;
+int *visible_faces = NULL;
+vec3_t *visible_face_normals = NULL;
+
+// Per-mesh scratch of the wireframe: which edges belong to a visible face
+bool *wireframe_visible_edges = NULL;
+
+// Number of threads rasterizing screen tiles, set with --threads at startup
+int num_render_threads = 0;
+
+// Span kernel used by the rasterizers, detected from the CPU unless forced with --raster-kernel
+raster_kernel requested_raster_kernel = NUM_RASTER_KERNELS;
+
+// Geometry kernel of the vertex and face stages, detected from the CPU unless forced with --geometry-kernel
+raster_kernel requested_geometry_kernel = NUM_RASTER_KERNELS;
+
+// With --benchmark, the number of frames to render without the frame rate cap before printing their average time
+int benchmark_frames = 0;
+
+// With --texture-benchmark, the PNG whose sampling is measured in every texture format instead of rendering
+char *texture_benchmark_path = NULL;
+
+// With --geometry-benchmark, the OBJ whose geometry stages are measured with every geometry kernel instead of rendering
+char *geometry_benchmark_path = NULL;
+
+// With --raster-kernel-test, the starting view is rendered with every span kernel and compared instead of rendering
+bool is_raster_kernel_test = false;
+
+// With --watertight-test, the closed convex OBJ whose triangles are rasterized one by one with every span kernel to
+// check that they cover every pixel of its silhouette exactly once, instead of rendering
+char *watertight_test_path = NULL;
+
+// With --deferred-test, the OBJ and PNG drawn with every span kernel, mostly as small triangles, to check that the
+// deferred and Z-prepass render methods produce the same image as the forward one, instead of rendering
+char *deferred_test_obj_path = NULL;
+char *deferred_test_png_path = NULL;
+
 //--------------------------------------------
 // Global transformation matrices
 //--------------------------------------------
-mat4_t world_matrix;
 mat4_t view_matrix;
+int view_version = 0; // Incremented whenever view_matrix changes
 mat4_t projection_matrix;
 
-bool setup(void)
+// Sets the projection matrix and the frustum planes for the window
+void setup_projection(void)
 {
-  set_backface_culling_option(CULLING_BACKFACE);
-  set_render_method(RENDER_TRIANGLE);
-
-  // Setup the projection matrix
   float aspect_x = (float)get_window_width() / (float)get_window_height();
   float aspect_y = (float)get_window_height() / (float)get_window_width();
   float fovy = M_PI / 3.0; // the same as 180/3, or 60deg
@@ -46,23 +103,84 @@ bool setup(void)
 
   // Initialize the frustum planes
   initialize_frustum_planes(fovx, fovy, z_near, z_far);
+}
+
+bool setup(void)
+{
+  set_backface_culling_option(CULLING_BACKFACE);
+  set_render_method(RENDER_TRIANGLE);
+
+  // Setup the projection matrix
+  setup_projection();
 
   // Load mesh and texture data from .png file
-  load_mesh("./assets/f22.obj", "./assets/f22.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(-1.5, 0.5, 5));
-  load_mesh("./assets/efa.obj", "./assets/efa.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(1.5, 0.5, 5));
-  load_mesh("./assets/f117.obj", "./assets/f117.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(0.0, 0.5, 3.0));
-  load_mesh("./assets/runway.obj", "./assets/runway.png", vec3_create(1, 1, 1), vec3_create(0, M_PI, 0), vec3_create(0, 0, 10));
+  load_mesh("./assets/f22.obj", "./assets/f22.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(-1.5, 0.5, 5), true);
+  load_mesh("./assets/efa.obj", "./assets/efa.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(1.5, 0.5, 5), true);
+  load_mesh("./assets/f117.obj", "./assets/f117.png", vec3_create(1, 1, 1), vec3_create(0, -M_PI_2, 0), vec3_create(0.0, 0.5, 3.0), true);
+  load_mesh("./assets/runway.obj", "./assets/runway.png", vec3_create(1, 1, 1), vec3_create(0, M_PI, 0), vec3_create(0, 0, 10), true);
 
   mesh_t *meshes = get_meshes();
   size_t mesh_count = get_mesh_count();
   printf("Loaded %zd meshes.\n", mesh_count);
+  print_asset_cache_stats();
+  printf("texture format: %s, %zu bytes of textures\n", get_texture_format_name(get_texture_format()),
+         get_asset_loaded_bytes(&texture_asset_type));
   for (size_t i = 0; i < mesh_count; i++)
   {
-    printf("Mesh #%zd: vertices: %d, faces: %d, uvs: %d\n", i + 1, array_length(meshes[i].vertices), array_length(meshes[i].faces), array_length(meshes[i].texcoords));
+    printf("Mesh #%zd: vertices: %d, faces: %d, edges: %d, uvs: %d\n", i + 1, array_length(meshes[i].vertices), array_length(meshes[i].faces), array_length(meshes[i].edges), array_length(meshes[i].texcoords));
   }
 
+  int max_num_vertices = 1;
+  int max_num_faces = 1;
+  int max_num_edges = 1;
+  for (size_t i = 0; i < mesh_count; i++)
+  {
+    max_num_vertices = array_length(meshes[i].vertices) > max_num_vertices ? array_length(meshes[i].vertices) : max_num_vertices;
+    max_num_faces = array_length(meshes[i].faces) > max_num_faces ? array_length(meshes[i].faces) : max_num_faces;
+    max_num_edges = array_length(meshes[i].edges) > max_num_edges ? array_length(meshes[i].edges) : max_num_edges;
+  }
+  bool is_vertex_cache_allocated = allocate_vertex_soa(&view_vertices, max_num_vertices) &&
+                                   allocate_vertex_soa(&screen_vertices, max_num_vertices);
+  vertex_outcodes = (clip_outcode_t *)malloc(sizeof(clip_outcode_t) * max_num_vertices);
+  visible_faces = (int *)malloc(sizeof(int) * max_num_faces);
+  visible_face_normals = (vec3_t *)malloc(sizeof(vec3_t) * max_num_faces);
+  wireframe_visible_edges = (bool *)malloc(sizeof(bool) * max_num_edges);
+  if (!is_vertex_cache_allocated || vertex_outcodes == NULL || visible_faces == NULL || visible_face_normals == NULL || wireframe_visible_edges == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the vertex cache and the wireframe.\n");
+    return false;
+  }
+
+  initialize_background(0xFF000000);
+
   // Initialize lights
   initialize_light(vec3_create(0, 0, 1));
+
+  // Select the rasterizer span kernel
+  set_raster_kernel(requested_raster_kernel != NUM_RASTER_KERNELS ? requested_raster_kernel : detect_raster_kernel());
+  printf("raster kernel: %s\n", get_raster_kernel_name(get_raster_kernel()));
+  set_geometry_kernel(requested_geometry_kernel != NUM_RASTER_KERNELS ? requested_geometry_kernel : detect_raster_kernel());
+  printf("geometry kernel: %s\n", get_raster_kernel_name(get_geometry_kernel()));
+  printf("depth format: %s (%d bytes per pixel)\n", get_depth_format_name(get_depth_format()), get_depth_format_size(get_depth_format()));
+  printf("texture mipmapping: %s\n", is_texture_mipmapping_enabled() ? "on" : "off");
+  printf("static mesh baking: %s\n", is_static_mesh_baking_enabled() ? "on" : "off");
+  printf("meshlet culling: %s\n", is_meshlet_culling_enabled() ? "on" : "off");
+  printf("framebuffer layout: %s, pixel storage: %s\n", get_framebuffer_layout_name(get_framebuffer_layout()),
+         get_pixel_storage_name(get_pixel_storage()));
+  if (get_depth_format() != DEPTH_FORMAT_FLOAT && get_raster_kernel() != RASTER_KERNEL_SCALAR)
+  {
+    printf("depth format: only the float format has SIMD kernels, using the scalar kernels\n");
+  }
+
+  // Initialize the tile binner and its render threads
+  if (num_render_threads <= 0)
+  {
+    num_render_threads = SDL_GetCPUCount();
+  }
+  if (!initialize_tiles(num_render_threads))
+  {
+    return false;
+  }
   return true;
 }
 
@@ -165,6 +283,16 @@ void process_input(void)
         set_render_method(RENDER_TEXTURED_WIREFRAME_TRIANGLE);
         break;
       }
+      if (keycode == SDLK_7)
+      {
+        set_render_method(RENDER_TEXTURED_TRIANGLE_DEFERRED);
+        break;
+      }
+      if (keycode == SDLK_8)
+      {
+        set_render_method(RENDER_TEXTURED_TRIANGLE_PREPASS);
+        break;
+      }
       if (keycode == SDLK_c)
       {
         set_backface_culling_option(CULLING_BACKFACE);
@@ -206,34 +334,56 @@ void process_input(void)
   }
 }
 
-void process_graphics_pipeline_stages(mesh_t *mesh)
+bool is_wireframe_render_method(RenderMethod render_method)
 {
+  return render_method == RENDER_WIREFRAME ||
+         render_method == RENDER_WIREFRAME_DOT ||
+         render_method == RENDER_WIREFRAME_TRIANGLE ||
+         render_method == RENDER_TEXTURED_WIREFRAME_TRIANGLE;
+}
 
-  // +-------------+
-  // | Model Space |  <----- Placing the mesh into the "world"
-  // +-------------+
-
-  // Create a scale, rotation, translation matrix
-  mat4_t scale_mat = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.y);
-  mat4_t rotation_x_mat = mat4_make_rotation_x(mesh->rotation.x);
-  mat4_t rotation_y_mat = mat4_make_rotation_y(mesh->rotation.y);
-  mat4_t rotation_z_mat = mat4_make_rotation_z(mesh->rotation.z);
-  mat4_t translation_mat = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
+// Turns the edges of the mesh's visible faces into screen-space lines, once per edge
+void process_wireframe_edges(mesh_t *mesh)
+{
+  int num_edges = array_length(mesh->edges);
+  for (int i = 0; i < num_edges; i++)
+  {
+    if (!wireframe_visible_edges[i])
+    {
+      continue;
+    }
+    vec3_t a = vec3_from_vec4(get_soa_vertex(&view_vertices, mesh->edges[i].a));
+    vec3_t b = vec3_from_vec4(get_soa_vertex(&view_vertices, mesh->edges[i].b));
+    if (!clip_line_against_near_far(&a, &b))
+    {
+      continue;
+    }
 
-  // Create a world matrix to combine the three transformations
-  world_matrix = mat4_identity();
+    vec4_t projected_a = project_to_screen(&projection_matrix, vec4_from_vec3(a));
+    vec4_t projected_b = project_to_screen(&projection_matrix, vec4_from_vec3(b));
+    vec2_t screen_a = vec2_create(projected_a.x, projected_a.y);
+    vec2_t screen_b = vec2_create(projected_b.x, projected_b.y);
+    if (!clip_line_to_rect(&screen_a, &screen_b, 0, 0, get_window_width() - 1, get_window_height() - 1))
+    {
+      continue;
+    }
 
-  // Multiply the transformations to the world matrix
-  world_matrix = mat4_matmul_mat4(scale_mat, world_matrix);
-  world_matrix = mat4_matmul_mat4(rotation_z_mat, world_matrix);
-  world_matrix = mat4_matmul_mat4(rotation_y_mat, world_matrix);
-  world_matrix = mat4_matmul_mat4(rotation_x_mat, world_matrix);
-  world_matrix = mat4_matmul_mat4(translation_mat, world_matrix);
+    // Lines are drawn between the truncated end points
+    if (num_lines_to_render < MAX_LINES_TO_RENDER)
+    {
+      lines_to_render[num_lines_to_render++] = (line_t){.x0 = screen_a.x, .y0 = screen_a.y, .x1 = screen_b.x, .y1 = screen_b.y};
+    }
+  }
+}
 
-  // +------------+
-  // | View Space |  <------ Simulating a "camera"
-  // +------------+
+// +------------+
+// | View Space |  <------ Simulating a "camera"
+// +------------+
 
+// Moves the camera and builds the view matrix, once per frame before the meshes are processed. The view version
+// changes with the view matrix, invalidating the cached view-world matrices of the meshes.
+void setup_frame_view(void)
+{
   // Update the camera position
   move_camera_by_forward_velocity();
   // Create a view matrix to transform the coordinate system to the camera's
@@ -241,93 +391,149 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
   mat4_t camera_rotation_m = mat4_matmul_mat4(
       mat4_make_rotation_x(get_camera_pitch()),
       mat4_make_rotation_y(get_camera_yaw()));
-  set_camera_direction(vec3_from_vec4(mat4_matmul_vec(camera_rotation_m, vec4_from_vec3(target))));
+  set_camera_direction(vec3_from_vec4(mat4_matmul_vec(&camera_rotation_m, vec4_from_vec3(target))));
 
   // Offset the target
   target = get_camera_target();
 
-  view_matrix = mat4_look_at(get_camera_position(), target, CAMERA_UP);
-
-  // Multiply the world matrix by the view matrix to compose the transformations
-  mat4_t view_world_matrix = mat4_matmul_mat4(view_matrix, world_matrix);
-
-  int num_faces = array_length(mesh->faces);
-  for (int i = 0; i < num_faces; i++)
+  mat4_t frame_view_matrix = mat4_look_at(get_camera_position(), target, CAMERA_UP);
+  if (memcmp(&frame_view_matrix, &view_matrix, sizeof(mat4_t)) != 0)
   {
-    face_t face = mesh->faces[i];
+    view_matrix = frame_view_matrix;
+    view_version++;
+  }
+}
 
-    vec3_t face_vertices[3];
-    face_vertices[0] = mesh->vertices[face.a];
-    face_vertices[1] = mesh->vertices[face.b];
-    face_vertices[2] = mesh->vertices[face.c];
+void process_graphics_pipeline_stages(mesh_t *mesh)
+{
 
-    vec4_t transformed_vertices[3];
+  // +-------------+
+  // | Model Space |  <----- Placing the mesh into the "world"
+  // +-------------+
 
-    // Apply transformations to each vertex of this face
-    for (int j = 0; j < 3; j++)
-    {
-      vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+  // The world matrix is only rebuilt when the mesh's transform changed, and the view-world matrix when either
+  // the world or the view matrix did
+  bool is_world_matrix_rebuilt = update_mesh_world_matrix(mesh);
+  if (is_world_matrix_rebuilt || mesh->view_version != view_version)
+  {
+    // Multiply the world matrix by the view matrix to compose the transformations
+    mesh->view_world_matrix = mat4_matmul_mat4(view_matrix, mesh->world_matrix);
+    mesh->view_version = view_version;
+    add_render_stat(STAT_MESH_MATRICES_BUILT, is_world_matrix_rebuilt ? 2 : 1);
+  }
+  const mat4_t view_world_matrix = mesh->view_world_matrix;
 
-      // Multiply the view-world matrix to the original vector
-      transformed_vertex = mat4_matmul_vec(view_world_matrix, transformed_vertex);
+  // +-----------------------+
+  // | Mesh Frustum Culling  |  <------ Skipping meshes entirely outside the view, and the clipper for those inside it
+  // +-----------------------+
 
-      transformed_vertices[j] = transformed_vertex;
-    }
+  clip_class mesh_clipping = classify_bounds_clipping(&mesh->bounds, &view_world_matrix, get_matrix_max_scale(&view_world_matrix));
+  add_render_stat(mesh_clipping == CLIP_REJECT ? STAT_MESHES_OUTSIDE : mesh_clipping == CLIP_ACCEPT ? STAT_MESHES_INSIDE : STAT_MESHES_CLIPPED, 1);
+  if (mesh_clipping == CLIP_REJECT)
+  {
+    return;
+  }
 
-    // +------------------+
-    // | Backface Culling |  <------ Hiding backside faces that are not visible
-    // +------------------+
+  bool is_wireframe = is_wireframe_render_method(get_render_method());
+  if (is_wireframe)
+  {
+    memset(wireframe_visible_edges, 0, sizeof(bool) * array_length(mesh->edges));
+  }
 
-    bool shouldCull = false;
+  // Apply the view-world transformation and the projection to each vertex of the mesh, once however many faces
+  // share it. The projections are only used by the faces the clipper leaves untouched, and the outcodes classify them.
+  int num_vertices = array_length(mesh->vertices);
+  transform_vertices(&view_world_matrix, mesh->vertices, num_vertices, &view_vertices);
+  project_vertices(&projection_matrix, &view_vertices, num_vertices, &screen_vertices, vertex_outcodes);
+  add_render_stat(STAT_VERTICES_TRANSFORMED, num_vertices);
+  int num_projected = num_vertices;
 
-    vec3_t face_normal = compute_triangle_normal(transformed_vertices);
+  // +------------------+
+  // | Backface Culling |  <------ Hiding backside faces that are not visible
+  // +------------------+
 
-    // The camera ray is the camera_position - vertex.
-    // There is no need to use the camera position for the camera ray.
-    // By the end of view matrix multiplication, the camera WILL be at the origin.
-    vec3_t camera_ray = vec3_mul(vec3_from_vec4(transformed_vertices[0]), -1.0); // Vector from camera (now the origin) to point A
+  int num_faces = array_length(mesh->faces);
+  add_render_stat(STAT_FACE_VERTICES, 3 * num_faces);
+  bool is_backface_culling = get_backface_culling_option() == CULLING_BACKFACE;
+  int num_visible_faces = 0;
+  int num_faces_tested = num_faces;
+  // Whole meshlets outside the frustum or facing away are rejected before their faces are. Their normal cones only
+  // stay valid under uniform scales, and the frustum has nothing to reject in a mesh entirely inside it.
+  bool is_frustum_culling = mesh_clipping != CLIP_ACCEPT;
+  bool is_cone_culling = is_backface_culling && mesh->scale.x > 0 && mesh->scale.x == mesh->scale.y && mesh->scale.y == mesh->scale.z;
+  if (is_meshlet_culling_enabled() && mesh->meshlets != NULL && (is_frustum_culling || is_cone_culling))
+  {
+    meshlet_cull_counts_t counts;
+    num_visible_faces = cull_meshlet_faces(mesh->faces, mesh->meshlets, &view_vertices, &view_world_matrix, is_backface_culling,
+                                           is_frustum_culling, is_cone_culling, visible_faces, visible_face_normals, &counts);
+    num_faces_tested = counts.faces_tested;
+    add_render_stat(STAT_MESHLETS, array_length(mesh->meshlets));
+    add_render_stat(STAT_MESHLETS_OUTSIDE, counts.meshlets_outside_frustum);
+    add_render_stat(STAT_MESHLETS_BACK_FACING, counts.meshlets_back_facing);
+    add_render_stat(STAT_MESHLET_FACES, counts.faces_rejected);
+  }
+  else
+  {
+    num_visible_faces = cull_faces(mesh->faces, num_faces, &view_vertices, is_backface_culling, visible_faces, visible_face_normals);
+  }
+  add_render_stat(STAT_FACES_BACK_FACING, num_faces_tested - num_visible_faces);
+  int num_faces_outside = 0;
+  int num_faces_clipped = 0;
+  for (int i = 0; i < num_visible_faces; i++)
+  {
+    face_t face = mesh->faces[visible_faces[i]];
+    vec3_t face_normal = visible_face_normals[i];
 
-    float dot = vec3_dot(face_normal, camera_ray);
+    // +------------------------------+
+    // | Frustum Culling and Clipping |  <------ Ignoring invisible triangles, clipping partially visible triangles, retaining visible triangles
+    // +------------------------------+
 
-    switch (get_backface_culling_option())
+    // Every face of a mesh inside the frustum is accepted as is, the others by the outcodes of their vertices
+    clip_class clipping = CLIP_ACCEPT;
+    if (mesh_clipping != CLIP_ACCEPT)
     {
-    case CULLING_NONE:
-      break;
-    case CULLING_BACKFACE:
-      if (dot < 0.0) // If dot < 0, then it should not be rendered
-      {
-        shouldCull = true;
-      }
-      break;
-    default:
-      fprintf(stderr, "WARNING: Invalid culling option selected!");
-      break;
+      clipping = classify_clip_outcodes(vertex_outcodes[face.a], vertex_outcodes[face.b], vertex_outcodes[face.c]);
     }
-    if (shouldCull)
+    if (clipping == CLIP_REJECT)
     {
+      num_faces_outside++;
       continue;
     }
 
-    // +------------------------------+
-    // | Frustum Culling and Clipping |  <------ Ignoring invisible triangles, clipping partially visible triangles, retaining visible triangles
-    // +------------------------------+
-
-    // Clip the vertices against the frustum planes before projection
-    polygon_t polygon = polygon_from_triangle(
-        vec3_from_vec4(transformed_vertices[0]),
-        vec3_from_vec4(transformed_vertices[1]),
-        vec3_from_vec4(transformed_vertices[2]),
-        face.a_uv,
-        face.b_uv,
-        face.c_uv);
-
-    clip_polygon(&polygon);
+    // The face's edges are drawn once all faces are known, so that edges shared by two visible faces are drawn once
+    if (is_wireframe)
+    {
+      for (int j = 0; j < 3; j++)
+      {
+        wireframe_visible_edges[face.edges[j]] = true;
+      }
+    }
 
-    // Break down the polygon back to triangle(s) if needed
-    triangle_t triangles_after_clipping[MAX_NUM_POLYGON_VERTICES];
+    triangle_t triangles_after_clipping[MAX_NUM_POLYGON_TRIANGLES];
     int num_triangles_after_clipping = 0;
+    bool is_clipped = clipping != CLIP_ACCEPT;
 
-    triangles_from_polygon(&polygon, triangles_after_clipping, &num_triangles_after_clipping);
+    if (!is_clipped)
+    {
+      // Inside the guard band: the rasterizer scissors it to the screen, so it skips the clipper entirely.
+      // Its vertices are the mesh's own, so their screen projections are cached.
+      triangles_after_clipping[0] = (triangle_t){
+          .points = {get_soa_vertex(&screen_vertices, face.a), get_soa_vertex(&screen_vertices, face.b), get_soa_vertex(&screen_vertices, face.c)},
+          .texcoords = {face.a_uv, face.b_uv, face.c_uv}};
+      num_triangles_after_clipping = 1;
+    }
+    else
+    {
+      // Clip the vertices in clip space, before the perspective divide, against the planes some of them are outside of
+      num_faces_clipped++;
+      const vec4_t clip_points[3] = {
+          mat4_matmul_vec_project(&projection_matrix, get_soa_vertex(&view_vertices, face.a)),
+          mat4_matmul_vec_project(&projection_matrix, get_soa_vertex(&view_vertices, face.b)),
+          mat4_matmul_vec_project(&projection_matrix, get_soa_vertex(&view_vertices, face.c))};
+      const tex2_t texcoords[3] = {face.a_uv, face.b_uv, face.c_uv};
+      clip_outcode_t outcode_union = vertex_outcodes[face.a] | vertex_outcodes[face.b] | vertex_outcodes[face.c];
+      num_triangles_after_clipping = clip_triangle(clip_points, texcoords, outcode_union, triangles_after_clipping);
+    }
 
     // Loop from all the triangles after clipping
     for (int t = 0; t < num_triangles_after_clipping; t++)
@@ -336,39 +542,9 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
       vec4_t projected_points[3];
       for (int j = 0; j < 3; j++)
       {
-
-        // +------------+
-        // | Projection |  <------ Project to a "screen (2D)", simulating perspective
-        // +------------+
-        projected_points[j] = mat4_matmul_vec_project(projection_matrix, clipped_triangle.points[j]);
-
-        // +-------------+
-        // | Image Space |  <------ Apply perspective divide, mapping values from -1.0 to 1.0.
-        // +-------------+
-
-        // Perspective Divide
-        if (projected_points[j].w != 0.0)
-        {
-          projected_points[j].x /= projected_points[j].w;
-          projected_points[j].y /= projected_points[j].w;
-          projected_points[j].z /= projected_points[j].w;
-        }
-
-        // Invert the y values since the y value in screen space grows downward from the top
-        projected_points[j].y *= -1;
-
-        // +--------------+
-        // | Screen Space |  <------ Mapping values from [-1.0, 1.0] to [0, screen dimensions].
-        // +--------------+
-
-        // Scale into the view
-        projected_points[j].x *= (get_window_width() / 2.0);
-        projected_points[j].y *= (get_window_height() / 2.0);
-
-        // Translate projected points to the middle of the screen
-        projected_points[j].x += (get_window_width() / 2.0);
-        projected_points[j].y += (get_window_height() / 2.0);
+        projected_points[j] = is_clipped ? clip_to_screen(clipped_triangle.points[j]) : clipped_triangle.points[j];
       }
+      num_projected += is_clipped ? 3 : 0;
 
       float light_intensity = light_lambertian(face_normal, get_sun_light().direction);
       color_t final_color = light_apply_intensity(face.color, light_intensity);
@@ -390,6 +566,16 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
     }
   }
 
+  add_render_stat(STAT_FACES_OUTSIDE, num_faces_outside);
+  add_render_stat(STAT_FACES_UNCLIPPED, num_visible_faces - num_faces_outside - num_faces_clipped);
+  add_render_stat(STAT_FACES_CLIPPED, num_faces_clipped);
+  add_render_stat(STAT_VERTICES_PROJECTED, num_projected);
+
+  if (is_wireframe)
+  {
+    process_wireframe_edges(mesh);
+  }
+
   // Without the z-buffer, we would need to sort the triangles by z here (Painter's algorithm).
 }
 
@@ -397,7 +583,7 @@ void update(void)
 {
   // Determine if we still have time to wait before the next frame
   uint64_t time_to_wait = FRAME_TIME - (SDL_GetTicks64() - previous_frame_time);
-  if (time_to_wait > 0 && time_to_wait <= FRAME_TIME)
+  if (time_to_wait > 0 && time_to_wait <= FRAME_TIME && benchmark_frames == 0)
   {
     SDL_Delay(time_to_wait); // Delay update until enough time has passed.
   }
@@ -409,6 +595,9 @@ void update(void)
 
   memset(triangles_to_render, 0, sizeof(triangle_t) * MAX_TRIANGLES_PER_MESH);
   num_triangles_to_render = 0;
+  num_lines_to_render = 0;
+
+  setup_frame_view();
 
   // Loop through all of the meshes for processing
   size_t mesh_count = get_mesh_count();
@@ -420,75 +609,72 @@ void update(void)
   }
 }
 
+void bin_wireframe_lines(void)
+{
+  for (int i = 0; i < num_lines_to_render; i++)
+  {
+    const line_t *line = &lines_to_render[i];
+    bin_line(line->x0, line->y0, line->x1, line->y1, 0xFFFFFFFF);
+  }
+}
+
 void render(void)
 {
-  clear_color_buffer(0xFF000000);
-  clear_z_buffer();
+  // The tiles clear themselves from the background when they are drawn
+  begin_tile_frame();
 
-  draw_grid();
+  // Lines are drawn under the vertex dots, but over the filled triangles
+  if (get_render_method() == RENDER_WIREFRAME || get_render_method() == RENDER_WIREFRAME_DOT)
+  {
+    bin_wireframe_lines();
+  }
 
-  // Draw all projected points from the cube
+  // Bin all projected triangles into the screen tiles they overlap
   for (int i = 0; i < num_triangles_to_render; i++)
   {
-    triangle_t triangle = triangles_to_render[i];
-    int x0 = triangle.points[0].x;
-    int y0 = triangle.points[0].y;
+    const triangle_t *triangle = &triangles_to_render[i];
+    int x0 = triangle->points[0].x;
+    int y0 = triangle->points[0].y;
 
-    int x1 = triangle.points[1].x;
-    int y1 = triangle.points[1].y;
+    int x1 = triangle->points[1].x;
+    int y1 = triangle->points[1].y;
 
-    int x2 = triangle.points[2].x;
-    int y2 = triangle.points[2].y;
+    int x2 = triangle->points[2].x;
+    int y2 = triangle->points[2].y;
 
     switch (get_render_method())
     {
     case RENDER_WIREFRAME:
-      draw_triangle(
-          x0, y0,
-          x1, y1,
-          x2, y2,
-          0xFFFFFFFF);
       break;
     case RENDER_WIREFRAME_DOT:
-      draw_triangle(
-          x0, y0,
-          x1, y1,
-          x2, y2,
-          0xFFFFFFFF);
+    {
       const int point_size = 4;
-      draw_rect(x0 - point_size / 2, y0 - point_size / 2, point_size, point_size, 0xFFFF0000);
-      draw_rect(x1 - point_size / 2, y1 - point_size / 2, point_size, point_size, 0xFFFF0000);
-      draw_rect(x2 - point_size / 2, y2 - point_size / 2, point_size, point_size, 0xFFFF0000);
+      bin_rect(x0 - point_size / 2, y0 - point_size / 2, point_size, point_size, 0xFFFF0000);
+      bin_rect(x1 - point_size / 2, y1 - point_size / 2, point_size, point_size, 0xFFFF0000);
+      bin_rect(x2 - point_size / 2, y2 - point_size / 2, point_size, point_size, 0xFFFF0000);
       break;
+    }
     case RENDER_WIREFRAME_TRIANGLE:
-      draw_filled_triangle(
-          triangle,
-          triangle.color);
-      draw_triangle(
-          x0, y0,
-          x1, y1,
-          x2, y2,
-          0xFFFFFFFF);
+      bin_filled_triangle(triangle, triangle->color);
       break;
     case RENDER_TRIANGLE:
-      draw_filled_triangle(
-          triangle,
-          triangle.color);
+      bin_filled_triangle(triangle, triangle->color);
       break;
     case RENDER_TEXTURED_TRIANGLE:
-      draw_textured_triangle(
-          triangle,
-          triangle.texture);
+      bin_textured_triangle(triangle);
       break;
     case RENDER_TEXTURED_WIREFRAME_TRIANGLE:
-      draw_textured_triangle(
-          triangle,
-          triangle.texture);
-      draw_triangle(
-          x0, y0,
-          x1, y1,
-          x2, y2,
-          0xFFFFFFFF);
+      bin_textured_triangle(triangle);
+      break;
+    case RENDER_TEXTURED_TRIANGLE_DEFERRED:
+      bin_visibility_triangle(triangles_to_render, i);
+      break;
+    case RENDER_TEXTURED_TRIANGLE_PREPASS:
+      // Untextured triangles are never drawn in the second pass, so they must not occlude anything in the first
+      if (triangle->texture != NULL)
+      {
+        bin_depth_triangle(triangle);
+      }
       break;
     default:
       fprintf(stderr, "WARNING: Invalid render option selected!");
@@ -496,16 +682,212 @@ void render(void)
     }
   }
 
+  if (get_render_method() == RENDER_WIREFRAME_TRIANGLE || get_render_method() == RENDER_TEXTURED_WIREFRAME_TRIANGLE)
+  {
+    bin_wireframe_lines();
+  }
+
+  // Second pass of the Z-prepass, binned after every depth-only triangle so that each tile replays it last
+  if (get_render_method() == RENDER_TEXTURED_TRIANGLE_PREPASS)
+  {
+    for (int i = 0; i < num_triangles_to_render; i++)
+    {
+      // As in the first pass: the textured rasterizer skips untextured triangles, so binning them is wasted work
+      if (triangles_to_render[i].texture != NULL)
+      {
+        bin_textured_triangle_depth_equal(&triangles_to_render[i]);
+      }
+    }
+  }
+
+  // Rasterize the tiles on the render threads
+  render_tiles();
+  end_render_stats_frame();
+
   render_color_buffer();
 }
 
 void free_resources(void)
 {
+  destroy_tiles();
   free_meshes();
+  free_vertex_soa(&view_vertices);
+  free_vertex_soa(&screen_vertices);
+  free(vertex_outcodes);
+  vertex_outcodes = NULL;
+  free(visible_faces);
+  visible_faces = NULL;
+  free(visible_face_normals);
+  visible_face_normals = NULL;
+  free(wireframe_visible_edges);
+  wireframe_visible_edges = NULL;
 }
 
-int main(void)
+void parse_arguments(int argc, char *argv[])
 {
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "-t") == 0) && i + 1 < argc)
+    {
+      num_render_threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--stats") == 0)
+    {
+      set_render_stats_enabled(true);
+    }
+    else if (strcmp(argv[i], "--bake-static-meshes") == 0)
+    {
+      set_static_mesh_baking_enabled(true);
+    }
+    else if (strcmp(argv[i], "--no-meshlet-culling") == 0)
+    {
+      set_meshlet_culling_enabled(false);
+    }
+    else if (strcmp(argv[i], "--no-mipmaps") == 0)
+    {
+      set_texture_mipmapping_enabled(false);
+    }
+    else if (strcmp(argv[i], "--texture-format") == 0 && i + 1 < argc)
+    {
+      i++;
+      bool is_known_format = false;
+      for (int format = 0; format < NUM_TEXTURE_FORMATS; format++)
+      {
+        if (strcmp(argv[i], get_texture_format_name(format)) == 0)
+        {
+          set_texture_format(format);
+          is_known_format = true;
+        }
+      }
+      if (!is_known_format)
+      {
+        fprintf(stderr, "WARNING: Unknown texture format %s.\n", argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--texture-benchmark") == 0 && i + 1 < argc)
+    {
+      texture_benchmark_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--geometry-benchmark") == 0 && i + 1 < argc)
+    {
+      geometry_benchmark_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+    {
+      benchmark_frames = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--depth-format") == 0 && i + 1 < argc)
+    {
+      i++;
+      bool is_known_format = false;
+      for (int format = 0; format < NUM_DEPTH_FORMATS; format++)
+      {
+        if (strcmp(argv[i], get_depth_format_name(format)) == 0)
+        {
+          set_depth_format(format);
+          is_known_format = true;
+        }
+      }
+      if (!is_known_format)
+      {
+        fprintf(stderr, "WARNING: Unknown depth format %s.\n", argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--framebuffer-layout") == 0 && i + 1 < argc)
+    {
+      i++;
+      bool is_known_layout = false;
+      for (int layout = 0; layout < NUM_FRAMEBUFFER_LAYOUTS; layout++)
+      {
+        if (strcmp(argv[i], get_framebuffer_layout_name(layout)) == 0)
+        {
+          set_framebuffer_layout(layout);
+          is_known_layout = true;
+        }
+      }
+      if (!is_known_layout)
+      {
+        fprintf(stderr, "WARNING: Unknown framebuffer layout %s.\n", argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--pixel-storage") == 0 && i + 1 < argc)
+    {
+      i++;
+      bool is_known_storage = false;
+      for (int storage = 0; storage < NUM_PIXEL_STORAGES; storage++)
+      {
+        if (strcmp(argv[i], get_pixel_storage_name(storage)) == 0)
+        {
+          set_pixel_storage(storage);
+          is_known_storage = true;
+        }
+      }
+      if (!is_known_storage)
+      {
+        fprintf(stderr, "WARNING: Unknown pixel storage %s.\n", argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--raster-kernel") == 0 && i + 1 < argc)
+    {
+      i++;
+      for (int kernel = 0; kernel < NUM_RASTER_KERNELS; kernel++)
+      {
+        if (strcmp(argv[i], get_raster_kernel_name(kernel)) == 0)
+        {
+          requested_raster_kernel = kernel;
+        }
+      }
+      if (requested_raster_kernel == NUM_RASTER_KERNELS)
+      {
+        fprintf(stderr, "WARNING: Unknown raster kernel %s.\n", argv[i]);
+      }
+    }
+    else if (strcmp(argv[i], "--raster-kernel-test") == 0)
+    {
+      is_raster_kernel_test = true;
+    }
+    else if (strcmp(argv[i], "--watertight-test") == 0 && i + 1 < argc)
+    {
+      watertight_test_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--deferred-test") == 0 && i + 2 < argc)
+    {
+      deferred_test_obj_path = argv[++i];
+      deferred_test_png_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--geometry-kernel") == 0 && i + 1 < argc)
+    {
+      i++;
+      for (int kernel = 0; kernel < NUM_RASTER_KERNELS; kernel++)
+      {
+        if (strcmp(argv[i], get_raster_kernel_name(kernel)) == 0)
+        {
+          requested_geometry_kernel = kernel;
+        }
+      }
+      if (requested_geometry_kernel == NUM_RASTER_KERNELS)
+      {
+        fprintf(stderr, "WARNING: Unknown geometry kernel %s.\n", argv[i]);
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  parse_arguments(argc, argv);
+  if (texture_benchmark_path != NULL)
+  {
+    benchmark_texture_formats(texture_benchmark_path);
+    return 0;
+  }
+  if (geometry_benchmark_path != NULL)
+  {
+    setup_projection();
+    benchmark_geometry_kernels(geometry_benchmark_path, &projection_matrix,
+                               requested_geometry_kernel != NUM_RASTER_KERNELS ? requested_geometry_kernel : detect_raster_kernel());
+    return 0;
+  }
 
   is_running = initialize_window();
 
@@ -521,12 +903,46 @@ int main(void)
       return 1;
     }
   }
+  if (is_raster_kernel_test)
+  {
+    bool is_matching = test_raster_kernels(update, render);
+    free_resources();
+    destroy_window();
+    return is_matching ? 0 : 1;
+  }
+  if (watertight_test_path != NULL)
+  {
+    bool is_watertight = test_watertight_rasterization(watertight_test_path, &projection_matrix);
+    free_resources();
+    destroy_window();
+    return is_watertight ? 0 : 1;
+  }
+  if (deferred_test_obj_path != NULL)
+  {
+    bool is_matching = test_deferred_shading(deferred_test_obj_path, deferred_test_png_path, &projection_matrix);
+    free_resources();
+    destroy_window();
+    return is_matching ? 0 : 1;
+  }
 
+  int num_frames = 0;
+  uint64_t benchmark_start = SDL_GetPerformanceCounter();
   while (is_running)
   {
     process_input();
     update();
     render();
+
+    if (benchmark_frames > 0 && ++num_frames == benchmark_frames)
+    {
+      double elapsed_ms = (SDL_GetPerformanceCounter() - benchmark_start) * 1000.0 / SDL_GetPerformanceFrequency();
+      printf("benchmark: %d frames, %.3f ms per frame, depth format %s, framebuffer layout %s, pixel storage %s, texture format %s, %.2f MB depth buffer\n",
+             num_frames, elapsed_ms / num_frames, get_depth_format_name(get_depth_format()),
+             get_framebuffer_layout_name(get_framebuffer_layout()), get_pixel_storage_name(get_pixel_storage()),
+             get_texture_format_name(get_texture_format()),
+             get_depth_format_size(get_depth_format()) * get_window_width() * get_window_height() / (1024.0 * 1024.0));
+      is_running = false;
+    }
   }
 
   free_resources();
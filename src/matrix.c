@@ -41,14 +41,14 @@ mat4_t inline mat4_make_scale_uniform(float s)
   return mat4_make_scale(s, s, s);
 }
 
-vec4_t mat4_matmul_vec(mat4_t m, vec4_t v)
+vec4_t mat4_matmul_vec(const mat4_t *m, vec4_t v)
 {
   vec4_t result;
 
-  result.x = m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w;
-  result.y = m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w;
-  result.z = m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w;
-  result.w = m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w;
+  result.x = m->m[0][0] * v.x + m->m[0][1] * v.y + m->m[0][2] * v.z + m->m[0][3] * v.w;
+  result.y = m->m[1][0] * v.x + m->m[1][1] * v.y + m->m[1][2] * v.z + m->m[1][3] * v.w;
+  result.z = m->m[2][0] * v.x + m->m[2][1] * v.y + m->m[2][2] * v.z + m->m[2][3] * v.w;
+  result.w = m->m[3][0] * v.x + m->m[3][1] * v.y + m->m[3][2] * v.z + m->m[3][3] * v.w;
 
   return result;
 }
@@ -162,7 +162,7 @@ mat4_t mat4_make_perspective(float fov, float aspect, float z_near, float z_far)
   return m;
 }
 
-vec4_t mat4_matmul_vec_project(mat4_t mat_proj, vec4_t v)
+vec4_t mat4_matmul_vec_project(const mat4_t *mat_proj, vec4_t v)
 {
   vec4_t projected = mat4_matmul_vec(mat_proj, v);
   return projected;
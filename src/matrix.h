@@ -12,7 +12,7 @@ mat4_t mat4_identity(void);
 mat4_t mat4_make_scale(float sx, float sy, float sz);
 mat4_t inline mat4_make_scale_uniform(float s);
 mat4_t mat4_matmul_mat4(mat4_t a, mat4_t b);
-vec4_t mat4_matmul_vec(mat4_t m, vec4_t v);
+vec4_t mat4_matmul_vec(const mat4_t *m, vec4_t v); // By pointer, since it runs for every vertex
 mat4_t mat4_make_translation(float tx, float ty, float tz);
 mat4_t mat4_make_rotation_x(float angle);
 mat4_t mat4_make_rotation_y(float angle);
@@ -23,6 +23,6 @@ mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
 mat4_t mat4_make_perspective(float fov, float aspect, float z_near, float z_far);
 
 // Projection Functions
-vec4_t mat4_matmul_vec_project(mat4_t mat_proj, vec4_t v);
+vec4_t mat4_matmul_vec_project(const mat4_t *mat_proj, vec4_t v);
 
 #endif
\ No newline at end of file
@@ -1,11 +1,24 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include "mesh.h"
 #include "array.h"
 
 static mesh_t meshes[MAX_NUM_MESHES] = {};
 static size_t mesh_count = 0;
+static bool is_static_baking_enabled = false;
+
+bool is_static_mesh_baking_enabled(void)
+{
+  return is_static_baking_enabled;
+}
+
+void set_static_mesh_baking_enabled(bool is_enabled)
+{
+  is_static_baking_enabled = is_enabled;
+}
 
 mesh_t *get_mesh(size_t idx)
 {
@@ -21,7 +34,7 @@ size_t get_mesh_count()
   return mesh_count;
 }
 
-void load_mesh(char *file_name, char *png_texture_file_name, vec3_t scale, vec3_t rotation, vec3_t translation)
+void load_mesh(char *file_name, char *png_texture_file_name, vec3_t scale, vec3_t rotation, vec3_t translation, bool is_static)
 {
   // Load the .obj file
   if (mesh_count >= MAX_NUM_MESHES)
@@ -29,18 +42,184 @@ void load_mesh(char *file_name, char *png_texture_file_name, vec3_t scale, vec3_
     fprintf(stderr, "ERROR: Mesh could not be loaded. Maximum number of meshes (%d) is already met.\n", MAX_NUM_MESHES);
     return;
   }
-  mesh_t mesh = load_obj_from_file(file_name);
-  mesh.scale = scale;
-  mesh.rotation = rotation;
-  mesh.translation = translation;
+  mesh_t mesh = {.scale = scale, .rotation = rotation, .translation = translation, .is_static = is_static, .is_world_matrix_dirty = true};
+  mesh.geometry_asset = acquire_asset(&mesh_geometry_asset_type, file_name);
+  const mesh_geometry_t *geometry = (const mesh_geometry_t *)get_asset_data(mesh.geometry_asset);
+  if (geometry != NULL)
+  {
+    mesh.vertices = geometry->vertices;
+    mesh.faces = geometry->faces;
+    mesh.edges = geometry->edges;
+    mesh.texcoords = geometry->texcoords;
+    mesh.meshlets = geometry->meshlets;
+    mesh.bounds = geometry->bounds;
+  }
 
   // Load the .png file
-  upng_t *png_handle = load_mesh_png(png_texture_file_name);
-  mesh.texture = png_handle;
+  mesh.texture_asset = acquire_asset(&texture_asset_type, png_texture_file_name);
+  mesh.texture = (texture_t *)get_asset_data(mesh.texture_asset);
+
+  if (mesh.is_static && is_static_baking_enabled)
+  {
+    bake_mesh_vertices(&mesh);
+  }
 
   meshes[mesh_count++] = mesh;
 }
 
+bool update_mesh_world_matrix(mesh_t *mesh)
+{
+  if (!mesh->is_world_matrix_dirty)
+  {
+    return false;
+  }
+
+  // Create a scale, rotation, translation matrix
+  mat4_t scale_mat = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
+  mat4_t rotation_x_mat = mat4_make_rotation_x(mesh->rotation.x);
+  mat4_t rotation_y_mat = mat4_make_rotation_y(mesh->rotation.y);
+  mat4_t rotation_z_mat = mat4_make_rotation_z(mesh->rotation.z);
+  mat4_t translation_mat = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
+
+  // Multiply the transformations to the world matrix
+  mesh->world_matrix = mat4_identity();
+  mesh->world_matrix = mat4_matmul_mat4(scale_mat, mesh->world_matrix);
+  mesh->world_matrix = mat4_matmul_mat4(rotation_z_mat, mesh->world_matrix);
+  mesh->world_matrix = mat4_matmul_mat4(rotation_y_mat, mesh->world_matrix);
+  mesh->world_matrix = mat4_matmul_mat4(rotation_x_mat, mesh->world_matrix);
+  mesh->world_matrix = mat4_matmul_mat4(translation_mat, mesh->world_matrix);
+
+  mesh->is_world_matrix_dirty = false;
+  return true;
+}
+
+// The box of the vertices and the sphere around its center
+static bounds_t compute_mesh_bounds(const vec3_t *vertices)
+{
+  int num_vertices = array_length((void *)vertices);
+  if (num_vertices == 0)
+  {
+    return (bounds_t){};
+  }
+  bounds_t bounds = {.min = vertices[0], .max = vertices[0]};
+  for (int i = 1; i < num_vertices; i++)
+  {
+    bounds.min = vec3_create(fminf(bounds.min.x, vertices[i].x), fminf(bounds.min.y, vertices[i].y), fminf(bounds.min.z, vertices[i].z));
+    bounds.max = vec3_create(fmaxf(bounds.max.x, vertices[i].x), fmaxf(bounds.max.y, vertices[i].y), fmaxf(bounds.max.z, vertices[i].z));
+  }
+  bounds.center = vec3_mul(vec3_add(bounds.min, bounds.max), 0.5);
+  for (int i = 0; i < num_vertices; i++)
+  {
+    bounds.radius = fmaxf(bounds.radius, vec3_length(vec3_sub(vertices[i], bounds.center)));
+  }
+  return bounds;
+}
+
+// Transforms a copy of the shared vertices to world space, so that the mesh's world matrix becomes the identity
+void bake_mesh_vertices(mesh_t *mesh)
+{
+  int num_vertices = array_length(mesh->vertices);
+  if (num_vertices == 0)
+  {
+    return;
+  }
+  mesh->baked_vertices = (vec3_t *)array_hold(NULL, num_vertices, sizeof(vec3_t));
+  if (mesh->baked_vertices == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the baked mesh vertices.\n");
+    return;
+  }
+  update_mesh_world_matrix(mesh);
+  for (int i = 0; i < num_vertices; i++)
+  {
+    mesh->baked_vertices[i] = vec3_from_vec4(mat4_matmul_vec(&mesh->world_matrix, vec4_from_vec3(mesh->vertices[i])));
+  }
+  mesh->vertices = mesh->baked_vertices;
+  mesh->baked_meshlets = transform_meshlets(mesh->meshlets, &mesh->world_matrix);
+  mesh->meshlets = mesh->baked_meshlets;
+  mesh->bounds = compute_mesh_bounds(mesh->vertices);
+  mesh->world_matrix = mat4_identity();
+}
+
+static bool is_mesh_transform_changeable(const mesh_t *mesh)
+{
+  if (mesh->baked_vertices != NULL)
+  {
+    fprintf(stderr, "WARNING: The transform of a baked static mesh cannot be changed.\n");
+    return false;
+  }
+  return true;
+}
+
+void set_mesh_scale(mesh_t *mesh, vec3_t scale)
+{
+  if (is_mesh_transform_changeable(mesh))
+  {
+    mesh->scale = scale;
+    mesh->is_world_matrix_dirty = true;
+  }
+}
+
+void set_mesh_rotation(mesh_t *mesh, vec3_t rotation)
+{
+  if (is_mesh_transform_changeable(mesh))
+  {
+    mesh->rotation = rotation;
+    mesh->is_world_matrix_dirty = true;
+  }
+}
+
+void set_mesh_translation(mesh_t *mesh, vec3_t translation)
+{
+  if (is_mesh_transform_changeable(mesh))
+  {
+    mesh->translation = translation;
+    mesh->is_world_matrix_dirty = true;
+  }
+}
+
+static void *load_mesh_geometry(const char *path, size_t *size)
+{
+  mesh_geometry_t *geometry = (mesh_geometry_t *)malloc(sizeof(mesh_geometry_t));
+  if (geometry == NULL)
+  {
+    return NULL;
+  }
+  mesh_t mesh = load_obj_from_file((char *)path);
+  *geometry = (mesh_geometry_t){.vertices = mesh.vertices, .faces = mesh.faces, .edges = mesh.edges, .texcoords = mesh.texcoords,
+                                .meshlets = build_meshlets(mesh.faces, mesh.vertices), .bounds = mesh.bounds};
+  *size = sizeof(mesh_geometry_t) + sizeof(vec3_t) * array_length(mesh.vertices) + sizeof(face_t) * array_length(mesh.faces) +
+          sizeof(edge_t) * array_length(mesh.edges) + sizeof(tex2_t) * array_length(mesh.texcoords) +
+          sizeof(meshlet_t) * array_length(geometry->meshlets);
+  return geometry;
+}
+
+static void free_mesh_geometry(void *data)
+{
+  mesh_geometry_t *geometry = (mesh_geometry_t *)data;
+  array_free(geometry->faces);
+  array_free(geometry->edges);
+  array_free(geometry->vertices);
+  array_free(geometry->texcoords);
+  array_free(geometry->meshlets);
+  free(geometry);
+}
+
+static void *load_texture_asset(const char *path, size_t *size)
+{
+  texture_t *texture = load_mesh_png((char *)path);
+  *size = get_texture_memory_size(texture);
+  return texture;
+}
+
+static void free_texture_asset(void *data)
+{
+  free_texture((texture_t *)data);
+}
+
+const asset_type_t mesh_geometry_asset_type = {.name = "mesh", .load = load_mesh_geometry, .free = free_mesh_geometry};
+const asset_type_t texture_asset_type = {.name = "texture", .load = load_texture_asset, .free = free_texture_asset};
+
 mesh_t load_obj_from_file(char *file_name)
 {
   FILE *file_handle = fopen(file_name, "r");
@@ -90,15 +269,80 @@ mesh_t load_obj_from_file(char *file_name)
   }
   fclose(file_handle);
 
+  build_mesh_edges(&mesh);
+  mesh.bounds = compute_mesh_bounds(mesh.vertices);
+
   return mesh;
 }
 
+// An edge of a face, before edges shared by several faces are merged
+typedef struct face_edge
+{
+  edge_t edge;
+  int face_idx;
+  int corner; // 0 for ab, 1 for bc, 2 for ca
+} face_edge_t;
+
+static int compare_face_edges(const void *first, const void *second)
+{
+  const edge_t *a = &((const face_edge_t *)first)->edge;
+  const edge_t *b = &((const face_edge_t *)second)->edge;
+  if (a->a != b->a)
+  {
+    return a->a < b->a ? -1 : 1;
+  }
+  if (a->b != b->b)
+  {
+    return a->b < b->b ? -1 : 1;
+  }
+  return 0;
+}
+
+// Sorts the edges of all faces by their vertices so that shared edges are adjacent, then keeps one of each
+void build_mesh_edges(mesh_t *mesh)
+{
+  int num_faces = array_length(mesh->faces);
+  if (num_faces == 0)
+  {
+    return;
+  }
+  face_edge_t *face_edges = (face_edge_t *)malloc(sizeof(face_edge_t) * 3 * num_faces);
+  if (face_edges == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the mesh edges.\n");
+    return;
+  }
+
+  for (int i = 0; i < num_faces; i++)
+  {
+    const face_t *face = &mesh->faces[i];
+    int vertices[3] = {face->a, face->b, face->c};
+    for (int corner = 0; corner < 3; corner++)
+    {
+      int a = vertices[corner];
+      int b = vertices[(corner + 1) % 3];
+      face_edges[3 * i + corner] = (face_edge_t){.edge = {.a = a < b ? a : b, .b = a < b ? b : a}, .face_idx = i, .corner = corner};
+    }
+  }
+  qsort(face_edges, 3 * num_faces, sizeof(face_edge_t), compare_face_edges);
+
+  for (int i = 0; i < 3 * num_faces; i++)
+  {
+    if (i == 0 || compare_face_edges(&face_edges[i - 1], &face_edges[i]) != 0)
+    {
+      array_push(mesh->edges, face_edges[i].edge);
+    }
+    mesh->faces[face_edges[i].face_idx].edges[face_edges[i].corner] = array_length(mesh->edges) - 1;
+  }
+  free(face_edges);
+}
+
 void free_mesh(mesh_t mesh)
 {
-  upng_free(mesh.texture);
-  array_free(mesh.faces);
-  array_free(mesh.vertices);
-  array_free(mesh.texcoords);
+  array_free(mesh.baked_vertices);
+  array_free(mesh.baked_meshlets);
+  release_asset(mesh.texture_asset);
+  release_asset(mesh.geometry_asset);
 }
 void free_meshes()
 {
@@ -109,17 +353,22 @@ void free_meshes()
   mesh_count = 0;
 }
 
-upng_t *load_mesh_png(char *file_path)
+// Decodes the PNG and converts it into an engine texture; the PNG itself is not kept
+texture_t *load_mesh_png(char *file_path)
 {
   upng_t *png_texture = upng_new_from_file(file_path);
-  if (png_texture != NULL)
+  if (png_texture == NULL)
   {
-    upng_decode(png_texture);
-    if (upng_get_error(png_texture) != UPNG_EOK)
-    {
-      fprintf(stderr, "ERROR: Failed to load mesh texture.\n");
-      return NULL;
-    }
+    return NULL;
+  }
+  upng_decode(png_texture);
+  if (upng_get_error(png_texture) != UPNG_EOK)
+  {
+    fprintf(stderr, "ERROR: Failed to load mesh texture.\n");
+    upng_free(png_texture);
+    return NULL;
   }
-  return png_texture;
+  texture_t *texture = create_texture_from_png(png_texture);
+  upng_free(png_texture);
+  return texture;
 }
\ No newline at end of file
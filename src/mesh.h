@@ -3,29 +3,84 @@
 
 #define MAX_NUM_MESHES 32
 
+#include <stdbool.h>
 #include "vector.h"
+#include "matrix.h"
 #include "triangle.h"
-#include "../upng/upng.h"
+#include "meshlet.h"
+#include "clipping.h"
+#include "assets.h"
 
-typedef struct mesh
+// An edge between two vertices of a mesh, with a < b
+typedef struct edge
+{
+  int a;
+  int b;
+} edge_t;
+
+// The geometry of an .obj file, shared by every mesh loaded from it
+typedef struct mesh_geometry
 {
   vec3_t *vertices; // Dynamic
   face_t *faces;    // Dynamic
-  upng_t *texture;  // PNG for the texture
+  edge_t *edges;    // Dynamic, every edge of the faces once, for the wireframe
+  tex2_t *texcoords; // Dynamic
+  meshlet_t *meshlets; // Dynamic, the faces are ordered by meshlet
+  bounds_t bounds;
+} mesh_geometry_t;
+
+// The geometry and texture of a mesh are owned by the asset registry and may be shared with other meshes.
+// Its scale, rotation and translation are changed through set_mesh_scale() and the like, which mark its cached world
+// matrix dirty.
+typedef struct mesh
+{
+  vec3_t *vertices; // Of the shared geometry, or the mesh's own baked_vertices
+  face_t *faces;
+  edge_t *edges;
+  texture_t *texture; // Converted from the PNG
   tex2_t *texcoords;
+  meshlet_t *meshlets; // Of the shared geometry, or the mesh's own baked_meshlets
+  bounds_t bounds;     // Of its vertices, in object space or in world space once baked
   vec3_t scale;
   vec3_t rotation;
   vec3_t translation;
+  asset_handle_t geometry_asset;
+  asset_handle_t texture_asset;
 
+  bool is_static;           // Its transform never changes after it is loaded
+  vec3_t *baked_vertices;   // Dynamic, the vertices of a static mesh already in world space, NULL unless baked
+  meshlet_t *baked_meshlets; // Dynamic, the meshlets of a baked mesh with their bounds in world space
+  bool is_world_matrix_dirty;
+  mat4_t world_matrix;      // Of scale, rotation and translation; the identity once the vertices are baked
+  mat4_t view_world_matrix; // Cached by the pipeline for the view of view_version
+  int view_version;
 } mesh_t;
 
+extern const asset_type_t mesh_geometry_asset_type;
+extern const asset_type_t texture_asset_type;
+
 mesh_t *get_mesh(size_t idx);
 mesh_t *get_meshes(void);
 size_t get_mesh_count(void);
-void load_mesh(char *file_name, char *png_texture_file_name, vec3_t scale, vec3_t rotation, vec3_t translation);
+void load_mesh(char *file_name, char *png_texture_file_name, vec3_t scale, vec3_t rotation, vec3_t translation, bool is_static);
 mesh_t load_obj_from_file(char *file_name);
-upng_t *load_mesh_png(char *file_path);
-void free_mesh(mesh_t mesh);
+void build_mesh_edges(mesh_t *mesh);
+texture_t *load_mesh_png(char *file_path);
+void free_mesh(mesh_t mesh); // Releases its geometry and texture to the asset registry
+
+// When enabled, static meshes are loaded with their vertices transformed to world space once
+bool is_static_mesh_baking_enabled(void);
+void set_static_mesh_baking_enabled(bool is_enabled);
+
+void bake_mesh_vertices(mesh_t *mesh); // Copies its vertices and meshlets in world space, its world matrix becoming the identity
+
+// Changing the transform of a baked mesh is ignored with a warning
+void set_mesh_scale(mesh_t *mesh, vec3_t scale);
+void set_mesh_rotation(mesh_t *mesh, vec3_t rotation);
+void set_mesh_translation(mesh_t *mesh, vec3_t translation);
+
+// Rebuilds the world matrix if its transform changed since, and returns whether it did
+bool update_mesh_world_matrix(mesh_t *mesh);
 void free_meshes();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "meshlet.h"
+#include "array.h"
+#include "clipping.h"
+
+// Margin of the conservative tests, relative to the distance of the meshlet, for the rounding of the per-face tests
+#define MESHLET_CULL_EPSILON 1e-3f
+
+// Angle in radians by which the normal cones are widened, for the rounding of the normals computed in view space
+#define MESHLET_CONE_MARGIN 0.01f
+
+// The normal of a face whose shortest edge is shorter than this fraction of the size of the mesh, or whose edges
+// from its first vertex are nearly parallel, changes direction with the rounding of its vertices. Such faces are
+// clustered apart, in meshlets without a normal cone.
+#define MESHLET_MIN_EDGE_FRACTION 1e-3f
+#define MESHLET_MIN_FACE_SIN 1e-2f
+
+// Marks the faces of cluster_of_face that may not be bounded by a normal cone
+#define UNSTABLE_FACE -2
+
+static bool is_culling_enabled = true;
+
+bool is_meshlet_culling_enabled(void)
+{
+  return is_culling_enabled;
+}
+
+void set_meshlet_culling_enabled(bool is_enabled)
+{
+  is_culling_enabled = is_enabled;
+}
+
+// Sets the bounding sphere and, with has_cone, the normal cone of the meshlet from its faces
+static void compute_meshlet_bounds(meshlet_t *meshlet, const face_t *faces, const vec3_t *vertices, const vec3_t *normals, bool has_cone)
+{
+  // The sphere is centered on the bounding box of the vertices
+  vec3_t min = vertices[faces[meshlet->first_face].a];
+  vec3_t max = min;
+  for (int i = meshlet->first_face; i < meshlet->first_face + meshlet->num_faces; i++)
+  {
+    int face_indices[3] = {faces[i].a, faces[i].b, faces[i].c};
+    for (int j = 0; j < 3; j++)
+    {
+      vec3_t vertex = vertices[face_indices[j]];
+      min = vec3_create(fminf(min.x, vertex.x), fminf(min.y, vertex.y), fminf(min.z, vertex.z));
+      max = vec3_create(fmaxf(max.x, vertex.x), fmaxf(max.y, vertex.y), fmaxf(max.z, vertex.z));
+    }
+  }
+  meshlet->center = vec3_mul(vec3_add(min, max), 0.5);
+  meshlet->radius = 0.0;
+  for (int i = meshlet->first_face; i < meshlet->first_face + meshlet->num_faces; i++)
+  {
+    int face_indices[3] = {faces[i].a, faces[i].b, faces[i].c};
+    for (int j = 0; j < 3; j++)
+    {
+      meshlet->radius = fmaxf(meshlet->radius, vec3_length(vec3_sub(vertices[face_indices[j]], meshlet->center)));
+    }
+  }
+
+  // The cone is centered on the average normal
+  meshlet->cone_axis = vec3_create(0, 0, 0);
+  meshlet->cone_cos = 0.0;
+  meshlet->cone_sin = 1.0;
+  if (!has_cone)
+  {
+    return;
+  }
+  vec3_t normal_sum = {0, 0, 0};
+  for (int i = meshlet->first_face; i < meshlet->first_face + meshlet->num_faces; i++)
+  {
+    normal_sum = vec3_add(normal_sum, normals[i]);
+  }
+  meshlet->cone_axis = vec3_normalize(normal_sum);
+  meshlet->cone_cos = 1.0;
+  for (int i = meshlet->first_face; i < meshlet->first_face + meshlet->num_faces; i++)
+  {
+    float dot = vec3_dot(normals[i], meshlet->cone_axis);
+    meshlet->cone_cos = dot >= meshlet->cone_cos ? meshlet->cone_cos : dot; // Also takes a NaN
+  }
+  float cone_angle = acosf(fminf(meshlet->cone_cos, 1.0)) + MESHLET_CONE_MARGIN;
+  if (!(cone_angle < M_PI_2))
+  {
+    meshlet->cone_cos = 0.0;
+    return;
+  }
+  meshlet->cone_cos = cosf(cone_angle);
+  meshlet->cone_sin = sinf(cone_angle);
+}
+
+static bool is_face_normal_stable(const face_t *face, const vec3_t *vertices, float min_edge_length)
+{
+  vec3_t ab = vec3_sub(vertices[face->b], vertices[face->a]);
+  vec3_t bc = vec3_sub(vertices[face->c], vertices[face->b]);
+  vec3_t ca = vec3_sub(vertices[face->a], vertices[face->c]);
+  if (vec3_length(ab) < min_edge_length || vec3_length(bc) < min_edge_length || vec3_length(ca) < min_edge_length)
+  {
+    return false;
+  }
+  float sin_angle = vec3_length(vec3_cross(vec3_normalize(ab), vec3_normalize(vec3_mul(ca, -1.0))));
+  return sin_angle >= MESHLET_MIN_FACE_SIN;
+}
+
+// Clusters the faces with the scratch arrays of build_meshlets(), reordering them
+static meshlet_t *cluster_faces(face_t *faces, const vec3_t *vertices, int num_edges, int *edge_face_offsets, int *edge_faces,
+                                vec3_t *normals, int *face_order, int *cluster_of_face, face_t *ordered_faces)
+{
+  int num_faces = array_length(faces);
+  int num_vertices = array_length((void *)vertices);
+  meshlet_t *meshlets = NULL;
+
+  // The size of the mesh is the diagonal of its bounding box
+  vec3_t min = vertices[0];
+  vec3_t max = vertices[0];
+  for (int i = 1; i < num_vertices; i++)
+  {
+    min = vec3_create(fminf(min.x, vertices[i].x), fminf(min.y, vertices[i].y), fminf(min.z, vertices[i].z));
+    max = vec3_create(fmaxf(max.x, vertices[i].x), fmaxf(max.y, vertices[i].y), fmaxf(max.z, vertices[i].z));
+  }
+  float min_edge_length = MESHLET_MIN_EDGE_FRACTION * vec3_length(vec3_sub(max, min));
+  for (int i = 0; i < num_faces; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      edge_face_offsets[faces[i].edges[j] + 1]++;
+    }
+    vec4_t points[3] = {vec4_from_vec3(vertices[faces[i].a]), vec4_from_vec3(vertices[faces[i].b]), vec4_from_vec3(vertices[faces[i].c])};
+    normals[i] = compute_triangle_normal(points);
+    cluster_of_face[i] = is_face_normal_stable(&faces[i], vertices, min_edge_length) ? -1 : UNSTABLE_FACE;
+  }
+  for (int e = 0; e < num_edges; e++)
+  {
+    edge_face_offsets[e + 1] += edge_face_offsets[e];
+  }
+  // Filled backwards from the end of each range, so that edge_face_offsets[e + 1] ends at the start of the range of
+  // e; shifting the offsets down by one then restores the ranges
+  for (int i = num_faces - 1; i >= 0; i--)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      edge_faces[--edge_face_offsets[faces[i].edges[j] + 1]] = i;
+    }
+  }
+  memmove(edge_face_offsets, edge_face_offsets + 1, sizeof(int) * num_edges);
+  edge_face_offsets[num_edges] = 3 * num_faces;
+
+  // Grow each cluster breadth-first over shared edges from the first face not in a cluster yet. The queue of a
+  // cluster is the part of face_order after its faces, since every queued face is either taken or left for a later
+  // cluster.
+  int num_ordered = 0;
+  for (int seed = 0; seed < num_faces; seed++)
+  {
+    if (cluster_of_face[seed] != -1)
+    {
+      continue;
+    }
+    int cluster = array_length(meshlets);
+    meshlet_t meshlet = {.first_face = num_ordered};
+    int queue_head = num_ordered;
+    int queue_tail = num_ordered;
+    face_order[queue_tail++] = seed;
+    cluster_of_face[seed] = cluster;
+    while (queue_head < queue_tail && meshlet.num_faces < MESHLET_MAX_FACES)
+    {
+      int face = face_order[queue_head++];
+      meshlet.num_faces++;
+      int face_edges[3] = {faces[face].edges[0], faces[face].edges[1], faces[face].edges[2]};
+      for (int j = 0; j < 3; j++)
+      {
+        for (int k = edge_face_offsets[face_edges[j]]; k < edge_face_offsets[face_edges[j] + 1]; k++)
+        {
+          int neighbor = edge_faces[k];
+          if (cluster_of_face[neighbor] == -1 && vec3_dot(normals[neighbor], normals[seed]) >= MESHLET_MIN_NORMAL_DOT)
+          {
+            face_order[queue_tail++] = neighbor;
+            cluster_of_face[neighbor] = cluster;
+          }
+        }
+      }
+    }
+    // The faces queued but not taken are free for the next clusters
+    for (int i = queue_head; i < queue_tail; i++)
+    {
+      cluster_of_face[face_order[i]] = -1;
+    }
+    num_ordered += meshlet.num_faces;
+    array_push(meshlets, meshlet);
+  }
+  int num_stable_meshlets = array_length(meshlets);
+
+  // The unstable faces are grouped in order
+  for (int i = 0; i < num_faces; i++)
+  {
+    if (cluster_of_face[i] != UNSTABLE_FACE)
+    {
+      continue;
+    }
+    if (array_length(meshlets) == num_stable_meshlets || meshlets[array_length(meshlets) - 1].num_faces == MESHLET_MAX_FACES)
+    {
+      meshlet_t meshlet = {.first_face = num_ordered};
+      array_push(meshlets, meshlet);
+    }
+    meshlets[array_length(meshlets) - 1].num_faces++;
+    face_order[num_ordered++] = i;
+  }
+
+  // Reorder the faces, and their normals, so that every meshlet's faces are contiguous
+  for (int i = 0; i < num_faces; i++)
+  {
+    ordered_faces[i] = faces[face_order[i]];
+  }
+  memcpy(faces, ordered_faces, sizeof(face_t) * num_faces);
+  for (int i = 0; i < num_faces; i++)
+  {
+    vec4_t points[3] = {vec4_from_vec3(vertices[faces[i].a]), vec4_from_vec3(vertices[faces[i].b]), vec4_from_vec3(vertices[faces[i].c])};
+    normals[i] = compute_triangle_normal(points);
+  }
+  for (int i = 0; i < array_length(meshlets); i++)
+  {
+    compute_meshlet_bounds(&meshlets[i], faces, vertices, normals, i < num_stable_meshlets);
+  }
+
+  return meshlets;
+}
+
+meshlet_t *build_meshlets(face_t *faces, const vec3_t *vertices)
+{
+  int num_faces = array_length(faces);
+  if (num_faces == 0)
+  {
+    return NULL;
+  }
+  int num_edges = 0;
+  for (int i = 0; i < num_faces; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      num_edges = faces[i].edges[j] >= num_edges ? faces[i].edges[j] + 1 : num_edges;
+    }
+  }
+
+  // The faces around each edge, as the ranges edge_face_offsets[e]..edge_face_offsets[e + 1] of edge_faces
+  int *edge_face_offsets = (int *)calloc(num_edges + 1, sizeof(int));
+  int *edge_faces = (int *)malloc(sizeof(int) * 3 * num_faces + 1);
+  vec3_t *normals = (vec3_t *)malloc(sizeof(vec3_t) * num_faces + 1);
+  int *face_order = (int *)malloc(sizeof(int) * num_faces + 1);
+  int *cluster_of_face = (int *)malloc(sizeof(int) * num_faces + 1); // The cluster that queued it, -1 before
+  face_t *ordered_faces = (face_t *)malloc(sizeof(face_t) * num_faces + 1);
+  meshlet_t *meshlets = NULL;
+  if (edge_face_offsets == NULL || edge_faces == NULL || normals == NULL || face_order == NULL || cluster_of_face == NULL ||
+      ordered_faces == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the meshlets.\n");
+  }
+  else
+  {
+    meshlets = cluster_faces(faces, vertices, num_edges, edge_face_offsets, edge_faces, normals, face_order, cluster_of_face,
+                             ordered_faces);
+  }
+  free(edge_face_offsets);
+  free(edge_faces);
+  free(normals);
+  free(face_order);
+  free(cluster_of_face);
+  free(ordered_faces);
+  return meshlets;
+}
+
+float get_matrix_max_scale(const mat4_t *matrix)
+{
+  float max_scale = 0.0;
+  for (int column = 0; column < 3; column++)
+  {
+    vec3_t axis = vec3_create(matrix->m[0][column], matrix->m[1][column], matrix->m[2][column]);
+    max_scale = fmaxf(max_scale, vec3_length(axis));
+  }
+  return max_scale;
+}
+
+meshlet_t *transform_meshlets(const meshlet_t *meshlets, const mat4_t *matrix)
+{
+  int num_meshlets = array_length((void *)meshlets);
+  if (num_meshlets == 0)
+  {
+    return NULL;
+  }
+  meshlet_t *transformed = (meshlet_t *)array_hold(NULL, num_meshlets, sizeof(meshlet_t));
+  float scale = get_matrix_max_scale(matrix);
+  for (int i = 0; i < num_meshlets; i++)
+  {
+    transformed[i] = meshlets[i];
+    transformed[i].center = vec3_from_vec4(mat4_matmul_vec(matrix, vec4_from_vec3(meshlets[i].center)));
+    transformed[i].radius = meshlets[i].radius * scale;
+    vec4_t axis = {.x = meshlets[i].cone_axis.x, .y = meshlets[i].cone_axis.y, .z = meshlets[i].cone_axis.z, .w = 0.0};
+    transformed[i].cone_axis = vec3_normalize(vec3_from_vec4(mat4_matmul_vec(matrix, axis)));
+  }
+  return transformed;
+}
+
+meshlet_visibility classify_meshlet(const meshlet_t *meshlet, const mat4_t *view_world_matrix, float scale, bool is_frustum_culling,
+                                    bool is_cone_culling)
+{
+  // Written out rather than with mat4_matmul_vec() and the vector functions, since it runs for every meshlet
+  const float(*m)[4] = view_world_matrix->m;
+  vec3_t c = meshlet->center;
+  vec3_t center = {
+      .x = m[0][0] * c.x + m[0][1] * c.y + m[0][2] * c.z + m[0][3],
+      .y = m[1][0] * c.x + m[1][1] * c.y + m[1][2] * c.z + m[1][3],
+      .z = m[2][0] * c.x + m[2][1] * c.y + m[2][2] * c.z + m[2][3]};
+  float radius = meshlet->radius * scale;
+  float distance = sqrtf(center.x * center.x + center.y * center.y + center.z * center.z);
+  float margin = MESHLET_CULL_EPSILON * (distance + radius);
+
+  // Every vertex is outside a plane when the whole sphere is
+  for (int i = 0; i < NUM_FRUSTUM_PLANES && is_frustum_culling; i++)
+  {
+    vec3_t point = frustum_planes[i].point;
+    vec3_t normal = frustum_planes[i].normal;
+    float plane_distance = (center.x - point.x) * normal.x + (center.y - point.y) * normal.y + (center.z - point.z) * normal.z;
+    if (plane_distance < -radius - margin)
+    {
+      return MESHLET_OUTSIDE_FRUSTUM;
+    }
+  }
+
+  // A face is back-facing when dot(normal, vertex) > 0 in view space, with the camera at the origin. Over the normals
+  // of the cone and the points of the sphere, that dot product is at least
+  // cos(cone) * dot(axis, center) - sin(cone) * |center| - radius.
+  // The matrix scales uniformly, so the axis is normalized by the scale.
+  if (is_cone_culling && meshlet->cone_cos > 0.0)
+  {
+    vec3_t a = meshlet->cone_axis;
+    float axis_dot_center = ((m[0][0] * a.x + m[0][1] * a.y + m[0][2] * a.z) * center.x +
+                             (m[1][0] * a.x + m[1][1] * a.y + m[1][2] * a.z) * center.y +
+                             (m[2][0] * a.x + m[2][1] * a.y + m[2][2] * a.z) * center.z) /
+                            scale;
+    float min_dot = meshlet->cone_cos * axis_dot_center - meshlet->cone_sin * distance - radius;
+    if (min_dot > margin)
+    {
+      return MESHLET_BACK_FACING;
+    }
+  }
+  return MESHLET_VISIBLE;
+}
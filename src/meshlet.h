@@ -0,0 +1,63 @@
+#ifndef MESHLET_RENENGINE_SFW
+#define MESHLET_RENENGINE_SFW
+
+#include <stdbool.h>
+
+#include "vector.h"
+#include "matrix.h"
+#include "triangle.h"
+
+/**
+ * Meshlets
+ * Clusters of up to MESHLET_MAX_FACES adjacent faces of a mesh, built when its geometry is loaded. Each one has a
+ * bounding sphere and a cone bounding the normals of its faces, so that a cluster entirely outside the view frustum or
+ * entirely facing away from the camera is rejected with one test instead of face by face.
+ */
+
+#define MESHLET_MAX_FACES 64
+
+// A face joins a cluster only if its normal is within acos(MESHLET_MIN_NORMAL_DOT) of the normal of the face the
+// cluster grew from, which keeps the normal cones narrow enough to be culled
+#define MESHLET_MIN_NORMAL_DOT 0.5f
+
+typedef struct meshlet
+{
+  int first_face; // The faces of a meshlet are contiguous in the mesh's faces
+  int num_faces;
+  vec3_t center; // Bounding sphere of the vertices of its faces
+  float radius;
+  vec3_t cone_axis; // Every face normal is within acos(cone_cos) of the axis; no cone when cone_cos <= 0
+  float cone_cos;
+  float cone_sin;
+} meshlet_t;
+
+typedef enum meshlet_visibility
+{
+  MESHLET_VISIBLE,          // Some of its faces may be visible, so they are culled face by face
+  MESHLET_OUTSIDE_FRUSTUM,  // Entirely outside one plane of the view frustum
+  MESHLET_BACK_FACING,      // Every face faces away from the camera
+} meshlet_visibility;
+
+// Clusters the faces, reordering them so that every meshlet's faces are contiguous. Returns a dynamic array.
+meshlet_t *build_meshlets(face_t *faces, const vec3_t *vertices);
+
+// A dynamic copy of the meshlets with their bounds transformed by the matrix, which may only rotate, translate and
+// scale uniformly
+meshlet_t *transform_meshlets(const meshlet_t *meshlets, const mat4_t *matrix);
+
+// Largest factor by which the matrix scales a length, to scale the bounding spheres with
+float get_matrix_max_scale(const mat4_t *matrix);
+
+/**
+ * Tests the meshlet against the view frustum, when is_frustum_culling is set, and its normal cone against the camera
+ * at the origin of view space, when is_cone_culling is set. Both tests are conservative: a meshlet is only rejected
+ * if every one of its faces would be rejected by classify_clip_outcodes() or the backface test. The cone test is
+ * only valid for matrices that rotate, translate and scale uniformly.
+ */
+meshlet_visibility classify_meshlet(const meshlet_t *meshlet, const mat4_t *view_world_matrix, float scale, bool is_frustum_culling,
+                                    bool is_cone_culling);
+
+bool is_meshlet_culling_enabled(void);
+void set_meshlet_culling_enabled(bool is_enabled);
+
+#endif
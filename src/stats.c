@@ -0,0 +1,156 @@
+#include "stats.h"
+
+#define STATS_REPORT_INTERVAL_MS 1000
+
+static bool is_enabled = false;
+static SDL_atomic_t frame_stats[NUM_RENDER_STATS];
+
+// Totals since the last report
+static long long report_stats[NUM_RENDER_STATS];
+static int report_frames = 0;
+static uint64_t report_start_time = 0;
+
+bool is_render_stats_enabled(void)
+{
+  return is_enabled;
+}
+
+void set_render_stats_enabled(bool is_stats_enabled)
+{
+  is_enabled = is_stats_enabled;
+}
+
+void add_render_stat(render_stat stat, int value)
+{
+  if (value != 0)
+  {
+    SDL_AtomicAdd(&frame_stats[stat], value);
+  }
+}
+
+int get_render_stat(render_stat stat)
+{
+  return SDL_AtomicGet(&frame_stats[stat]);
+}
+
+const char *get_render_stat_name(render_stat stat)
+{
+  switch (stat)
+  {
+  case STAT_BLOCKS_REJECTED:
+    return "blocks rejected";
+  case STAT_BLOCKS_ACCEPTED:
+    return "blocks accepted";
+  case STAT_BLOCKS_PARTIAL:
+    return "blocks partial";
+  case STAT_BLOCKS_OCCLUDED:
+    return "blocks occluded";
+  case STAT_TRIANGLES_OCCLUDED:
+    return "triangles occluded";
+  case STAT_PIXELS_SHADED:
+    return "pixels shaded";
+  case STAT_TRIANGLES_EMPTY:
+    return "triangles empty";
+  case STAT_TRIANGLES_SMALL:
+    return "triangles small";
+  case STAT_TRIANGLES_LARGE:
+    return "triangles large";
+  case STAT_LINES:
+    return "lines";
+  case STAT_LINE_PIXELS:
+    return "line pixels";
+  case STAT_TILES_CLEARED:
+    return "tiles cleared";
+  case STAT_DEPTH_BYTES_CLEARED:
+    return "depth bytes cleared";
+  case STAT_TEXEL_BYTES:
+    return "texel bytes fetched";
+  case STAT_VERTICES_TRANSFORMED:
+    return "vertices transformed";
+  case STAT_FACE_VERTICES:
+    return "face vertices";
+  case STAT_VERTICES_PROJECTED:
+    return "vertices projected";
+  case STAT_MESH_MATRICES_BUILT:
+    return "mesh matrices built";
+  case STAT_MESHLETS:
+    return "meshlets";
+  case STAT_MESHLETS_OUTSIDE:
+    return "meshlets outside frustum";
+  case STAT_MESHLETS_BACK_FACING:
+    return "meshlets back-facing";
+  case STAT_MESHLET_FACES:
+    return "meshlet faces rejected";
+  case STAT_FACES_BACK_FACING:
+    return "faces back-facing";
+  case STAT_FACES_OUTSIDE:
+    return "faces outside frustum";
+  case STAT_FACES_UNCLIPPED:
+    return "faces unclipped";
+  case STAT_FACES_CLIPPED:
+    return "faces clipped";
+  case STAT_MESHES_OUTSIDE:
+    return "meshes outside frustum";
+  case STAT_MESHES_INSIDE:
+    return "meshes inside frustum";
+  case STAT_MESHES_CLIPPED:
+    return "meshes clipped";
+  default:
+    return "unknown";
+  }
+}
+
+// Share of a stat within a group of stats that partition the same work, in percent
+static double get_report_share(int stat, int first, int last)
+{
+  long long total = 0;
+  for (int i = first; i <= last; i++)
+  {
+    total += report_stats[i];
+  }
+  return total > 0 ? 100.0 * report_stats[stat] / total : 0.0;
+}
+
+static void print_render_stats(void)
+{
+  printf("stats (per frame, %d frames):", report_frames);
+  for (int i = 0; i < NUM_RENDER_STATS; i++)
+  {
+    printf(" %s: %lld", get_render_stat_name(i), report_stats[i] / report_frames);
+    if (i >= STAT_BLOCKS_REJECTED && i <= STAT_BLOCKS_OCCLUDED)
+    {
+      printf(" (%.1f%%)", get_report_share(i, STAT_BLOCKS_REJECTED, STAT_BLOCKS_OCCLUDED));
+    }
+    printf(i + 1 < NUM_RENDER_STATS ? "," : "\n");
+  }
+}
+
+void end_render_stats_frame(void)
+{
+  for (int i = 0; i < NUM_RENDER_STATS; i++)
+  {
+    report_stats[i] += SDL_AtomicSet(&frame_stats[i], 0);
+  }
+  report_frames++;
+
+  uint64_t now = SDL_GetTicks64();
+  if (report_start_time == 0)
+  {
+    report_start_time = now;
+  }
+  if (now - report_start_time < STATS_REPORT_INTERVAL_MS)
+  {
+    return;
+  }
+
+  if (is_enabled)
+  {
+    print_render_stats();
+  }
+  for (int i = 0; i < NUM_RENDER_STATS; i++)
+  {
+    report_stats[i] = 0;
+  }
+  report_frames = 0;
+  report_start_time = now;
+}
@@ -0,0 +1,56 @@
+#ifndef STATS_RENENGINE_SFW
+#define STATS_RENENGINE_SFW
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+/**
+ * Stats
+ * Per-frame counters of the rendering pipeline. The counters are atomic, since the render threads update them
+ * concurrently; callers should accumulate locally and add once per triangle or tile rather than once per pixel.
+ */
+
+typedef enum render_stat
+{
+  STAT_BLOCKS_REJECTED,      // 8x8 raster blocks entirely outside their triangle
+  STAT_BLOCKS_ACCEPTED,      // 8x8 raster blocks entirely inside their triangle
+  STAT_BLOCKS_PARTIAL,       // 8x8 raster blocks that needed per-pixel edge tests
+  STAT_BLOCKS_OCCLUDED,      // 8x8 raster blocks overlapping their triangle but behind the coarse z-buffer
+  STAT_TRIANGLES_OCCLUDED,   // Triangles rejected in a tile by the coarse z-buffer before any block was visited
+  STAT_PIXELS_SHADED,        // Color writes of the filled and textured rasterizers and the visibility buffer resolve
+  STAT_TRIANGLES_EMPTY,      // Binned triangles culled because they cover no pixel center
+  STAT_TRIANGLES_SMALL,      // Binned triangles rasterized by the small triangle fast path
+  STAT_TRIANGLES_LARGE,      // Binned triangles rasterized in blocks
+  STAT_LINES,                // Wireframe lines binned, after clipping
+  STAT_LINE_PIXELS,          // Color writes of the wireframe lines
+  STAT_TILES_CLEARED,        // Tiles whose background or z-buffer was cleared, out of the tiles of the screen
+  STAT_DEPTH_BYTES_CLEARED,  // Bytes of the z-buffer written by clears; epoch clears write none
+  STAT_TEXEL_BYTES,          // Bytes of texture cache lines fetched by the textured rasterizers and the resolve
+  STAT_VERTICES_TRANSFORMED, // Mesh vertices transformed to view space, once per vertex
+  STAT_FACE_VERTICES,        // Vertices of the faces processed: the transforms of a pipeline without the vertex cache
+  STAT_VERTICES_PROJECTED,   // Vertices projected to the screen: every mesh vertex, then those made by clipping
+  STAT_MESH_MATRICES_BUILT,  // World and view-world matrices of the meshes rebuilt after their transform or the view changed
+  STAT_MESHLETS,             // Meshlets tested against the frustum and their normal cone
+  STAT_MESHLETS_OUTSIDE,     // Meshlets rejected as entirely outside the frustum
+  STAT_MESHLETS_BACK_FACING, // Meshlets rejected as entirely back-facing
+  STAT_MESHLET_FACES,        // Faces skipped with their rejected meshlets
+  STAT_FACES_BACK_FACING,    // Faces culled by the per-face backface test
+  STAT_FACES_OUTSIDE,        // Faces rejected by their clip-space outcodes, all outside the same frustum plane
+  STAT_FACES_UNCLIPPED,      // Faces inside the guard band, near and far planes by their outcodes, skipping the clipper
+  STAT_FACES_CLIPPED,        // Faces straddling the guard band, near or far plane, clipped in clip space
+  STAT_MESHES_OUTSIDE,       // Meshes skipped as entirely outside the frustum by their bounds
+  STAT_MESHES_INSIDE,        // Meshes entirely inside the frustum, whose faces skip the clipper
+  STAT_MESHES_CLIPPED,       // Meshes crossing the frustum, whose faces are classified and clipped one by one
+  NUM_RENDER_STATS
+} render_stat;
+
+bool is_render_stats_enabled(void);
+void set_render_stats_enabled(bool is_enabled);
+
+void add_render_stat(render_stat stat, int value);
+int get_render_stat(render_stat stat);
+const char *get_render_stat_name(render_stat stat);
+
+void end_render_stats_frame(void); // Prints the per-frame averages about once a second when enabled
+#endif
@@ -1,10 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 #include "display.h"
 #include "texture.h"
 
-int texture_width = 64;
-int texture_height = 64;
-
 tex2_t tex2_clone(tex2_t *t)
 {
     tex2_t result = {
@@ -12,4 +10,519 @@ tex2_t tex2_clone(tex2_t *t)
         .v = t->v,
     };
     return result;
-}
\ No newline at end of file
+}
+
+static bool is_mipmapping_enabled = true;
+
+bool is_texture_mipmapping_enabled(void)
+{
+    return is_mipmapping_enabled;
+}
+
+void set_texture_mipmapping_enabled(bool is_enabled)
+{
+    is_mipmapping_enabled = is_enabled;
+}
+
+static texture_format current_texture_format = TEXTURE_FORMAT_RGBA8888;
+
+texture_format get_texture_format(void)
+{
+    return current_texture_format;
+}
+
+void set_texture_format(texture_format format)
+{
+    current_texture_format = format;
+}
+
+const char *get_texture_format_name(texture_format format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_RGBA8888:
+        return "rgba8888";
+    case TEXTURE_FORMAT_RGB565:
+        return "rgb565";
+    case TEXTURE_FORMAT_PALETTE8:
+        return "palette8";
+    case TEXTURE_FORMAT_BC1:
+        return "bc1";
+    default:
+        return "unknown";
+    }
+}
+
+// Smallest power of two that is at least size, and at least one block
+static int get_texture_size(int size, int *shift)
+{
+    *shift = TEXTURE_BLOCK_SHIFT;
+    while ((1 << *shift) < size)
+    {
+        (*shift)++;
+    }
+    return 1 << *shift;
+}
+
+static bool allocate_texture_level(texture_level_t *level, int width_shift, int height_shift)
+{
+    level->width = 1 << width_shift;
+    level->height = 1 << height_shift;
+    level->width_mask = level->width - 1;
+    level->height_mask = level->height - 1;
+    level->blocks_per_row_shift = width_shift - TEXTURE_BLOCK_SHIFT;
+    level->format = TEXTURE_FORMAT_RGBA8888;
+    level->palette = NULL;
+    level->texels = malloc(sizeof(color_t) * level->width * level->height);
+    return level->texels != NULL;
+}
+
+// Averages each of the four 8-bit channels of four texels, rounding to nearest
+static color_t average_texels(color_t a, color_t b, color_t c, color_t d)
+{
+    color_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        result |= ((sum + 2) / 4) << shift;
+    }
+    return result;
+}
+
+// Box-filters a level into the next one, of half its sizes
+static void downsample_texture_level(const texture_level_t *source, texture_level_t *destination)
+{
+    const color_t *source_texels = (const color_t *)source->texels;
+    color_t *destination_texels = (color_t *)destination->texels;
+    for (int y = 0; y < destination->height; y++)
+    {
+        for (int x = 0; x < destination->width; x++)
+        {
+            destination_texels[get_texel_index(destination, x, y)] = average_texels(
+                source_texels[get_texel_index(source, 2 * x, 2 * y)],
+                source_texels[get_texel_index(source, 2 * x + 1, 2 * y)],
+                source_texels[get_texel_index(source, 2 * x, 2 * y + 1)],
+                source_texels[get_texel_index(source, 2 * x + 1, 2 * y + 1)]);
+        }
+    }
+}
+
+// Rounds an 8-bit channel to a channel of fewer bits
+static uint32_t quantize_channel(uint32_t value, int bits)
+{
+    uint32_t max = (1u << bits) - 1;
+    return (value * max + 127) / 255;
+}
+
+static uint16_t pack_rgb565(color_t color)
+{
+    return (uint16_t)((quantize_channel(color & 0xFF, 5) << 11) |
+                      (quantize_channel((color >> 8) & 0xFF, 6) << 5) |
+                      quantize_channel((color >> 16) & 0xFF, 5));
+}
+
+// Squared distance between the RGB channels of two colors
+static int get_color_distance(color_t a, color_t b)
+{
+    int distance = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        int difference = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+        distance += difference * difference;
+    }
+    return distance;
+}
+
+// The palette is built by median cut over a histogram of the colors with 5 bits per channel
+#define PALETTE_HISTOGRAM_BITS 5
+#define PALETTE_HISTOGRAM_SIZE (1 << (3 * PALETTE_HISTOGRAM_BITS))
+
+typedef struct palette_bin
+{
+    int channels[3]; // Histogram coordinates
+    int count;
+    uint64_t sums[3]; // Of the 8-bit channels of the texels in the bin
+} palette_bin_t;
+
+typedef struct palette_box
+{
+    int start; // Range of bins
+    int count;
+} palette_box_t;
+
+static int get_palette_bin_key(color_t color)
+{
+    int shift = 8 - PALETTE_HISTOGRAM_BITS;
+    return (int)(((color & 0xFF) >> shift) << (2 * PALETTE_HISTOGRAM_BITS) |
+                 (((color >> 8) & 0xFF) >> shift) << PALETTE_HISTOGRAM_BITS |
+                 ((color >> 16) & 0xFF) >> shift);
+}
+
+static int palette_sort_channel = 0; // Channel compare_palette_bins sorts on, since qsort takes no context
+
+static int compare_palette_bins(const void *first, const void *second)
+{
+    return ((const palette_bin_t *)first)->channels[palette_sort_channel] -
+           ((const palette_bin_t *)second)->channels[palette_sort_channel];
+}
+
+// Largest range of a channel over the bins of a box, and which channel it is
+static int get_palette_box_range(const palette_bin_t *bins, const palette_box_t *box, int *channel)
+{
+    int max_range = 0;
+    *channel = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        int min = INT32_MAX;
+        int max = INT32_MIN;
+        for (int i = box->start; i < box->start + box->count; i++)
+        {
+            min = bins[i].channels[c] < min ? bins[i].channels[c] : min;
+            max = bins[i].channels[c] > max ? bins[i].channels[c] : max;
+        }
+        if (max - min > max_range)
+        {
+            max_range = max - min;
+            *channel = c;
+        }
+    }
+    return max_range;
+}
+
+// Splits the colors of the first level into TEXTURE_PALETTE_SIZE boxes, each of the same number of texels along the
+// channel of widest range of the box split, and averages every box into a color of the palette
+static color_t *build_texture_palette(const texture_level_t *level)
+{
+    color_t *palette = (color_t *)malloc(sizeof(color_t) * TEXTURE_PALETTE_SIZE);
+    palette_bin_t *bins = (palette_bin_t *)calloc(PALETTE_HISTOGRAM_SIZE, sizeof(palette_bin_t));
+    if (palette == NULL || bins == NULL)
+    {
+        free(palette);
+        free(bins);
+        return NULL;
+    }
+    const color_t *texels = (const color_t *)level->texels;
+    for (int i = 0; i < level->width * level->height; i++)
+    {
+        palette_bin_t *bin = &bins[get_palette_bin_key(texels[i])];
+        bin->count++;
+        for (int c = 0; c < 3; c++)
+        {
+            bin->sums[c] += (texels[i] >> (8 * c)) & 0xFF;
+        }
+    }
+    int num_bins = 0;
+    for (int key = 0; key < PALETTE_HISTOGRAM_SIZE; key++)
+    {
+        if (bins[key].count > 0)
+        {
+            bins[num_bins] = bins[key];
+            bins[num_bins].channels[0] = key >> (2 * PALETTE_HISTOGRAM_BITS);
+            bins[num_bins].channels[1] = (key >> PALETTE_HISTOGRAM_BITS) & ((1 << PALETTE_HISTOGRAM_BITS) - 1);
+            bins[num_bins].channels[2] = key & ((1 << PALETTE_HISTOGRAM_BITS) - 1);
+            num_bins++;
+        }
+    }
+
+    palette_box_t boxes[TEXTURE_PALETTE_SIZE] = {{.start = 0, .count = num_bins}};
+    int num_boxes = 1;
+    while (num_boxes < TEXTURE_PALETTE_SIZE)
+    {
+        int split = -1;
+        int split_channel = 0;
+        int split_range = 0;
+        for (int i = 0; i < num_boxes; i++)
+        {
+            int channel;
+            int range = get_palette_box_range(bins, &boxes[i], &channel);
+            if (range > split_range)
+            {
+                split = i;
+                split_channel = channel;
+                split_range = range;
+            }
+        }
+        if (split < 0)
+        {
+            break; // Every box holds one bin
+        }
+
+        palette_box_t *box = &boxes[split];
+        palette_sort_channel = split_channel;
+        qsort(&bins[box->start], box->count, sizeof(palette_bin_t), compare_palette_bins);
+        int total = 0;
+        for (int i = box->start; i < box->start + box->count; i++)
+        {
+            total += bins[i].count;
+        }
+        // Both halves keep at least one bin
+        int median = 1;
+        for (int below = bins[box->start].count; median < box->count - 1 && 2 * below < total; median++)
+        {
+            below += bins[box->start + median].count;
+        }
+        boxes[num_boxes++] = (palette_box_t){.start = box->start + median, .count = box->count - median};
+        box->count = median;
+    }
+
+    for (int i = 0; i < TEXTURE_PALETTE_SIZE; i++)
+    {
+        palette[i] = 0xFF000000;
+    }
+    for (int i = 0; i < num_boxes; i++)
+    {
+        uint64_t count = 0;
+        uint64_t sums[3] = {0, 0, 0};
+        for (int j = boxes[i].start; j < boxes[i].start + boxes[i].count; j++)
+        {
+            count += bins[j].count;
+            for (int c = 0; c < 3; c++)
+            {
+                sums[c] += bins[j].sums[c];
+            }
+        }
+        for (int c = 0; count > 0 && c < 3; c++)
+        {
+            palette[i] |= (color_t)((sums[c] + count / 2) / count) << (8 * c);
+        }
+    }
+    free(bins);
+    return palette;
+}
+
+static uint8_t find_palette_index(const color_t *palette, color_t color)
+{
+    int best = 0;
+    int best_distance = INT32_MAX;
+    for (int i = 0; i < TEXTURE_PALETTE_SIZE; i++)
+    {
+        int distance = get_color_distance(palette[i], color);
+        if (distance < best_distance)
+        {
+            best = i;
+            best_distance = distance;
+        }
+    }
+    return (uint8_t)best;
+}
+
+// Picks the two texels of a block farthest apart as endpoints, then the nearest of the 4 colors for every texel
+static bc1_block_t encode_bc1_block(const color_t *texels)
+{
+    int first = 0;
+    int second = 0;
+    int max_distance = -1;
+    for (int i = 0; i < TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE; i++)
+    {
+        for (int j = i + 1; j < TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE; j++)
+        {
+            int distance = get_color_distance(texels[i], texels[j]);
+            if (distance > max_distance)
+            {
+                first = i;
+                second = j;
+                max_distance = distance;
+            }
+        }
+    }
+    bc1_block_t block = {.color0 = pack_rgb565(texels[first]), .color1 = pack_rgb565(texels[second]), .indices = 0};
+    if (block.color0 < block.color1)
+    {
+        uint16_t swap = block.color0;
+        block.color0 = block.color1;
+        block.color1 = swap;
+    }
+    if (block.color0 == block.color1)
+    {
+        return block;
+    }
+    for (int i = 0; i < TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE; i++)
+    {
+        int best = 0;
+        int best_distance = INT32_MAX;
+        for (int index = 0; index < 4; index++)
+        {
+            bc1_block_t single = {.color0 = block.color0, .color1 = block.color1, .indices = (uint32_t)index};
+            int distance = get_color_distance(decode_bc1_texel(&single, 0), texels[i]);
+            if (distance < best_distance)
+            {
+                best = index;
+                best_distance = distance;
+            }
+        }
+        block.indices |= (uint32_t)best << (2 * i);
+    }
+    return block;
+}
+
+// Encodes the RGBA8888 texels of a level in a smaller format, in place. palette_indices caches the palette index of
+// every color of the palette histogram, -1 until first needed.
+static bool encode_texture_level(texture_level_t *level, texture_format format, const color_t *palette, int16_t *palette_indices)
+{
+    int num_texels = level->width * level->height;
+    uint8_t *encoded = (uint8_t *)malloc(((size_t)num_texels * get_texture_format_bits(format)) / 8 + TEXTURE_GATHER_PADDING);
+    if (encoded == NULL)
+    {
+        return false;
+    }
+    memset(encoded + ((size_t)num_texels * get_texture_format_bits(format)) / 8, 0, TEXTURE_GATHER_PADDING);
+    const color_t *texels = (const color_t *)level->texels;
+    for (int i = 0; i < num_texels; i++)
+    {
+        switch (format)
+        {
+        case TEXTURE_FORMAT_RGB565:
+            ((uint16_t *)encoded)[i] = pack_rgb565(texels[i]);
+            break;
+        case TEXTURE_FORMAT_PALETTE8:
+        {
+            int key = get_palette_bin_key(texels[i]);
+            if (palette_indices[key] < 0)
+            {
+                palette_indices[key] = find_palette_index(palette, texels[i]);
+            }
+            encoded[i] = (uint8_t)palette_indices[key];
+            break;
+        }
+        case TEXTURE_FORMAT_BC1:
+            if (i % (TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE) == 0)
+            {
+                ((bc1_block_t *)encoded)[i / (TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE)] = encode_bc1_block(&texels[i]);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    free(level->texels);
+    level->texels = encoded;
+    level->format = format;
+    level->palette = palette;
+    return true;
+}
+
+// Encodes every level, already filtered in RGBA8888, in the format
+static bool encode_texture(texture_t *texture, texture_format format)
+{
+    texture->format = format;
+    if (format == TEXTURE_FORMAT_RGBA8888)
+    {
+        return true;
+    }
+    int16_t *palette_indices = NULL;
+    if (format == TEXTURE_FORMAT_PALETTE8)
+    {
+        texture->palette = build_texture_palette(&texture->levels[0]);
+        palette_indices = (int16_t *)malloc(sizeof(int16_t) * PALETTE_HISTOGRAM_SIZE);
+        if (texture->palette == NULL || palette_indices == NULL)
+        {
+            free(palette_indices);
+            return false;
+        }
+        for (int key = 0; key < PALETTE_HISTOGRAM_SIZE; key++)
+        {
+            palette_indices[key] = -1;
+        }
+    }
+    bool is_encoded = true;
+    for (int i = 0; i < texture->num_levels && is_encoded; i++)
+    {
+        is_encoded = encode_texture_level(&texture->levels[i], format, texture->palette, palette_indices);
+    }
+    free(palette_indices);
+    return is_encoded;
+}
+
+texture_t *create_texture_from_png(upng_t *png)
+{
+    int png_width = upng_get_width(png);
+    int png_height = upng_get_height(png);
+    const color_t *png_texels = (const color_t *)upng_get_buffer(png);
+
+    texture_t *texture = (texture_t *)malloc(sizeof(texture_t));
+    if (texture == NULL)
+    {
+        return NULL;
+    }
+    int width_shift;
+    int height_shift;
+    get_texture_size(png_width, &width_shift);
+    get_texture_size(png_height, &height_shift);
+    texture->format = TEXTURE_FORMAT_RGBA8888;
+    texture->num_levels = 0;
+    texture->palette = NULL;
+    if (!allocate_texture_level(&texture->levels[0], width_shift, height_shift))
+    {
+        free_texture(texture);
+        return NULL;
+    }
+    texture->num_levels = 1;
+
+    // Nearest-neighbor resampling, which copies the texels as they are when the sizes are already powers of two
+    texture_level_t *base = &texture->levels[0];
+    color_t *base_texels = (color_t *)base->texels;
+    for (int y = 0; y < base->height; y++)
+    {
+        int png_y = (int)((int64_t)y * png_height / base->height);
+        for (int x = 0; x < base->width; x++)
+        {
+            int png_x = (int)((int64_t)x * png_width / base->width);
+            base_texels[get_texel_index(base, x, y)] = png_texels[png_width * png_y + png_x];
+        }
+    }
+    if (base->width != png_width || base->height != png_height)
+    {
+        printf("texture: resampled %d x %d to %d x %d\n", png_width, png_height, base->width, base->height);
+    }
+
+    // Mip levels, while both sizes still hold whole blocks
+    while (texture->num_levels < TEXTURE_MAX_LEVELS &&
+           width_shift > TEXTURE_BLOCK_SHIFT && height_shift > TEXTURE_BLOCK_SHIFT)
+    {
+        width_shift--;
+        height_shift--;
+        texture_level_t *level = &texture->levels[texture->num_levels];
+        if (!allocate_texture_level(level, width_shift, height_shift))
+        {
+            free_texture(texture);
+            return NULL;
+        }
+        texture->num_levels++;
+        downsample_texture_level(level - 1, level);
+    }
+
+    if (!encode_texture(texture, current_texture_format))
+    {
+        free_texture(texture);
+        return NULL;
+    }
+    return texture;
+}
+
+void free_texture(texture_t *texture)
+{
+    if (texture == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < texture->num_levels; i++)
+    {
+        free(texture->levels[i].texels);
+    }
+    free(texture->palette);
+    free(texture);
+}
+
+size_t get_texture_memory_size(const texture_t *texture)
+{
+    if (texture == NULL)
+    {
+        return 0;
+    }
+    size_t size = sizeof(texture_t) + (texture->palette != NULL ? sizeof(color_t) * TEXTURE_PALETTE_SIZE : 0);
+    for (int i = 0; i < texture->num_levels; i++)
+    {
+        size += ((size_t)texture->levels[i].width * texture->levels[i].height * get_texture_format_bits(texture->format)) / 8;
+    }
+    return size;
+}
@@ -2,6 +2,11 @@
 #define TEXTURE_RENENGINE_SFW
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "display.h"
+#include "../upng/upng.h"
 
 typedef struct tex2
 {
@@ -11,4 +16,168 @@ typedef struct tex2
 
 tex2_t tex2_clone(tex2_t *t);
 
-#endif
\ No newline at end of file
+// Texels are stored in blocks of 4x4, so that a block of 32-bit texels is one cache line.
+// Nearby texels are then in the same line whichever direction the UVs go across the screen.
+#define TEXTURE_BLOCK_SHIFT 2
+#define TEXTURE_BLOCK_SIZE (1 << TEXTURE_BLOCK_SHIFT)
+
+// Mip levels down to TEXTURE_BLOCK_SIZE texels on the smaller side; 16 is enough for any texture that fits in memory
+#define TEXTURE_MAX_LEVELS 16
+
+// In-memory formats of the texels, encoded at load and decoded on every sample.
+// All but RGBA8888 drop the alpha channel, which the rasterizers do not use; their texels decode as opaque.
+typedef enum texture_format
+{
+  TEXTURE_FORMAT_RGBA8888, // 32 bits per texel, as decoded from the PNG
+  TEXTURE_FORMAT_RGB565,   // 16 bits per texel
+  TEXTURE_FORMAT_PALETTE8, // 8-bit indices into a palette of 256 colors shared by all levels, built by median cut
+  TEXTURE_FORMAT_BC1,      // 4 bits per texel: every 4x4 block holds 2 RGB565 endpoints and a 2-bit index per texel
+                           // into the endpoints and 2 colors between them
+  NUM_TEXTURE_FORMATS
+} texture_format;
+
+#define TEXTURE_PALETTE_SIZE 256
+
+// The SIMD kernels gather 32 bits at a time, so the texels of the smaller formats are followed by this many bytes
+#define TEXTURE_GATHER_PADDING 4
+
+// A block of TEXTURE_FORMAT_BC1, the 16 texels of a TEXTURE_BLOCK_SIZE block.
+// color0 > color1, or both are equal and every index is 0.
+typedef struct bc1_block
+{
+  uint16_t color0;
+  uint16_t color1;
+  uint32_t indices; // 2 bits per texel, in the row-major order of the block
+} bc1_block_t;
+
+// One level of a texture. Its sizes are powers of two, so UVs wrap with masks instead of integer divisions.
+typedef struct texture_level
+{
+  int width;
+  int height;
+  int width_mask; // width - 1
+  int height_mask;
+  int blocks_per_row_shift; // log2(width / TEXTURE_BLOCK_SIZE)
+  texture_format format;
+  void *texels;           // Blocks in row-major order, each with its texels in row-major order, in the format
+  const color_t *palette; // The texture's palette, for TEXTURE_FORMAT_PALETTE8
+} texture_level_t;
+
+/**
+ * Texture
+ * An engine-owned texture, converted from a decoded PNG at load, with its chain of mip levels.
+ * Every level halves the one before it with a box filter, then all levels are encoded in the texture format.
+ */
+typedef struct texture
+{
+  texture_format format;
+  int num_levels;
+  texture_level_t levels[TEXTURE_MAX_LEVELS];
+  color_t *palette; // For TEXTURE_FORMAT_PALETTE8, else NULL
+} texture_t;
+
+texture_t *create_texture_from_png(upng_t *png); // Resamples the PNG to the next powers of two when needed
+void free_texture(texture_t *texture);
+size_t get_texture_memory_size(const texture_t *texture); // Bytes of the texture and all of its levels
+
+bool is_texture_mipmapping_enabled(void);
+void set_texture_mipmapping_enabled(bool is_enabled); // When disabled, only the first level is sampled
+
+texture_format get_texture_format(void);
+void set_texture_format(texture_format format); // Format of the textures created from then on
+const char *get_texture_format_name(texture_format format);
+
+static inline int get_texture_format_bits(texture_format format)
+{
+  switch (format)
+  {
+  case TEXTURE_FORMAT_RGB565:
+    return 16;
+  case TEXTURE_FORMAT_PALETTE8:
+    return 8;
+  case TEXTURE_FORMAT_BC1:
+    return 4;
+  default:
+    return 32;
+  }
+}
+
+// Index of the texel (x, y) in the blocked texels, for 0 <= x < width and 0 <= y < height
+static inline int get_texel_index(const texture_level_t *level, int x, int y)
+{
+  int block = ((y >> TEXTURE_BLOCK_SHIFT) << level->blocks_per_row_shift) + (x >> TEXTURE_BLOCK_SHIFT);
+  return (block << (2 * TEXTURE_BLOCK_SHIFT)) + ((y & (TEXTURE_BLOCK_SIZE - 1)) << TEXTURE_BLOCK_SHIFT) + (x & (TEXTURE_BLOCK_SIZE - 1));
+}
+
+// Index of the nearest texel of the UV, which wraps like abs((int)(width * u)) % width
+static inline int get_texel_index_at(const texture_level_t *level, float u, float v)
+{
+  int x = abs((int)(level->width * u)) & level->width_mask;
+  int y = abs((int)(level->height * v)) & level->height_mask;
+  return get_texel_index(level, x, y);
+}
+
+// Address of the byte holding the texel, to count the cache lines the samples touch
+static inline const void *get_texel_address(const texture_level_t *level, int index)
+{
+  return (const uint8_t *)level->texels + (((size_t)index * get_texture_format_bits(level->format)) >> 3);
+}
+
+// An RGB565 color (red in the top bits) as an opaque color_t, with every channel's top bits repeated in its low bits
+static inline color_t expand_rgb565(uint32_t color)
+{
+  uint32_t r = (color >> 11) & 0x1F;
+  uint32_t g = (color >> 5) & 0x3F;
+  uint32_t b = color & 0x1F;
+  return 0xFF000000 | (((b << 3) | (b >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((r << 3) | (r >> 2));
+}
+
+// (2 * a + b) / 3 of every color channel, the first color between two BC1 endpoints
+static inline color_t mix_bc1_colors(color_t a, color_t b)
+{
+  color_t result = 0xFF000000;
+  for (int shift = 0; shift < 24; shift += 8)
+  {
+    result |= ((2 * ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF)) / 3) << shift;
+  }
+  return result;
+}
+
+static inline color_t decode_bc1_texel(const bc1_block_t *block, int in_block)
+{
+  switch ((block->indices >> (2 * in_block)) & 3)
+  {
+  case 0:
+    return expand_rgb565(block->color0);
+  case 1:
+    return expand_rgb565(block->color1);
+  case 2:
+    return mix_bc1_colors(expand_rgb565(block->color0), expand_rgb565(block->color1));
+  default:
+    return mix_bc1_colors(expand_rgb565(block->color1), expand_rgb565(block->color0));
+  }
+}
+
+// Decodes the texel at an index of get_texel_index
+static inline color_t fetch_texel(const texture_level_t *level, int index)
+{
+  switch (level->format)
+  {
+  case TEXTURE_FORMAT_RGB565:
+    return expand_rgb565(((const uint16_t *)level->texels)[index]);
+  case TEXTURE_FORMAT_PALETTE8:
+    return level->palette[((const uint8_t *)level->texels)[index]];
+  case TEXTURE_FORMAT_BC1:
+    return decode_bc1_texel(&((const bc1_block_t *)level->texels)[index >> (2 * TEXTURE_BLOCK_SHIFT)],
+                            index & (TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE - 1));
+  default:
+    return ((const color_t *)level->texels)[index];
+  }
+}
+
+static inline color_t sample_texture(const texture_level_t *level, float u, float v)
+{
+  return fetch_texel(level, get_texel_index_at(level, u, v));
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include "tiles.h"
+#include "stats.h"
+
+typedef struct tile_bin
+{
+  int *commands; // Indices into draw_commands, in submission order
+  int count;
+  int capacity;
+  bool has_visibility_triangles;
+  bool is_dirty; // Drawn into last frame, so the tile no longer shows only the background
+} tile_bin_t;
+
+static int num_tiles_x = 0;
+static int num_tiles_y = 0;
+static tile_t *tiles = NULL;
+static tile_bin_t *bins = NULL;
+
+static draw_command_t *draw_commands = NULL;
+static int num_draw_commands = 0;
+static int draw_commands_capacity = 0;
+
+// Triangle table of this frame's DRAW_VISIBILITY_TRIANGLE commands, used to resolve the visibility buffer
+static const triangle_t *visibility_triangles = NULL;
+
+// Worker pool; the main thread also rasterizes, so only num_threads - 1 workers are spawned
+static int num_render_threads = 1;
+static SDL_Thread *workers[MAX_RENDER_THREADS];
+static SDL_sem *work_ready = NULL;
+static SDL_sem *work_done = NULL;
+static SDL_atomic_t next_tile;
+static bool is_shutting_down = false;
+
+static void rasterize_tile(int tile_idx)
+{
+  const tile_t *tile = &tiles[tile_idx];
+  tile_bin_t *bin = &bins[tile_idx];
+
+  // Clear the tile lazily, right before drawing it. It is about to be read, so it is cleared through the cache.
+  if (bin->is_dirty)
+  {
+    clear_color_buffer_tile(tile, false);
+  }
+  clear_z_buffer_tile(tile);
+  bin->is_dirty = true;
+  add_render_stat(STAT_TILES_CLEARED, 1);
+
+  if (bin->has_visibility_triangles)
+  {
+    clear_triangle_id_buffer(tile);
+  }
+
+  for (int i = 0; i < bin->count; i++)
+  {
+    const draw_command_t *command = &draw_commands[bin->commands[i]];
+    const triangle_t *triangle = command->triangle;
+    switch (command->type)
+    {
+    case DRAW_FILLED_TRIANGLE:
+      draw_filled_triangle(*triangle, command->color, tile);
+      break;
+    case DRAW_TEXTURED_TRIANGLE:
+      draw_textured_triangle(*triangle, triangle->texture, tile);
+      break;
+    case DRAW_DEPTH_TRIANGLE:
+      draw_depth_triangle(*triangle, tile);
+      break;
+    case DRAW_TEXTURED_TRIANGLE_DEPTH_EQUAL:
+      draw_textured_triangle_depth_equal(*triangle, triangle->texture, tile);
+      break;
+    case DRAW_LINE:
+      draw_line(command->x, command->y, command->x_end, command->y_end, command->color, tile);
+      break;
+    case DRAW_VISIBILITY_TRIANGLE:
+      draw_visibility_triangle(*triangle, command->triangle_id, tile);
+      break;
+    case DRAW_RECT:
+      draw_rect(command->x, command->y, command->width, command->height, command->color, tile);
+      break;
+    }
+  }
+
+  // Every command of the tile has been drawn, so the visible triangle of each pixel is final
+  if (bin->has_visibility_triangles)
+  {
+    resolve_visibility_buffer(visibility_triangles, tile);
+  }
+}
+
+// Grab tiles until there are none left
+static void rasterize_pending_tiles(void)
+{
+  int num_tiles = num_tiles_x * num_tiles_y;
+  for (int tile_idx = SDL_AtomicAdd(&next_tile, 1); tile_idx < num_tiles; tile_idx = SDL_AtomicAdd(&next_tile, 1))
+  {
+    if (bins[tile_idx].count > 0)
+    {
+      rasterize_tile(tile_idx);
+    }
+    else if (bins[tile_idx].is_dirty)
+    {
+      // Nothing is drawn into it this frame, so only the background is restored, around the cache.
+      // The z-buffer is left as is, since it is only read by tiles that clear it first.
+      clear_color_buffer_tile(&tiles[tile_idx], true);
+      bins[tile_idx].is_dirty = false;
+      add_render_stat(STAT_TILES_CLEARED, 1);
+    }
+  }
+}
+
+static int render_worker(void *data)
+{
+  (void)data;
+  while (true)
+  {
+    SDL_SemWait(work_ready);
+    if (is_shutting_down)
+    {
+      break;
+    }
+    rasterize_pending_tiles();
+    SDL_SemPost(work_done);
+  }
+  return 0;
+}
+
+bool initialize_tiles(int num_threads)
+{
+  num_tiles_x = (get_window_width() + TILE_SIZE - 1) / TILE_SIZE;
+  num_tiles_y = (get_window_height() + TILE_SIZE - 1) / TILE_SIZE;
+
+  tiles = (tile_t *)malloc(sizeof(tile_t) * num_tiles_x * num_tiles_y);
+  bins = (tile_bin_t *)calloc(num_tiles_x * num_tiles_y, sizeof(tile_bin_t));
+  if (tiles == NULL || bins == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to allocate memory for the screen tiles.\n");
+    return false;
+  }
+
+  for (int ty = 0; ty < num_tiles_y; ty++)
+  {
+    for (int tx = 0; tx < num_tiles_x; tx++)
+    {
+      bins[ty * num_tiles_x + tx].is_dirty = true; // The color buffer starts uninitialized
+      tile_t *tile = &tiles[ty * num_tiles_x + tx];
+      tile->x_min = tx * TILE_SIZE;
+      tile->y_min = ty * TILE_SIZE;
+      tile->x_max = tile->x_min + TILE_SIZE < get_window_width() ? tile->x_min + TILE_SIZE : get_window_width();
+      tile->y_max = tile->y_min + TILE_SIZE < get_window_height() ? tile->y_min + TILE_SIZE : get_window_height();
+    }
+  }
+
+  num_render_threads = clamp(1, MAX_RENDER_THREADS, num_threads);
+  is_shutting_down = false;
+  work_ready = SDL_CreateSemaphore(0);
+  work_done = SDL_CreateSemaphore(0);
+  if (work_ready == NULL || work_done == NULL)
+  {
+    fprintf(stderr, "ERROR: Failed to create the render thread semaphores.\n");
+    return false;
+  }
+  for (int i = 0; i < num_render_threads - 1; i++)
+  {
+    workers[i] = SDL_CreateThread(render_worker, "render_worker", NULL);
+    if (workers[i] == NULL)
+    {
+      fprintf(stderr, "WARNING: Could only create %d render threads.\n", i + 1);
+      num_render_threads = i + 1;
+      break;
+    }
+  }
+
+  printf("tiles: %d x %d (%dpx), render threads: %d\n", num_tiles_x, num_tiles_y, TILE_SIZE, num_render_threads);
+  return true;
+}
+
+void destroy_tiles(void)
+{
+  is_shutting_down = true;
+  for (int i = 0; i < num_render_threads - 1; i++)
+  {
+    SDL_SemPost(work_ready);
+  }
+  for (int i = 0; i < num_render_threads - 1; i++)
+  {
+    SDL_WaitThread(workers[i], NULL);
+    workers[i] = NULL;
+  }
+  num_render_threads = 1;
+
+  SDL_DestroySemaphore(work_ready);
+  work_ready = NULL;
+  SDL_DestroySemaphore(work_done);
+  work_done = NULL;
+
+  for (int i = 0; i < num_tiles_x * num_tiles_y; i++)
+  {
+    free(bins[i].commands);
+  }
+  free(bins);
+  bins = NULL;
+  free(tiles);
+  tiles = NULL;
+  num_tiles_x = 0;
+  num_tiles_y = 0;
+
+  free(draw_commands);
+  draw_commands = NULL;
+  num_draw_commands = 0;
+  draw_commands_capacity = 0;
+}
+
+int get_render_thread_count(void)
+{
+  return num_render_threads;
+}
+
+void begin_tile_frame(void)
+{
+  num_draw_commands = 0;
+  visibility_triangles = NULL;
+  for (int i = 0; i < num_tiles_x * num_tiles_y; i++)
+  {
+    bins[i].count = 0;
+    bins[i].has_visibility_triangles = false;
+  }
+}
+
+// Adds the command to every tile overlapped by the pixel rectangle [x_min, x_max] x [y_min, y_max]
+static void bin_command(draw_command_t command, int x_min, int y_min, int x_max, int y_max)
+{
+  x_min = x_min > 0 ? x_min : 0;
+  y_min = y_min > 0 ? y_min : 0;
+  x_max = x_max < get_window_width() - 1 ? x_max : get_window_width() - 1;
+  y_max = y_max < get_window_height() - 1 ? y_max : get_window_height() - 1;
+  if (x_min > x_max || y_min > y_max)
+  {
+    return;
+  }
+
+  if (num_draw_commands == draw_commands_capacity)
+  {
+    int capacity = draw_commands_capacity > 0 ? draw_commands_capacity * 2 : 1024;
+    draw_command_t *resized = (draw_command_t *)realloc(draw_commands, sizeof(draw_command_t) * capacity);
+    if (resized == NULL)
+    {
+      fprintf(stderr, "ERROR: Failed to grow the draw command list.\n");
+      return;
+    }
+    draw_commands = resized;
+    draw_commands_capacity = capacity;
+  }
+  int command_idx = num_draw_commands++;
+  draw_commands[command_idx] = command;
+
+  for (int ty = y_min / TILE_SIZE; ty <= y_max / TILE_SIZE; ty++)
+  {
+    for (int tx = x_min / TILE_SIZE; tx <= x_max / TILE_SIZE; tx++)
+    {
+      tile_bin_t *bin = &bins[ty * num_tiles_x + tx];
+      if (bin->count == bin->capacity)
+      {
+        int capacity = bin->capacity > 0 ? bin->capacity * 2 : 64;
+        int *resized = (int *)realloc(bin->commands, sizeof(int) * capacity);
+        if (resized == NULL)
+        {
+          fprintf(stderr, "ERROR: Failed to grow a tile bin.\n");
+          continue;
+        }
+        bin->commands = resized;
+        bin->capacity = capacity;
+      }
+      bin->commands[bin->count++] = command_idx;
+      bin->has_visibility_triangles = bin->has_visibility_triangles || command.type == DRAW_VISIBILITY_TRIANGLE;
+    }
+  }
+}
+
+// Bins using the same bounding box as the rasterizers in triangle.c; triangles covering no pixel center are dropped
+static void bin_triangle_command(draw_command_t command)
+{
+  tile_t pixel_bounds;
+  switch (classify_triangle_size(command.triangle, &pixel_bounds))
+  {
+  case TRIANGLE_EMPTY:
+    add_render_stat(STAT_TRIANGLES_EMPTY, 1);
+    return;
+  case TRIANGLE_SMALL:
+    add_render_stat(STAT_TRIANGLES_SMALL, 1);
+    break;
+  case TRIANGLE_LARGE:
+    add_render_stat(STAT_TRIANGLES_LARGE, 1);
+    break;
+  }
+  bin_command(command, pixel_bounds.x_min, pixel_bounds.y_min, pixel_bounds.x_max - 1, pixel_bounds.y_max - 1);
+}
+
+void bin_filled_triangle(const triangle_t *triangle, color_t color)
+{
+  draw_command_t command = {.type = DRAW_FILLED_TRIANGLE, .triangle = triangle, .color = color};
+  bin_triangle_command(command);
+}
+
+void bin_textured_triangle(const triangle_t *triangle)
+{
+  draw_command_t command = {.type = DRAW_TEXTURED_TRIANGLE, .triangle = triangle};
+  bin_triangle_command(command);
+}
+
+void bin_depth_triangle(const triangle_t *triangle)
+{
+  draw_command_t command = {.type = DRAW_DEPTH_TRIANGLE, .triangle = triangle};
+  bin_triangle_command(command);
+}
+
+void bin_textured_triangle_depth_equal(const triangle_t *triangle)
+{
+  draw_command_t command = {.type = DRAW_TEXTURED_TRIANGLE_DEPTH_EQUAL, .triangle = triangle};
+  bin_triangle_command(command);
+}
+
+void bin_visibility_triangle(const triangle_t *triangles, int triangle_id)
+{
+  visibility_triangles = triangles;
+  draw_command_t command = {.type = DRAW_VISIBILITY_TRIANGLE, .triangle = &triangles[triangle_id], .triangle_id = triangle_id};
+  bin_triangle_command(command);
+}
+
+void bin_rect(int x, int y, int width, int height, color_t color)
+{
+  draw_command_t command = {.type = DRAW_RECT, .x = x, .y = y, .width = width, .height = height, .color = color};
+  bin_command(command, x, y, x + width - 1, y + height - 1);
+}
+
+void bin_line(int x0, int y0, int x1, int y1, color_t color)
+{
+  add_render_stat(STAT_LINES, 1);
+  draw_command_t command = {.type = DRAW_LINE, .x = x0, .y = y0, .x_end = x1, .y_end = y1, .color = color};
+  bin_command(command, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 > x1 ? x0 : x1, y0 > y1 ? y0 : y1);
+}
+
+void render_tiles(void)
+{
+  SDL_AtomicSet(&next_tile, 0);
+  for (int i = 0; i < num_render_threads - 1; i++)
+  {
+    SDL_SemPost(work_ready);
+  }
+
+  rasterize_pending_tiles();
+
+  for (int i = 0; i < num_render_threads - 1; i++)
+  {
+    SDL_SemWait(work_done);
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef TILES_RENENGINE_SFW
+#define TILES_RENENGINE_SFW
+
+#include <stdbool.h>
+#include <SDL.h>
+
+#include "display.h"
+#include "triangle.h"
+
+#define MAX_RENDER_THREADS 64
+
+/**
+ * Tiles
+ * Sort-middle rasterization: draw commands are binned into the screen tiles they overlap,
+ * then a pool of worker threads rasterizes whole tiles independently.
+ * Every tile replays its commands in submission order, so the result is the same for any thread count.
+ */
+
+typedef enum draw_command_type
+{
+  DRAW_FILLED_TRIANGLE,
+  DRAW_TEXTURED_TRIANGLE,
+  DRAW_DEPTH_TRIANGLE,                // Z-prepass: writes only the depth
+  DRAW_TEXTURED_TRIANGLE_DEPTH_EQUAL, // Z-prepass: textures only the pixels where the triangle's depth is the z-buffer's
+  DRAW_LINE,
+  DRAW_VISIBILITY_TRIANGLE, // Tiles with these commands resolve their visibility buffer after the last command
+  DRAW_RECT,
+} draw_command_type;
+
+typedef struct draw_command
+{
+  draw_command_type type;
+  const triangle_t *triangle; // Used by the triangle commands
+  int triangle_id;            // Used by DRAW_VISIBILITY_TRIANGLE, index of the triangle in the visibility triangle table
+  int x;                      // Used by DRAW_RECT and DRAW_LINE, which goes from (x, y) to (x_end, y_end)
+  int y;
+  int width;
+  int height;
+  int x_end;
+  int y_end;
+  color_t color;
+} draw_command_t;
+
+bool initialize_tiles(int num_threads);
+void destroy_tiles(void);
+int get_render_thread_count(void);
+
+void begin_tile_frame(void);
+void bin_filled_triangle(const triangle_t *triangle, color_t color);
+void bin_textured_triangle(const triangle_t *triangle);
+void bin_visibility_triangle(const triangle_t *triangles, int triangle_id);
+void bin_depth_triangle(const triangle_t *triangle);
+void bin_textured_triangle_depth_equal(const triangle_t *triangle);
+void bin_rect(int x, int y, int width, int height, color_t color);
+void bin_line(int x0, int y0, int x1, int y1, color_t color); // The end points must be on screen
+void render_tiles(void);
+
+#endif
@@ -2,6 +2,12 @@
 #include "display.h"
 #include "texture.h"
 #include "light.h"
+#include "stats.h"
+
+// Keep a * b + c as two roundings so that the scalar and SIMD kernels agree
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
 
 float edge_cross(vec2_t a, vec2_t b, vec2_t p)
 {
@@ -11,200 +17,1019 @@ float edge_cross(vec2_t a, vec2_t b, vec2_t p)
   return vec2_cross(ab, ap);
 }
 
+static raster_kernel current_raster_kernel = RASTER_KERNEL_SCALAR;
+
+#if RASTER_HAS_X86_SIMD
+static const raster_span_t filled_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_filled_span_scalar,
+    draw_filled_span_sse2,
+    draw_filled_span_avx2};
+static const raster_span_t textured_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_textured_span_scalar,
+    draw_textured_span_sse2,
+    draw_textured_span_avx2};
+static const raster_span_t visibility_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_visibility_span_scalar,
+    draw_visibility_span_sse2,
+    draw_visibility_span_avx2};
+static const raster_span_t depth_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_depth_span_scalar,
+    draw_depth_span_sse2,
+    draw_depth_span_avx2};
+#else
+static const raster_span_t filled_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_filled_span_scalar,
+    draw_filled_span_scalar,
+    draw_filled_span_scalar};
+static const raster_span_t textured_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_textured_span_scalar,
+    draw_textured_span_scalar,
+    draw_textured_span_scalar};
+static const raster_span_t visibility_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_visibility_span_scalar,
+    draw_visibility_span_scalar,
+    draw_visibility_span_scalar};
+static const raster_span_t depth_span_kernels[NUM_RASTER_KERNELS] = {
+    draw_depth_span_scalar,
+    draw_depth_span_scalar,
+    draw_depth_span_scalar};
+#endif
+
+// Picks the widest kernel the CPU supports
+raster_kernel detect_raster_kernel(void)
+{
+#if RASTER_HAS_X86_SIMD
+  if (SDL_HasAVX2())
+  {
+    return RASTER_KERNEL_AVX2;
+  }
+  if (SDL_HasSSE2())
+  {
+    return RASTER_KERNEL_SSE2;
+  }
+#endif
+  return RASTER_KERNEL_SCALAR;
+}
+
+raster_kernel get_raster_kernel(void)
+{
+  return current_raster_kernel;
+}
+
+// Kernels wider than what the CPU supports fall back to the best supported one
+void set_raster_kernel(raster_kernel kernel)
+{
+  raster_kernel supported_kernel = detect_raster_kernel();
+  if (kernel > supported_kernel)
+  {
+    fprintf(stderr, "WARNING: %s rasterizer is not supported on this CPU, using %s.\n",
+            get_raster_kernel_name(kernel), get_raster_kernel_name(supported_kernel));
+    kernel = supported_kernel;
+  }
+  current_raster_kernel = kernel;
+}
+
+// The SIMD kernels only implement the float depth format
+static raster_kernel get_span_kernel(void)
+{
+  return get_depth_format() == DEPTH_FORMAT_FLOAT ? current_raster_kernel : RASTER_KERNEL_SCALAR;
+}
+
+const char *get_raster_kernel_name(raster_kernel kernel)
+{
+  switch (kernel)
+  {
+  case RASTER_KERNEL_SCALAR:
+    return "scalar";
+  case RASTER_KERNEL_SSE2:
+    return "sse2";
+  case RASTER_KERNEL_AVX2:
+    return "avx2";
+  default:
+    return "unknown";
+  }
+}
+
+// Bounding box and initial edge function values of a triangle, clipped to a tile
+typedef struct raster_bounds
+{
+  int x_min;
+  int y_min;
+  int x_max;
+  int y_max;
+  int64_t w0_row;
+  int64_t w1_row;
+  int64_t w2_row;
+  int64_t delta_w0_row;
+  int64_t delta_w1_row;
+  int64_t delta_w2_row;
+  raster_plane_t alpha_plane; // Exact barycentric coordinates, from which the attribute planes are built
+  raster_plane_t beta_plane;
+  float x_ref_offset; // Small triangles only: center of the reference pixel minus vertex 0, in pixels
+  float y_ref_offset;
+  bool is_small;      // The whole triangle, not just the part in the tile, is a TRIANGLE_SMALL
+} raster_bounds_t;
+
+// The span kernels interpolate depth in float, so a pixel can end up slightly nearer than the exact depth plane.
+// Depth bounds are widened by this much to stay conservative.
+#define DEPTH_BOUND_TOLERANCE 1e-5
+
+static int to_fixed_point(float value)
+{
+  return (int)floorf(value * SUBPIXEL_SCALE + 0.5f);
+}
+
+// Edge function of the fixed-point edge a -> b at the fixed-point point p, i.e. edge_cross() without rounding
+static int64_t edge_function_fixed(int ax, int ay, int bx, int by, int px, int py)
+{
+  return (int64_t)(bx - ax) * (py - ay) - (int64_t)(by - ay) * (px - ax);
+}
+
+// Bounding box of the pixel centers covered by the triangle with the fixed-point vertices, inclusive
+static void get_pixel_center_bounds(int x0, int y0, int x1, int y1, int x2, int y2, raster_bounds_t *bounds)
+{
+  int x_min_fixed = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+  int y_min_fixed = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+  int x_max_fixed = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+  int y_max_fixed = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+  bounds->x_min = (x_min_fixed + SUBPIXEL_SCALE / 2 - 1) >> SUBPIXEL_BITS;
+  bounds->y_min = (y_min_fixed + SUBPIXEL_SCALE / 2 - 1) >> SUBPIXEL_BITS;
+  bounds->x_max = (x_max_fixed - SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+  bounds->y_max = (y_max_fixed - SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS;
+  bounds->is_small = bounds->x_max - bounds->x_min < SMALL_TRIANGLE_SIZE && bounds->y_max - bounds->y_min < SMALL_TRIANGLE_SIZE;
+}
+
+/**
+ * Runs once per triangle when it is binned, with the same snapping as setup_triangle_raster, so that triangles that
+ * cover no pixel center never reach a tile. The bounds are also tighter than the floating-point bounding box.
+ */
+triangle_size_class classify_triangle_size(const triangle_t *triangle, tile_t *pixel_bounds)
+{
+  int x0 = to_fixed_point(triangle->points[0].x);
+  int y0 = to_fixed_point(triangle->points[0].y);
+  int x1 = to_fixed_point(triangle->points[1].x);
+  int y1 = to_fixed_point(triangle->points[1].y);
+  int x2 = to_fixed_point(triangle->points[2].x);
+  int y2 = to_fixed_point(triangle->points[2].y);
+  if (edge_function_fixed(x0, y0, x1, y1, x2, y2) <= 0)
+  {
+    return TRIANGLE_EMPTY;
+  }
+
+  raster_bounds_t bounds;
+  get_pixel_center_bounds(x0, y0, x1, y1, x2, y2, &bounds);
+  if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max)
+  {
+    return TRIANGLE_EMPTY;
+  }
+  pixel_bounds->x_min = bounds.x_min;
+  pixel_bounds->y_min = bounds.y_min;
+  pixel_bounds->x_max = bounds.x_max + 1;
+  pixel_bounds->y_max = bounds.y_max + 1;
+  return bounds.is_small ? TRIANGLE_SMALL : TRIANGLE_LARGE;
+}
+
+// Used for perspective-correct barycentric interpolation
+static void setup_triangle_inv_w(const triangle_t *triangle, raster_setup_t *setup)
+{
+  setup->inv_w[0] = 1.0 / triangle->points[0].w;
+  setup->inv_w[1] = 1.0 / triangle->points[1].w;
+  setup->inv_w[2] = 1.0 / triangle->points[2].w;
+}
+
+// Plane of an attribute that is a0, a1, a2 at the vertices, divided by w beforehand if it is perspective-correct
+static raster_plane_t make_raster_plane(const raster_bounds_t *bounds, double a0, double a1, double a2)
+{
+  raster_plane_t plane;
+  plane.value = a2 + (a0 - a2) * bounds->alpha_plane.value + (a1 - a2) * bounds->beta_plane.value;
+  plane.delta_col = (a0 - a2) * bounds->alpha_plane.delta_col + (a1 - a2) * bounds->beta_plane.delta_col;
+  plane.delta_row = (a0 - a2) * bounds->alpha_plane.delta_row + (a1 - a2) * bounds->beta_plane.delta_row;
+  return plane;
+}
+
+/**
+ * Plane of an attribute over a small triangle: its value at vertex 0 plus its gradients, in float. The gradients
+ * come from the exact fixed-point steps of the edge functions of vertices 1 and 2, which are their barycentric
+ * coordinates times the area.
+ */
+static raster_plane_t make_small_raster_plane(const raster_setup_t *setup, const raster_bounds_t *bounds, float a0, float a1, float a2)
+{
+  float a1_step = (a1 - a0) * setup->inv_area;
+  float a2_step = (a2 - a0) * setup->inv_area;
+  float delta_col = a1_step * setup->delta_w1_col + a2_step * setup->delta_w2_col;
+  float delta_row = a1_step * bounds->delta_w1_row + a2_step * bounds->delta_w2_row;
+  raster_plane_t plane;
+  plane.value = a0 + delta_col * bounds->x_ref_offset + delta_row * bounds->y_ref_offset;
+  plane.delta_col = delta_col;
+  plane.delta_row = delta_row;
+  return plane;
+}
+
+static raster_plane_t make_attribute_plane(const raster_setup_t *setup, const raster_bounds_t *bounds, float a0, float a1, float a2)
+{
+  return bounds->is_small ? make_small_raster_plane(setup, bounds, a0, a1, a2) : make_raster_plane(bounds, a0, a1, a2);
+}
+
+float get_raster_plane_row(const raster_setup_t *setup, const raster_plane_t *plane, int y)
+{
+  return (float)(plane->value + plane->delta_row * (y - setup->y_ref));
+}
+
+/**
+ * Mip level selection. With perspective, the area of texture that a pixel covers is
+ * q0 q1 q2 * uv_area / screen_area / q^3, where q0, q1, q2 are the 1 / w of the vertices and q the pixel's.
+ * Its level is half the log2 of that area in texels of the first level, rounded to nearest, so each level starts at a
+ * threshold on q, which the kernels compare with the 1 / w they compute anyway.
+ */
+// Ratios between the 1 / w thresholds of consecutive mip levels: 2^(-1/3), then 2^(-2/3)
+#define MIP_THRESHOLD_FIRST_STEP 0.79370052598409973738
+#define MIP_THRESHOLD_STEP 0.62996052494743658238
+
+static void setup_triangle_texture_levels(const triangle_t *triangle, raster_setup_t *setup)
+{
+  setup->min_texture_level = 0;
+  setup->max_texture_level = 0;
+  const texture_level_t *base = &setup->texture->levels[0];
+  double screen_area = fabs(((double)triangle->points[1].x - triangle->points[0].x) * ((double)triangle->points[2].y - triangle->points[0].y) -
+                            ((double)triangle->points[1].y - triangle->points[0].y) * ((double)triangle->points[2].x - triangle->points[0].x));
+  double uv_area = fabs(((double)triangle->texcoords[1].u - triangle->texcoords[0].u) * ((double)triangle->texcoords[2].v - triangle->texcoords[0].v) -
+                        ((double)triangle->texcoords[1].v - triangle->texcoords[0].v) * ((double)triangle->texcoords[2].u - triangle->texcoords[0].u));
+  if (!is_texture_mipmapping_enabled() || setup->texture->num_levels == 1 || screen_area == 0.0 || uv_area == 0.0)
+  {
+    return;
+  }
+
+  // Level L starts where L - 0.5 <= 0.5 * log2(texel_scale / q^3), i.e. q <= cbrt(texel_scale) * 2^((1 - 2L) / 3)
+  double texel_scale = (double)setup->inv_w[0] * setup->inv_w[1] * setup->inv_w[2] * uv_area / screen_area * base->width * base->height;
+  double threshold = cbrt(texel_scale) * MIP_THRESHOLD_FIRST_STEP;
+  for (int level = 1; level < setup->texture->num_levels; level++)
+  {
+    setup->texture_level_thresholds[level] = (float)threshold;
+    threshold *= MIP_THRESHOLD_STEP;
+  }
+
+  // 1 / w is linear over the triangle, so its pixels are between the levels of its vertices
+  float inv_w_min = fminf(setup->inv_w[0], fminf(setup->inv_w[1], setup->inv_w[2]));
+  float inv_w_max = fmaxf(setup->inv_w[0], fmaxf(setup->inv_w[1], setup->inv_w[2]));
+  setup->max_texture_level = setup->texture->num_levels - 1;
+  int min_level = get_pixel_texture_level(setup, inv_w_max) - setup->texture->levels;
+  int max_level = get_pixel_texture_level(setup, inv_w_min) - setup->texture->levels;
+  setup->min_texture_level = min_level;
+  setup->max_texture_level = max_level;
+}
+
+// Query texture information once for the whole triangle; needs the inverse w's
+static void setup_triangle_texture(const triangle_t *triangle, texture_t *texture, raster_setup_t *setup)
+{
+  setup->texture = texture;
+  setup->texel_lines = NULL;
+  setup_triangle_texture_levels(triangle, setup);
+  for (int i = 0; i < 3; i++)
+  {
+    setup->texcoords[i] = triangle->texcoords[i];
+    setup->u_over_w[i] = triangle->texcoords[i].u * setup->inv_w[i];
+    setup->v_over_w[i] = triangle->texcoords[i].v * setup->inv_w[i];
+  }
+}
+
 // Highly parallelizable triangle rasterizations, algorithm from Juan Pineda's 1988 paper
 // https://www.cs.drexel.edu/~deb39/Classes/Papers/comp175-06-pineda.pdf
-void draw_filled_triangle(triangle_t triangle, color_t color)
+static bool setup_triangle_raster(triangle_t *triangle, const tile_t *tile, raster_setup_t *setup, raster_bounds_t *bounds)
 {
+  setup->is_depth_equal = false;
+  setup->depth_format = get_depth_format();
+  setup->depth_epoch_tag = get_depth_epoch_tag(tile->x_min, tile->y_min);
+
   // Vertices
-  vec4_t v0 = triangle.points[0];
-  vec4_t v1 = triangle.points[1];
-  vec4_t v2 = triangle.points[2];
-
-  vec2_t v0_xy = vec4_xy(v0);
-  vec2_t v1_xy = vec4_xy(v1);
-  vec2_t v2_xy = vec4_xy(v2);
-
-  // Used to compute barycentric coordinates
-  float area_parallelogram = edge_cross(
-      v0_xy,
-      v1_xy,
-      v2_xy);
-
-  // Used for perspective-correct barycentric interpolation
-  float inv_w_v0 = 1.0 / v0.w;
-  float inv_w_v1 = 1.0 / v1.w;
-  float inv_w_v2 = 1.0 / v2.w;
-
-  // Get the bounding box
-  int x_min = floor(fmin(v0.x, fmin(v1.x, v2.x)));
-  int y_min = floor(fmin(v0.y, fmin(v1.y, v2.y)));
-  int x_max = ceil(fmax(v0.x, fmax(v1.x, v2.x)));
-  int y_max = ceil(fmax(v0.y, fmax(v1.y, v2.y)));
+  vec4_t v0 = triangle->points[0];
+  vec4_t v1 = triangle->points[1];
+  vec4_t v2 = triangle->points[2];
+
+  // Snap the vertices to the sub-pixel grid, so that the edge functions are exact integers.
+  // Triangles sharing an edge then agree exactly on which pixels belong to that edge.
+  int x0 = to_fixed_point(v0.x);
+  int y0 = to_fixed_point(v0.y);
+  int x1 = to_fixed_point(v1.x);
+  int y1 = to_fixed_point(v1.y);
+  int x2 = to_fixed_point(v2.x);
+  int y2 = to_fixed_point(v2.y);
+
+  // Used to compute barycentric coordinates. Back-facing and degenerate triangles have no pixel inside all three edges.
+  int64_t area_parallelogram = edge_function_fixed(x0, y0, x1, y1, x2, y2);
+  if (area_parallelogram <= 0)
+  {
+    return false;
+  }
+  setup->inv_area = 1.0f / (float)area_parallelogram;
+
+  setup_triangle_inv_w(triangle, setup);
+
+  // Get the bounding box of the pixel centers covered by the triangle
+  get_pixel_center_bounds(x0, y0, x1, y1, x2, y2, bounds);
+
+  // Scissor the bounding box to the screen, since guard-band clipping leaves vertices outside of it.
+  // The attribute planes are anchored at the scissored box so that they don't depend on the tile, and stay precise on
+  // screen however far the triangle extends beyond it.
+  bounds->x_min = bounds->x_min > 0 ? bounds->x_min : 0;
+  bounds->y_min = bounds->y_min > 0 ? bounds->y_min : 0;
+  bounds->x_max = bounds->x_max < get_window_width() - 1 ? bounds->x_max : get_window_width() - 1;
+  bounds->y_max = bounds->y_max < get_window_height() - 1 ? bounds->y_max : get_window_height() - 1;
+  setup->x_ref = bounds->x_min;
+  setup->y_ref = bounds->y_min;
+
+  // Only rasterize the part of the bounding box that overlaps the tile
+  bounds->x_min = bounds->x_min > tile->x_min ? bounds->x_min : tile->x_min;
+  bounds->y_min = bounds->y_min > tile->y_min ? bounds->y_min : tile->y_min;
+  bounds->x_max = bounds->x_max < tile->x_max - 1 ? bounds->x_max : tile->x_max - 1;
+  bounds->y_max = bounds->y_max < tile->y_max - 1 ? bounds->y_max : tile->y_max - 1;
+  if (bounds->x_min > bounds->x_max || bounds->y_min > bounds->y_max)
+  {
+    return false;
+  }
 
   // Compute the delta for the w's per column and per row, since these deltas are constant.
   // This is because the barycentric coordinate is parallel across the edges.
-  // To derive these formulas, use FOIL expansion on the cross product formula
-  float delta_w0_col = v1.y - v2.y;
-  float delta_w1_col = v2.y - v0.y;
-  float delta_w2_col = v0.y - v1.y;
+  // To derive these formulas, use FOIL expansion on the cross product formula.
+  // One pixel is SUBPIXEL_SCALE units in fixed point.
+  setup->delta_w0_col = (y1 - y2) * SUBPIXEL_SCALE;
+  setup->delta_w1_col = (y2 - y0) * SUBPIXEL_SCALE;
+  setup->delta_w2_col = (y0 - y1) * SUBPIXEL_SCALE;
 
-  float delta_w0_row = v2.x - v1.x;
-  float delta_w1_row = v0.x - v2.x;
-  float delta_w2_row = v1.x - v0.x;
+  bounds->delta_w0_row = (int64_t)(x2 - x1) * SUBPIXEL_SCALE;
+  bounds->delta_w1_row = (int64_t)(x0 - x2) * SUBPIXEL_SCALE;
+  bounds->delta_w2_row = (int64_t)(x1 - x0) * SUBPIXEL_SCALE;
 
   // Bias factors for precedence in rasterization
-  // Ideally, we represent this as a fixed-point number to fix holes in rasterizations
-  // We use fixed-point numbers so that we know exactly the difference between each number is in resolution.
-  float bias0 = is_top_left(&v1_xy, &v2_xy) ? 0 : -0.0001;
-  float bias1 = is_top_left(&v2_xy, &v0_xy) ? 0 : -0.0001;
-  float bias2 = is_top_left(&v0_xy, &v1_xy) ? 0 : -0.0001;
-
-  // Compute the initial values for the edge functions
-  vec2_t p0 = {x_min + 0.5, y_min + 0.5}; // Add a bias of 0.5 to test always the middle point of the vertex
-  vec3_t barycentric_unnormalized_row = compute_barycentric_unnormalized(v0_xy, v1_xy, v2_xy, p0);
-  // Add the bias
-  barycentric_unnormalized_row = vec3_add(barycentric_unnormalized_row, vec3_create(bias0, bias1, bias2));
-  float w0_row = barycentric_unnormalized_row.x;
-  float w1_row = barycentric_unnormalized_row.y;
-  float w2_row = barycentric_unnormalized_row.z;
-
-  for (int yi = y_min; yi <= y_max; yi++)
-  {
-    float w0 = w0_row;
-    float w1 = w1_row;
-    float w2 = w2_row;
-    for (int xi = x_min; xi <= x_max; xi++)
+  // Pixels exactly on an edge belong to the triangle only if the edge is a top or left edge.
+  // Since the edge functions are integers, a bias of -1 turns "w >= 0" into "w > 0" for the other edges.
+  vec2_t v0_fixed = {x0, y0};
+  vec2_t v1_fixed = {x1, y1};
+  vec2_t v2_fixed = {x2, y2};
+  setup->bias[0] = is_top_left(&v1_fixed, &v2_fixed) ? 0 : -1;
+  setup->bias[1] = is_top_left(&v2_fixed, &v0_fixed) ? 0 : -1;
+  setup->bias[2] = is_top_left(&v0_fixed, &v1_fixed) ? 0 : -1;
+
+  // Compute the initial values for the edge functions at the middle of the first pixel
+  int px = bounds->x_min * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+  int py = bounds->y_min * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+  bounds->w0_row = edge_function_fixed(x1, y1, x2, y2, px, py);
+  bounds->w1_row = edge_function_fixed(x2, y2, x0, y0, px, py);
+  bounds->w2_row = edge_function_fixed(x0, y0, x1, y1, px, py);
+
+  // Small triangles cover a few pixels at most, which repay neither the exact planes nor the coarse z test: their
+  // planes start from vertex 0, and the depth test rejects their hidden pixels
+  if (bounds->is_small)
+  {
+    bounds->x_ref_offset = (float)(setup->x_ref * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2 - x0) / SUBPIXEL_SCALE;
+    bounds->y_ref_offset = (float)(setup->y_ref * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2 - y0) / SUBPIXEL_SCALE;
+    setup->inv_w_plane = make_small_raster_plane(setup, bounds, setup->inv_w[0], setup->inv_w[1], setup->inv_w[2]);
+    return true;
+  }
+
+  // The barycentric coordinates, and so every attribute divided by w, are linear in screen space.
+  // Their planes are computed exactly from the edge functions at the reference pixel.
+  int px_ref = setup->x_ref * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+  int py_ref = setup->y_ref * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+  bounds->alpha_plane.value = (double)edge_function_fixed(x1, y1, x2, y2, px_ref, py_ref) / area_parallelogram;
+  bounds->alpha_plane.delta_col = (double)setup->delta_w0_col / area_parallelogram;
+  bounds->alpha_plane.delta_row = (double)bounds->delta_w0_row / area_parallelogram;
+  bounds->beta_plane.value = (double)edge_function_fixed(x2, y2, x0, y0, px_ref, py_ref) / area_parallelogram;
+  bounds->beta_plane.delta_col = (double)setup->delta_w1_col / area_parallelogram;
+  bounds->beta_plane.delta_row = (double)bounds->delta_w1_row / area_parallelogram;
+  setup->inv_w_plane = make_raster_plane(bounds, setup->inv_w[0], setup->inv_w[1], setup->inv_w[2]);
+
+  // Hierarchical z: skip the triangle if its nearest point is behind everything already drawn under it
+  float max_inv_w = setup->inv_w[0] > setup->inv_w[1] ? setup->inv_w[0] : setup->inv_w[1];
+  max_inv_w = max_inv_w > setup->inv_w[2] ? max_inv_w : setup->inv_w[2];
+  if (1.0 - max_inv_w - DEPTH_BOUND_TOLERANCE >= get_coarse_z_buffer_max(bounds->x_min, bounds->y_min, bounds->x_max, bounds->y_max))
+  {
+    add_render_stat(STAT_TRIANGLES_OCCLUDED, 1);
+    return false;
+  }
+
+  return true;
+}
+
+static bool fits_int32(int64_t value)
+{
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Rasterizes the pixels x_start..x_end of row y, given the edge functions at pixel x_start
+static int rasterize_contiguous_span(const raster_setup_t *setup, raster_span_t span, int y, int x_start, int x_end,
+                                     int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  // The edge functions are linear along the row, so checking both ends is enough
+  int span_length = x_end - x_start;
+  int64_t w0_end = w0 + (int64_t)span_length * setup->delta_w0_col;
+  int64_t w1_end = w1 + (int64_t)span_length * setup->delta_w1_col;
+  int64_t w2_end = w2 + (int64_t)span_length * setup->delta_w2_col;
+  bool is_span_int32 = fits_int32(w0) && fits_int32(w1) && fits_int32(w2) &&
+                       fits_int32(w0_end) && fits_int32(w1_end) && fits_int32(w2_end);
+
+  return (is_span_int32 ? span : setup->scalar_span)(setup, y, x_start, x_end, w0, w1, w2, is_covered);
+}
+
+static int rasterize_span(const raster_setup_t *setup, raster_span_t span, int y, int x_start, int x_end,
+                          int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  if (are_framebuffer_rows_contiguous())
+  {
+    return rasterize_contiguous_span(setup, span, y, x_start, x_end, w0, w1, w2, is_covered);
+  }
+
+  // Otherwise only the pixels of a block row are contiguous, so each one is a separate span
+  int shaded = 0;
+  for (int x = x_start; x <= x_end;)
+  {
+    int block_end = x - x % FRAMEBUFFER_BLOCK_SIZE + FRAMEBUFFER_BLOCK_SIZE - 1;
+    int segment_end = block_end < x_end ? block_end : x_end;
+    int64_t offset = x - x_start;
+    shaded += rasterize_contiguous_span(setup, span, y, x, segment_end,
+                                        w0 + offset * setup->delta_w0_col,
+                                        w1 + offset * setup->delta_w1_col,
+                                        w2 + offset * setup->delta_w2_col,
+                                        is_covered);
+    x = segment_end + 1;
+  }
+  return shaded;
+}
+
+typedef enum block_coverage
+{
+  BLOCK_OUTSIDE,
+  BLOCK_PARTIAL,
+  BLOCK_INSIDE,
+  BLOCK_OCCLUDED // Covered, but behind the coarse z-buffer
+} block_coverage;
+
+// Value of an edge function at pixel (x, y), stepped from its value at the bounding box origin
+static int64_t edge_function_at(int64_t w_origin, int64_t delta_col, int64_t delta_row, const raster_bounds_t *bounds, int x, int y)
+{
+  return w_origin + (x - bounds->x_min) * delta_col + (y - bounds->y_min) * delta_row;
+}
+
+/**
+ * Classifies the pixels [x_start, x_end] x [y_start, y_end] against the three edges.
+ * An edge function is linear, so over a block its minimum and maximum are at two of the four corners. These are
+ * picked from the signs of the deltas: if the maximum of any edge is outside, no pixel of the block is inside,
+ * and if the minimum of every edge is inside, all pixels are.
+ */
+static block_coverage classify_block(const raster_setup_t *setup, const raster_bounds_t *bounds,
+                                     int x_start, int y_start, int x_end, int y_end)
+{
+  const int64_t w_origin[3] = {bounds->w0_row, bounds->w1_row, bounds->w2_row};
+  const int64_t delta_col[3] = {setup->delta_w0_col, setup->delta_w1_col, setup->delta_w2_col};
+  const int64_t delta_row[3] = {bounds->delta_w0_row, bounds->delta_w1_row, bounds->delta_w2_row};
+
+  bool is_inside = true;
+  for (int i = 0; i < 3; i++)
+  {
+    int64_t w = edge_function_at(w_origin[i], delta_col[i], delta_row[i], bounds, x_start, y_start) + setup->bias[i];
+    int64_t col_extent = (x_end - x_start) * delta_col[i];
+    int64_t row_extent = (y_end - y_start) * delta_row[i];
+    int64_t w_max = w + (col_extent > 0 ? col_extent : 0) + (row_extent > 0 ? row_extent : 0);
+    int64_t w_min = w + (col_extent < 0 ? col_extent : 0) + (row_extent < 0 ? row_extent : 0);
+    if (w_max < 0)
     {
+      return BLOCK_OUTSIDE;
+    }
+    is_inside = is_inside && w_min >= 0;
+  }
+  return is_inside ? BLOCK_INSIDE : BLOCK_PARTIAL;
+}
 
-      /**
-       *  The point p is inside the triangle if it is to the right of all three edges of the triangle.
-       *  Hello, cross product! We can use the cross product's sign to determine if an edge is in correct direction.
-       *  We can't use the cross product in 2D, but we "cheat" by using the z-axis as the result.
-       *
-       *  "Cross products", or 'edge functions' according to Juan Pineda.
-       *  These are actually the barycentric coordinates of the triangle, but not divided by the area of the parallelogram formed by the triangle.
-       *  Adding a bias essentially "shrinks" the non-top-left edges of the triangle.
-       */
-
-      // We actually DON'T have to compute the w's every iteration, because the delta of the cross
-      // products is CONSTANT per iteration. So we can just compute an initial value for the w's,
-      // then increment by a computed delta.
-      /*
-      vec2_t p = {xi, yi};
+// Nearest depth of the triangle's plane over the pixels [x_start, x_end] x [y_start, y_end]
+static float get_block_min_depth(const raster_setup_t *setup, int x_start, int y_start, int x_end, int y_end)
+{
+  const raster_plane_t *plane = &setup->inv_w_plane;
+  double inv_w = plane->value + (x_start - setup->x_ref) * plane->delta_col + (y_start - setup->y_ref) * plane->delta_row;
+  double col_extent = (x_end - x_start) * plane->delta_col;
+  double row_extent = (y_end - y_start) * plane->delta_row;
+  double max_inv_w = inv_w + (col_extent > 0 ? col_extent : 0) + (row_extent > 0 ? row_extent : 0);
+  return 1.0 - max_inv_w - DEPTH_BOUND_TOLERANCE;
+}
 
-      vec3_t barycentric_unnormalized = compute_barycentric_unnormalized(v0_xy, v1_xy, v2_xy, p);
+// Rasterizes the rows y_start..y_end of a run of horizontally adjacent blocks with the same coverage.
+// Returns the number of pixels shaded.
+static int rasterize_block_run(const raster_setup_t *setup, const raster_bounds_t *bounds, raster_span_t span,
+                               int x_start, int y_start, int x_end, int y_end, block_coverage coverage)
+{
+  if (coverage == BLOCK_OUTSIDE || coverage == BLOCK_OCCLUDED)
+  {
+    return 0;
+  }
+  int64_t w0 = edge_function_at(bounds->w0_row, setup->delta_w0_col, bounds->delta_w0_row, bounds, x_start, y_start);
+  int64_t w1 = edge_function_at(bounds->w1_row, setup->delta_w1_col, bounds->delta_w1_row, bounds, x_start, y_start);
+  int64_t w2 = edge_function_at(bounds->w2_row, setup->delta_w2_col, bounds->delta_w2_row, bounds, x_start, y_start);
+  int shaded = 0;
+  for (int yi = y_start; yi <= y_end; yi++)
+  {
+    shaded += rasterize_span(setup, span, yi, x_start, x_end, w0, w1, w2, coverage == BLOCK_INSIDE);
+    w0 += bounds->delta_w0_row;
+    w1 += bounds->delta_w1_row;
+    w2 += bounds->delta_w2_row;
+  }
 
-      float w0 = barycentric_unnormalized.x;
-      float w1 = barycentric_unnormalized.y;
-      float w2 = barycentric_unnormalized.z;
-      */
+  // Tighten the coarse z-buffer over the blocks that were drawn. An equal-depth pass only marks pixels consumed, which
+  // makes them farther: the coarse z-buffer stays below them, so the depths still to match it are never rejected.
+  if (!setup->is_depth_equal)
+  {
+    for (int block_x = x_start / RASTER_BLOCK_SIZE; block_x <= x_end / RASTER_BLOCK_SIZE; block_x++)
+    {
+      update_coarse_z_buffer_at(block_x, y_start / RASTER_BLOCK_SIZE);
+    }
+  }
+  return shaded;
+}
 
-      float alpha = w0 / area_parallelogram;
-      float beta = w1 / area_parallelogram;
-      float gamma = 1.0 - alpha - beta;
+/**
+ * Fast path for triangles of at most SMALL_TRIANGLE_SIZE x SMALL_TRIANGLE_SIZE pixels, which would only visit a few
+ * partial blocks: the rows are handed straight to the scalar kernel, whose edge functions never overflow here.
+ * Their setup is lean too: float planes from vertex 0, one mip level per triangle, and no coarse z test.
+ * The coarse z-buffer is not tightened afterwards; it stays conservative, as depths are only ever lowered.
+ */
+static void rasterize_small_triangle(const raster_setup_t *setup, const raster_bounds_t *bounds)
+{
+  int64_t w0 = bounds->w0_row;
+  int64_t w1 = bounds->w1_row;
+  int64_t w2 = bounds->w2_row;
+  int shaded = 0;
+  for (int yi = bounds->y_min; yi <= bounds->y_max; yi++)
+  {
+    shaded += rasterize_span(setup, setup->scalar_span, yi, bounds->x_min, bounds->x_max, w0, w1, w2, false);
+    w0 += bounds->delta_w0_row;
+    w1 += bounds->delta_w1_row;
+    w2 += bounds->delta_w2_row;
+  }
+  add_render_stat(STAT_PIXELS_SHADED, shaded);
+}
+
+/**
+ * Walks the bounding box in screen-aligned blocks of RASTER_BLOCK_SIZE x RASTER_BLOCK_SIZE pixels.
+ * Blocks outside the triangle are skipped, blocks inside it are filled without edge tests, and only the blocks
+ * crossed by an edge are tested per pixel. Blocks whose nearest depth is behind the coarse z-buffer are skipped too.
+ * Adjacent blocks with the same coverage are merged into one span per row so that the span kernels still see long runs.
+ */
+static void rasterize_blocks(const raster_setup_t *setup, const raster_bounds_t *bounds, raster_span_t span)
+{
+  if (bounds->is_small)
+  {
+    rasterize_small_triangle(setup, bounds);
+    return;
+  }
 
-      if (is_point_inside_triangle(w0, w1, w2, bias0, bias1, bias2))
+  int block_counts[4] = {0, 0, 0, 0};
+  int shaded = 0;
+  int block_x_first = bounds->x_min - bounds->x_min % RASTER_BLOCK_SIZE;
+  int block_y_first = bounds->y_min - bounds->y_min % RASTER_BLOCK_SIZE;
+  for (int block_y = block_y_first; block_y <= bounds->y_max; block_y += RASTER_BLOCK_SIZE)
+  {
+    int y_start = block_y > bounds->y_min ? block_y : bounds->y_min;
+    int y_end = block_y + RASTER_BLOCK_SIZE - 1 < bounds->y_max ? block_y + RASTER_BLOCK_SIZE - 1 : bounds->y_max;
+
+    int run_x_start = bounds->x_min;
+    int run_x_end = bounds->x_min - 1;
+    block_coverage run_coverage = BLOCK_OUTSIDE;
+    for (int block_x = block_x_first; block_x <= bounds->x_max; block_x += RASTER_BLOCK_SIZE)
+    {
+      int x_start = block_x > bounds->x_min ? block_x : bounds->x_min;
+      int x_end = block_x + RASTER_BLOCK_SIZE - 1 < bounds->x_max ? block_x + RASTER_BLOCK_SIZE - 1 : bounds->x_max;
+
+      block_coverage coverage = classify_block(setup, bounds, x_start, y_start, x_end, y_end);
+      if (coverage != BLOCK_OUTSIDE &&
+          get_block_min_depth(setup, x_start, y_start, x_end, y_end) >= get_coarse_z_buffer_at(block_x / RASTER_BLOCK_SIZE, block_y / RASTER_BLOCK_SIZE))
+      {
+        coverage = BLOCK_OCCLUDED;
+      }
+      block_counts[coverage]++;
+      if (coverage != run_coverage)
       {
-        draw_triangle_pixel(xi, yi,
-                            alpha, beta, gamma,
-                            inv_w_v0, inv_w_v1, inv_w_v2,
-                            color);
+        shaded += rasterize_block_run(setup, bounds, span, run_x_start, y_start, run_x_end, y_end, run_coverage);
+        run_x_start = x_start;
+        run_coverage = coverage;
       }
-      w0 += delta_w0_col;
-      w1 += delta_w1_col;
-      w2 += delta_w2_col;
+      run_x_end = x_end;
     }
-    w0_row += delta_w0_row;
-    w1_row += delta_w1_row;
-    w2_row += delta_w2_row;
+    shaded += rasterize_block_run(setup, bounds, span, run_x_start, y_start, run_x_end, y_end, run_coverage);
   }
-  return;
+
+  add_render_stat(STAT_BLOCKS_REJECTED, block_counts[BLOCK_OUTSIDE]);
+  add_render_stat(STAT_BLOCKS_PARTIAL, block_counts[BLOCK_PARTIAL]);
+  add_render_stat(STAT_BLOCKS_ACCEPTED, block_counts[BLOCK_INSIDE]);
+  add_render_stat(STAT_BLOCKS_OCCLUDED, block_counts[BLOCK_OCCLUDED]);
+  add_render_stat(STAT_PIXELS_SHADED, shaded);
 }
 
-void draw_textured_triangle(triangle_t triangle, upng_t *texture)
+void draw_filled_triangle(triangle_t triangle, color_t color, const tile_t *tile)
 {
-  // Vertices
-  vec4_t v0 = triangle.points[0];
-  vec4_t v1 = triangle.points[1];
-  vec4_t v2 = triangle.points[2];
-
-  vec2_t v0_xy = vec4_xy(v0);
-  vec2_t v1_xy = vec4_xy(v1);
-  vec2_t v2_xy = vec4_xy(v2);
-
-  // Used to compute barycentric coordinates
-  float area_parallelogram = edge_cross(
-      v0_xy,
-      v1_xy,
-      v2_xy);
-
-  // Used for perspective-correct barycentric interpolation
-  float inv_w_v0 = 1.0 / v0.w;
-  float inv_w_v1 = 1.0 / v1.w;
-  float inv_w_v2 = 1.0 / v2.w;
-
-  // Get the bounding box
-  int x_min = floor(fmin(v0.x, fmin(v1.x, v2.x)));
-  int y_min = floor(fmin(v0.y, fmin(v1.y, v2.y)));
-  int x_max = ceil(fmax(v0.x, fmax(v1.x, v2.x)));
-  int y_max = ceil(fmax(v0.y, fmax(v1.y, v2.y)));
+  raster_setup_t setup;
+  raster_bounds_t bounds;
+  if (!setup_triangle_raster(&triangle, tile, &setup, &bounds))
+  {
+    return;
+  }
+  setup.color = color;
+  setup.scalar_span = draw_filled_span_scalar;
 
-  // Compute the delta for the w's per column and per row, since these deltas are constant.
-  // This is because the barycentric coordinate is parallel across the edges.
-  // To derive these formulas, use FOIL expansion on the cross product formula
-  float delta_w0_col = v1.y - v2.y;
-  float delta_w1_col = v2.y - v0.y;
-  float delta_w2_col = v0.y - v1.y;
+  rasterize_blocks(&setup, &bounds, filled_span_kernels[get_span_kernel()]);
+}
 
-  float delta_w0_row = v2.x - v1.x;
-  float delta_w1_row = v0.x - v2.x;
-  float delta_w2_row = v1.x - v0.x;
+static void rasterize_textured_triangle(triangle_t *triangle, texture_t *texture, const tile_t *tile, bool is_depth_equal)
+{
+  if (texture == NULL)
+  {
+    return;
+  }
 
-  // Bias factors for precedence in rasterization
-  // Ideally, we represent this as a fixed-point number to fix holes in rasterizations
-  // We use fixed-point numbers so that we know exactly the difference between each number is in resolution.
-  float bias0 = is_top_left(&v1_xy, &v2_xy) ? 0 : -0.0001;
-  float bias1 = is_top_left(&v2_xy, &v0_xy) ? 0 : -0.0001;
-  float bias2 = is_top_left(&v0_xy, &v1_xy) ? 0 : -0.0001;
-
-  // Compute the initial values for the edge functions
-  vec2_t p0 = {x_min + 0.5, y_min + 0.5}; // Add a bias of 0.5 to test always the middle point of the vertex
-  vec3_t barycentric_unnormalized_row = compute_barycentric_unnormalized(v0_xy, v1_xy, v2_xy, p0);
-  // Add the bias
-  barycentric_unnormalized_row = vec3_add(barycentric_unnormalized_row, vec3_create(bias0, bias1, bias2));
-  float w0_row = barycentric_unnormalized_row.x;
-  float w1_row = barycentric_unnormalized_row.y;
-  float w2_row = barycentric_unnormalized_row.z;
-
-  for (int yi = y_min; yi <= y_max; yi++)
-  {
-    float w0 = w0_row;
-    float w1 = w1_row;
-    float w2 = w2_row;
-    for (int xi = x_min; xi <= x_max; xi++)
+  raster_setup_t setup;
+  raster_bounds_t bounds;
+  if (!setup_triangle_raster(triangle, tile, &setup, &bounds))
+  {
+    return;
+  }
+  setup.is_depth_equal = is_depth_equal;
+  setup.scalar_span = draw_textured_span_scalar;
+  setup_triangle_texture(triangle, texture, &setup);
+  setup.u_over_w_plane = make_attribute_plane(&setup, &bounds, setup.u_over_w[0], setup.u_over_w[1], setup.u_over_w[2]);
+  setup.v_over_w_plane = make_attribute_plane(&setup, &bounds, setup.v_over_w[0], setup.v_over_w[1], setup.v_over_w[2]);
+  int texel_lines = 0;
+  setup.texel_lines = is_render_stats_enabled() ? &texel_lines : NULL; // Counting is only worth its cost for the stats
+
+  rasterize_blocks(&setup, &bounds, textured_span_kernels[get_span_kernel()]);
+  add_render_stat(STAT_TEXEL_BYTES, texel_lines * CACHE_LINE_SIZE);
+}
+
+void draw_textured_triangle(triangle_t triangle, texture_t *texture, const tile_t *tile)
+{
+  rasterize_textured_triangle(&triangle, texture, tile, false);
+}
+
+void draw_depth_triangle(triangle_t triangle, const tile_t *tile)
+{
+  raster_setup_t setup;
+  raster_bounds_t bounds;
+  if (!setup_triangle_raster(&triangle, tile, &setup, &bounds))
+  {
+    return;
+  }
+  setup.scalar_span = draw_depth_span_scalar;
+
+  rasterize_blocks(&setup, &bounds, depth_span_kernels[get_span_kernel()]);
+}
+
+// The coarse z-buffer already holds the final depths, so occluded blocks and triangles are still skipped
+void draw_textured_triangle_depth_equal(triangle_t triangle, texture_t *texture, const tile_t *tile)
+{
+  rasterize_textured_triangle(&triangle, texture, tile, true);
+}
+
+void draw_visibility_triangle(triangle_t triangle, int triangle_id, const tile_t *tile)
+{
+  // Untextured triangles are skipped, like in draw_textured_triangle
+  if (triangle.texture == NULL)
+  {
+    return;
+  }
+
+  raster_setup_t setup;
+  raster_bounds_t bounds;
+  if (!setup_triangle_raster(&triangle, tile, &setup, &bounds))
+  {
+    return;
+  }
+  setup.triangle_id = triangle_id;
+  setup.scalar_span = draw_visibility_span_scalar;
+
+  rasterize_blocks(&setup, &bounds, visibility_span_kernels[get_span_kernel()]);
+}
+
+/**
+ * Textures every covered pixel of the tile exactly once, from the triangle and barycentrics in the visibility buffer.
+ * Neighboring pixels mostly belong to the same triangle, so its constants are only set up again when the id changes.
+ */
+void resolve_visibility_buffer(const triangle_t *triangles, const tile_t *tile)
+{
+  raster_setup_t setup;
+  setup.texture = NULL; // Set up with the first covered pixel
+  int setup_triangle_id = -1;
+  int shaded = 0;
+  int texel_lines = 0;
+  for (int yi = tile->y_min; yi < tile->y_max; yi++)
+  {
+    const int *triangle_id_row = get_triangle_id_buffer_row(yi);
+    const float *alpha_row = get_alpha_buffer_row(yi);
+    const float *beta_row = get_beta_buffer_row(yi);
+    color_t *color_row = NULL;
+    uintptr_t last_texel_line = 0;
+    for (int xi = tile->x_min; xi < tile->x_max; xi++)
     {
+      if (xi % FRAMEBUFFER_BLOCK_SIZE == 0 || xi == tile->x_min)
+      {
+        color_row = get_color_buffer_span(xi, yi);
+      }
+      int triangle_id = triangle_id_row[xi];
+      if (triangle_id < 0)
+      {
+        continue;
+      }
+      if (triangle_id != setup_triangle_id)
+      {
+        const triangle_t *triangle = &triangles[triangle_id];
+        setup_triangle_inv_w(triangle, &setup);
+        setup_triangle_texture(triangle, triangle->texture, &setup);
+        setup_triangle_id = triangle_id;
+      }
 
-      float alpha = w0 / area_parallelogram;
-      float beta = w1 / area_parallelogram;
-      float gamma = 1.0 - alpha - beta;
+      float alpha = alpha_row[xi];
+      float beta = beta_row[xi];
+      float gamma = 1.0f - alpha - beta;
+
+      float u = setup.u_over_w[0] * alpha + setup.u_over_w[1] * beta + setup.u_over_w[2] * gamma;
+      float v = setup.v_over_w[0] * alpha + setup.v_over_w[1] * beta + setup.v_over_w[2] * gamma;
+      float inverse_w = setup.inv_w[0] * alpha + setup.inv_w[1] * beta + setup.inv_w[2] * gamma;
+      float w = 1.0f / inverse_w;
+      u *= w;
+      v *= w;
+
+      const texture_level_t *level = get_pixel_texture_level(&setup, inverse_w);
+      int texel_index = get_texel_index_at(level, u, v);
+      count_texel_line(get_texel_address(level, texel_index), &last_texel_line, &texel_lines);
+      color_row[xi] = fetch_texel(level, texel_index);
+      shaded++;
+    }
+  }
+  add_render_stat(STAT_PIXELS_SHADED, shaded);
+  add_render_stat(STAT_TEXEL_BYTES, texel_lines * CACHE_LINE_SIZE);
+}
+
+/**
+ * Depth test of one pixel against a row of the z-buffer, in any depth format. When it passes, the depth is written.
+ * With is_depth_equal, it only passes when the depth equals the z-buffer's, and the pixel is then marked consumed with
+ * the farthest value of the format, which no fragment produces: two triangles with the same depth at a pixel would
+ * otherwise both shade it. The unsigned normalized formats store 1 - 1/w rounded down, and never quite reach their
+ * maximum; the 24-bit ones carry epoch_tag in their top bits.
+ */
+static inline bool depth_test(void *depth_row, int xi, float inverse_w, depth_format format, uint32_t epoch_tag,
+                              bool is_depth_equal)
+{
+  switch (format)
+  {
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+  {
+    // Nearer objects get greater inverse w values, so 1 / w is stored as is and the greater depth passes
+    float *z_row = (float *)depth_row;
+    bool is_nearer = is_depth_equal ? inverse_w == z_row[xi] : inverse_w > z_row[xi];
+    if (is_nearer)
+    {
+      z_row[xi] = is_depth_equal ? -INFINITY : inverse_w;
+    }
+    return is_nearer;
+  }
+  case DEPTH_FORMAT_UNORM16:
+  {
+    uint16_t *z_row = (uint16_t *)depth_row;
+    float unorm = (1.0f - inverse_w) * DEPTH_UNORM16_MAX;
+    uint16_t depth = unorm <= 0.0f ? 0 : unorm < DEPTH_UNORM16_MAX - 1 ? (uint16_t)unorm : DEPTH_UNORM16_MAX - 1;
+    bool is_nearer = is_depth_equal ? depth == z_row[xi] : depth < z_row[xi];
+    if (is_nearer)
+    {
+      z_row[xi] = is_depth_equal ? DEPTH_UNORM16_MAX : depth;
+    }
+    return is_nearer;
+  }
+  case DEPTH_FORMAT_UNORM24:
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+  {
+    // Depths of earlier epochs have greater tags, so they compare as farther than any depth of this epoch
+    uint32_t *z_row = (uint32_t *)depth_row;
+    float unorm = (1.0f - inverse_w) * DEPTH_UNORM24_MAX;
+    uint32_t depth = epoch_tag | (unorm <= 0.0f ? 0 : unorm < DEPTH_UNORM24_MAX - 1 ? (uint32_t)unorm : DEPTH_UNORM24_MAX - 1);
+    bool is_nearer = is_depth_equal ? depth == z_row[xi] : depth < z_row[xi];
+    if (is_nearer)
+    {
+      z_row[xi] = is_depth_equal ? epoch_tag | DEPTH_UNORM24_MAX : depth;
+    }
+    return is_nearer;
+  }
+  default:
+  {
+    // Using the inverse w as is is incorrect, as nearer objects get lesser inverse w values than farther ones.
+    // As such, we need to subtract the inverse w from 1.0.
+    float *z_row = (float *)depth_row;
+    float depth = 1.0f - inverse_w;
+    bool is_nearer = is_depth_equal ? depth == z_row[xi] : depth < z_row[xi]; // Draw only if the current depth is less than what is in the z-buffer
+    if (is_nearer)
+    {
+      z_row[xi] = is_depth_equal ? INFINITY : depth;
+    }
+    return is_nearer;
+  }
+  }
+}
+
+// For the pixel-at-a-time rasterizers, which don't specialize on the depth format
+bool test_and_update_depth(void *depth_row, int xi, float inverse_w, depth_format format, uint32_t epoch_tag)
+{
+  return depth_test(depth_row, xi, inverse_w, format, epoch_tag, false);
+}
 
-      if (is_point_inside_triangle(w0, w1, w2, bias0, bias1, bias2))
+// Reference kernels; the SIMD kernels in triangle_simd.c must match them bit for bit in the float depth format.
+// The inner loops make no function calls: the attributes come from the planes of the setup, and the texture from
+// the pointer and dimensions cached there. Every kernel is inlined once per depth format, so that the depth test is
+// specialized for it.
+// The filled and depth-only kernels only differ in the color write, so they share one inlined loop.
+static inline int draw_filled_span(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                   int64_t w0, int64_t w1, int64_t w2, bool is_covered, bool is_depth_only,
+                                   depth_format format)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  void *depth_row = get_depth_buffer_span(x_start, y);
+  const float inv_w_row = get_raster_plane_row(setup, &setup->inv_w_plane, y);
+  const float inv_w_col = (float)setup->inv_w_plane.delta_col;
+  int shaded = 0;
+  for (int xi = x_start; xi <= x_end; xi++)
+  {
+    /**
+     *  The point p is inside the triangle if it is to the right of all three edges of the triangle.
+     *  Hello, cross product! We can use the cross product's sign to determine if an edge is in correct direction.
+     *  We can't use the cross product in 2D, but we "cheat" by using the z-axis as the result.
+     *
+     *  "Cross products", or 'edge functions' according to Juan Pineda.
+     *  These are actually the barycentric coordinates of the triangle, but not divided by the area of the parallelogram formed by the triangle.
+     *  Adding a bias essentially "shrinks" the non-top-left edges of the triangle.
+     */
+    if (is_covered || (w0 + setup->bias[0] >= 0 && w1 + setup->bias[1] >= 0 && w2 + setup->bias[2] >= 0))
+    {
+      float inverse_w = inv_w_row + inv_w_col * (float)(xi - setup->x_ref);
+      if (depth_test(depth_row, xi, inverse_w, format, setup->depth_epoch_tag, false))
       {
-        draw_texel(xi, yi,
-                   alpha, beta, gamma,
-                   inv_w_v0, inv_w_v1, inv_w_v2,
-                   triangle.texcoords[0], triangle.texcoords[1], triangle.texcoords[2],
-                   texture);
+        if (!is_depth_only)
+        {
+          color_row[xi] = setup->color;
+          shaded++;
+        }
       }
-      w0 += delta_w0_col;
-      w1 += delta_w1_col;
-      w2 += delta_w2_col;
     }
-    w0_row += delta_w0_row;
-    w1_row += delta_w1_row;
-    w2_row += delta_w2_row;
+
+    // We actually DON'T have to compute the w's every iteration, because the delta of the cross
+    // products is CONSTANT per iteration. So we can just compute an initial value for the w's,
+    // then increment by a computed delta. In fixed point the increments are exact.
+    w0 += setup->delta_w0_col;
+    w1 += setup->delta_w1_col;
+    w2 += setup->delta_w2_col;
+  }
+  return shaded;
+}
+
+static int draw_filled_span_in_format(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                      int64_t w0, int64_t w1, int64_t w2, bool is_covered, bool is_depth_only)
+{
+  switch (setup->depth_format)
+  {
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+    return draw_filled_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_only, DEPTH_FORMAT_REVERSE_FLOAT);
+  case DEPTH_FORMAT_UNORM16:
+    return draw_filled_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_only, DEPTH_FORMAT_UNORM16);
+  case DEPTH_FORMAT_UNORM24:
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+    return draw_filled_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_only, DEPTH_FORMAT_UNORM24);
+  default:
+    return draw_filled_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_only, DEPTH_FORMAT_FLOAT);
+  }
+}
+
+int draw_filled_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                            int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_in_format(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+// First pass of the Z-prepass: only the depth is written, nothing is shaded
+int draw_depth_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                           int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_in_format(setup, y, x_start, x_end, w0, w1, w2, is_covered, true);
+}
+
+// With is_depth_equal, only the pixels whose depth equals the z-buffer are textured, and they are marked consumed.
+// Both passes compute the depth the same way, so exactly the visible triangle of each pixel passes, and only the
+// first of several triangles at the same depth shades it.
+static inline int draw_textured_span(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                     int64_t w0, int64_t w1, int64_t w2, bool is_covered, bool is_depth_equal,
+                                     depth_format format)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  void *depth_row = get_depth_buffer_span(x_start, y);
+  const float inv_w_row = get_raster_plane_row(setup, &setup->inv_w_plane, y);
+  const float inv_w_col = (float)setup->inv_w_plane.delta_col;
+  const float u_row = get_raster_plane_row(setup, &setup->u_over_w_plane, y);
+  const float u_col = (float)setup->u_over_w_plane.delta_col;
+  const float v_row = get_raster_plane_row(setup, &setup->v_over_w_plane, y);
+  const float v_col = (float)setup->v_over_w_plane.delta_col;
+  int shaded = 0;
+  uintptr_t last_texel_line = 0;
+  int texel_lines = 0;
+  for (int xi = x_start; xi <= x_end; xi++)
+  {
+    if (is_covered || (w0 + setup->bias[0] >= 0 && w1 + setup->bias[1] >= 0 && w2 + setup->bias[2] >= 0))
+    {
+      float x_offset = (float)(xi - setup->x_ref);
+      float inverse_w = inv_w_row + inv_w_col * x_offset;
+      if (depth_test(depth_row, xi, inverse_w, format, setup->depth_epoch_tag, is_depth_equal))
+      {
+        // u / w and v / w are linear in screen space; dividing by the interpolated 1 / w makes them perspective-correct
+        float w = 1.0f / inverse_w;
+        float u = (u_row + u_col * x_offset) * w;
+        float v = (v_row + v_col * x_offset) * w;
+
+        const texture_level_t *level = get_pixel_texture_level(setup, inverse_w);
+        int texel_index = get_texel_index_at(level, u, v);
+        count_texel_line(get_texel_address(level, texel_index), &last_texel_line, &texel_lines);
+        color_row[xi] = fetch_texel(level, texel_index);
+        shaded++;
+      }
+    }
+    w0 += setup->delta_w0_col;
+    w1 += setup->delta_w1_col;
+    w2 += setup->delta_w2_col;
+  }
+  if (setup->texel_lines != NULL)
+  {
+    *setup->texel_lines += texel_lines;
+  }
+  return shaded;
+}
+
+static int draw_textured_span_in_format(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                        int64_t w0, int64_t w1, int64_t w2, bool is_covered, bool is_depth_equal)
+{
+  switch (setup->depth_format)
+  {
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+    return draw_textured_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_equal, DEPTH_FORMAT_REVERSE_FLOAT);
+  case DEPTH_FORMAT_UNORM16:
+    return draw_textured_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_equal, DEPTH_FORMAT_UNORM16);
+  case DEPTH_FORMAT_UNORM24:
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+    return draw_textured_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_equal, DEPTH_FORMAT_UNORM24);
+  default:
+    return draw_textured_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, is_depth_equal, DEPTH_FORMAT_FLOAT);
+  }
+}
+
+int draw_textured_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                              int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return setup->is_depth_equal ? draw_textured_span_in_format(setup, y, x_start, x_end, w0, w1, w2, is_covered, true)
+                               : draw_textured_span_in_format(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+// Only stores the depth, triangle id and barycentric coordinates; the pixel is textured by resolve_visibility_buffer
+static inline int draw_visibility_span(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                       int64_t w0, int64_t w1, int64_t w2, bool is_covered, depth_format format)
+{
+  void *depth_row = get_depth_buffer_span(x_start, y);
+  int *triangle_id_row = get_triangle_id_buffer_row(y);
+  float *alpha_row = get_alpha_buffer_row(y);
+  float *beta_row = get_beta_buffer_row(y);
+  const float inv_w_row = get_raster_plane_row(setup, &setup->inv_w_plane, y);
+  const float inv_w_col = (float)setup->inv_w_plane.delta_col;
+  for (int xi = x_start; xi <= x_end; xi++)
+  {
+    if (is_covered || (w0 + setup->bias[0] >= 0 && w1 + setup->bias[1] >= 0 && w2 + setup->bias[2] >= 0))
+    {
+      // Same depth as draw_filled_span and draw_textured_span
+      float inverse_w = inv_w_row + inv_w_col * (float)(xi - setup->x_ref);
+      if (depth_test(depth_row, xi, inverse_w, format, setup->depth_epoch_tag, false))
+      {
+        triangle_id_row[xi] = setup->triangle_id;
+        alpha_row[xi] = (float)w0 * setup->inv_area;
+        beta_row[xi] = (float)w1 * setup->inv_area;
+      }
+    }
+    w0 += setup->delta_w0_col;
+    w1 += setup->delta_w1_col;
+    w2 += setup->delta_w2_col;
+  }
+  return 0; // The pixels are shaded by resolve_visibility_buffer
+}
+
+int draw_visibility_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  switch (setup->depth_format)
+  {
+  case DEPTH_FORMAT_REVERSE_FLOAT:
+    return draw_visibility_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, DEPTH_FORMAT_REVERSE_FLOAT);
+  case DEPTH_FORMAT_UNORM16:
+    return draw_visibility_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, DEPTH_FORMAT_UNORM16);
+  case DEPTH_FORMAT_UNORM24:
+  case DEPTH_FORMAT_UNORM24_EPOCH:
+    return draw_visibility_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, DEPTH_FORMAT_UNORM24);
+  default:
+    return draw_visibility_span(setup, y, x_start, x_end, w0, w1, w2, is_covered, DEPTH_FORMAT_FLOAT);
   }
-  return;
 }
 
 // Top-left rule for rasterization which determines the precedence of edges and prevents overdraw
@@ -218,7 +1043,7 @@ bool is_top_left(vec2_t *start, vec2_t *end)
   return is_top_edge || is_left_edge;
 }
 
-bool is_point_inside_triangle(int w0, int w1, int w2, int bias0, int bias1, int bias2)
+bool is_point_inside_triangle(int64_t w0, int64_t w1, int64_t w2, int bias0, int bias1, int bias2)
 {
   if (w0 + bias0 < 0 || w1 + bias1 < 0 || w2 + bias2 < 0)
   {
@@ -383,26 +1208,21 @@ void draw_triangle_pixel(int xi, int yi,
   // Interpolate using barycentric coordinates, multiplying by 1 / w of the point for correct perspective texture mapping (instead of affine texture mapping)
   float inverse_w = inv_w_a * alpha + inv_w_b * beta + inv_w_c * gamma;
 
-  // Using the inverse w as is is incorrect, as nearer objects get lesser inverse w values than farther ones.
-  // As such, we need to subtract the inverse w from 1.0.
-  float transformed_inverse_w = 1.0 - inverse_w;
-  if (transformed_inverse_w < get_z_buffer_at(xi, yi)) // Draw only if the current depth is less than what is in the z-buffer
+  if (!is_valid_pixel(xi, yi)) // The scanline rasterizer doesn't scissor its triangles to the screen
+  {
+    return;
+  }
+  if (test_and_update_depth(get_depth_buffer_span(xi, yi), xi, inverse_w, get_depth_format(), get_depth_epoch_tag(xi, yi)))
   {
     draw_pixel(xi, yi, color);
-    update_z_buffer_at(xi, yi, transformed_inverse_w);
   }
 }
 
 void draw_texel(int xi, int yi,
                 float alpha, float beta, float gamma,
                 float inv_w_a, float inv_w_b, float inv_w_c,
-                tex2_t uv_a, tex2_t uv_b, tex2_t uv_c, upng_t *texture)
+                tex2_t uv_a, tex2_t uv_b, tex2_t uv_c, texture_t *texture)
 {
-  // Query texture information
-  int texture_width = upng_get_width(texture);
-  int texture_height = upng_get_height(texture);
-  color_t *texture_buffer = (color_t *)upng_get_buffer(texture);
-
   // Interpolate using barycentric coordinates, multiplying by 1 / w of the point for correct perspective texture mapping (instead of affine texture mapping)
   float u = uv_a.u * inv_w_a * alpha + uv_b.u * inv_w_b * beta + uv_c.u * inv_w_c * gamma;
   float v = uv_a.v * inv_w_a * alpha + uv_b.v * inv_w_b * beta + uv_c.v * inv_w_c * gamma;
@@ -412,17 +1232,13 @@ void draw_texel(int xi, int yi,
   u /= inverse_w;
   v /= inverse_w;
 
-  // Map the UV coordinate to actual texture dimensions, wrapping and clamping to avoid overflow
-  int texture_x = clamp(0, texture_width, abs((int)(texture_width * u)) % texture_width);
-  int texture_y = clamp(0, texture_height, abs((int)(texture_height * v)) % texture_height);
-
-  // Using the inverse w as is is incorrect, as nearer objects get lesser inverse w values than farther ones.
-  // As such, we need to subtract the inverse w from 1.0.
-  float transformed_inverse_w = 1.0 - inverse_w;
-  if (transformed_inverse_w < get_z_buffer_at(xi, yi)) // Draw only if the current depth is less than what is in the z-buffer
+  if (!is_valid_pixel(xi, yi)) // The scanline rasterizer doesn't scissor its triangles to the screen
+  {
+    return;
+  }
+  if (test_and_update_depth(get_depth_buffer_span(xi, yi), xi, inverse_w, get_depth_format(), get_depth_epoch_tag(xi, yi)))
   {
-    draw_pixel(xi, yi, texture_buffer[texture_width * texture_y + texture_x]);
-    update_z_buffer_at(xi, yi, transformed_inverse_w);
+    draw_pixel(xi, yi, sample_texture(&texture->levels[0], u, v)); // The scanline rasterizer has no mip selection
   }
 }
 
@@ -447,7 +1263,7 @@ void sort_three_vertices_uv_by_y(triangle_t *triangle) // Insertion Sort, sorts
 
 void draw_textured_triangle_scanline(
     triangle_t triangle,
-    upng_t *texture)
+    texture_t *texture)
 {
   // Sort the vertices
   sort_three_vertices_uv_by_y(&triangle);
@@ -6,7 +6,6 @@
 #include "vector.h"
 #include "display.h"
 #include "texture.h"
-#include "../upng/upng.h"
 #include "utils.h"
 
 typedef struct face
@@ -18,6 +17,7 @@ typedef struct face
   tex2_t b_uv;
   tex2_t c_uv;
   color_t color;
+  int edges[3]; // Indices of the edges ab, bc and ca in the mesh's edge list
 } face_t;
 
 // A barycentric interpolation encapsulates the result of interpolating the UVs and the inverse w.
@@ -33,10 +33,119 @@ typedef struct triangle
   vec4_t points[3];
   tex2_t texcoords[3];
   color_t color;
-  upng_t *texture;
+  texture_t *texture;
 } triangle_t;
 
+// Vertices are snapped to 28.4 fixed point (1/16th of a pixel) before rasterization
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_SCALE (1 << SUBPIXEL_BITS)
+
+// The bounding box is traversed in blocks of 8x8 pixels, which are trivially rejected or accepted when possible.
+// They line up with the blocks of the coarse z-buffer, so every block is depth tested against one coarse depth.
+#define RASTER_BLOCK_SIZE Z_BUFFER_BLOCK_SIZE
+
+// Triangles whose pixel bounding box fits in 4x4 pixels skip the block traversal and are rasterized directly
+#define SMALL_TRIANGLE_SIZE 4
+
+typedef enum triangle_size_class
+{
+  TRIANGLE_EMPTY, // Covers no pixel center: back-facing, degenerate, or too thin after snapping
+  TRIANGLE_SMALL, // Bounding box of at most SMALL_TRIANGLE_SIZE x SMALL_TRIANGLE_SIZE pixels
+  TRIANGLE_LARGE
+} triangle_size_class;
+
+// The SSE2/AVX2 span kernels are only compiled for x86
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RASTER_HAS_X86_SIMD 1
+#else
+#define RASTER_HAS_X86_SIMD 0
+#endif
+
+typedef enum raster_kernel
+{
+  RASTER_KERNEL_SCALAR,
+  RASTER_KERNEL_SSE2, // 4 pixels per iteration
+  RASTER_KERNEL_AVX2, // 8 pixels per iteration
+  NUM_RASTER_KERNELS
+} raster_kernel;
+
+// An attribute that is linear in screen space, such as 1 / w, u / w or v / w.
+// value is the attribute at the center of the triangle's reference pixel (x_ref, y_ref).
+typedef struct raster_plane
+{
+  double value;
+  double delta_col; // Change per pixel to the right
+  double delta_row; // Change per pixel down
+} raster_plane_t;
+
+// Per-triangle constants shared by every span kernel
+typedef struct raster_setup
+{
+  int delta_w0_col; // Exact change of the fixed-point edge functions from one pixel to the next
+  int delta_w1_col;
+  int delta_w2_col;
+  int bias[3];      // 0 for top-left edges, -1 otherwise
+  float inv_area;
+  float inv_w[3];
+  float u_over_w[3]; // u / w and v / w of each vertex, for perspective-correct interpolation
+  float v_over_w[3];
+  int x_ref; // Pixel the attribute planes are anchored at, the top-left of the unclipped bounding box
+  int y_ref;
+  raster_plane_t inv_w_plane;
+  raster_plane_t u_over_w_plane;
+  raster_plane_t v_over_w_plane;
+  color_t color;
+  tex2_t texcoords[3];
+  const texture_t *texture;
+  int min_texture_level; // Range of mip levels the pixels can select, from the range of 1 / w over the triangle
+  int max_texture_level;
+  float texture_level_thresholds[TEXTURE_MAX_LEVELS]; // A pixel samples a level above min_texture_level only if its
+                                                      // 1 / w is at most the threshold of that level
+  int *texel_lines; // When not NULL, the texture cache lines fetched by the kernels are added to it
+  int triangle_id;     // Index written to the visibility buffer
+  bool is_depth_equal; // Second pass of the Z-prepass: the depth was already written, so it is only compared, and
+                       // the pixels that pass are marked consumed
+  depth_format depth_format; // Only DEPTH_FORMAT_FLOAT has SIMD kernels
+  uint32_t depth_epoch_tag;  // Clear epoch of the tile, in the top bits of the DEPTH_FORMAT_UNORM24_EPOCH depths
+  int (*scalar_span)(const struct raster_setup *setup, int y, int x_start, int x_end,
+                     int64_t w0, int64_t w1, int64_t w2, bool is_covered); // Fallback for spans that overflow 32 bits
+} raster_setup_t;
+
+/**
+ * Rasterizes the pixels x_start..x_end (inclusive) of row y and returns the number of pixels it shaded.
+ * w0, w1, w2 are the fixed-point edge functions at the center of pixel x_start. They are stepped exactly in
+ * integers, so every kernel produces the same image. The SIMD kernels are only used for spans whose edge
+ * functions fit in 32 bits.
+ * is_covered is set when the whole span is known to be inside the triangle, so the edge tests are skipped.
+ * Unless the framebuffer rows are contiguous, a span never crosses a FRAMEBUFFER_BLOCK_SIZE block.
+ */
+typedef int (*raster_span_t)(const raster_setup_t *setup, int y, int x_start, int x_end,
+                             int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+
+// Mip level of a pixel, from its 1 / w; the same in every kernel since they all compute 1 / w the same way
+static inline const texture_level_t *get_pixel_texture_level(const raster_setup_t *setup, float inverse_w)
+{
+  int level = setup->min_texture_level;
+  while (level < setup->max_texture_level && inverse_w <= setup->texture_level_thresholds[level + 1])
+  {
+    level++;
+  }
+  return &setup->texture->levels[level];
+}
+
+// Counts the texture cache lines fetched along a span: a line is counted again whenever the fetches leave it
+static inline void count_texel_line(const void *texel, uintptr_t *last_line, int *lines)
+{
+  uintptr_t line = (uintptr_t)texel / CACHE_LINE_SIZE;
+  if (line != *last_line)
+  {
+    *last_line = line;
+    (*lines)++;
+  }
+}
+
 float edge_cross(vec2_t a, vec2_t b, vec2_t p); // Computes a 2D cross product between three vertices. Used for computing barycentric coordinates.
+bool test_and_update_depth(void *depth_row, int xi, float inverse_w, depth_format format, uint32_t epoch_tag);
 void draw_triangle_pixel(int xi, int yi,
                          float alpha, float beta, float gamma,
                          float inv_w_a, float inv_w_b, float inv_w_c,
@@ -44,12 +153,63 @@ void draw_triangle_pixel(int xi, int yi,
 void draw_texel(int xi, int yi,
                 float alpha, float beta, float gamma,
                 float inv_w_a, float inv_w_b, float inv_w_c,
-                tex2_t uv_a, tex2_t uv_b, tex2_t uv_c, upng_t *texture);
+                tex2_t uv_a, tex2_t uv_b, tex2_t uv_c, texture_t *texture);
+
+/**
+ * Value of an attribute plane at the start of row y, i.e. at pixel (x_ref, y).
+ * Every kernel evaluates a plane as row value + delta_col * (x - x_ref), in float and in that order, so that all of
+ * them produce the same values. Unlike a running sum, this does not drift along long spans.
+ */
+float get_raster_plane_row(const raster_setup_t *setup, const raster_plane_t *plane, int y);
+
+raster_kernel detect_raster_kernel(void);
+raster_kernel get_raster_kernel(void);
+void set_raster_kernel(raster_kernel kernel);
+const char *get_raster_kernel_name(raster_kernel kernel);
+
+int draw_filled_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                            int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_textured_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                              int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_visibility_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_depth_span_scalar(const raster_setup_t *setup, int y, int x_start, int x_end,
+                           int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+#if RASTER_HAS_X86_SIMD
+int draw_filled_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                          int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_textured_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                            int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_visibility_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                              int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_depth_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                         int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_filled_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                          int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_textured_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                            int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_visibility_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                              int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+int draw_depth_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                         int64_t w0, int64_t w1, int64_t w2, bool is_covered);
+#endif
+
+// Classifies a triangle from its snapped vertices and returns the pixels its centers may cover in pixel_bounds
+triangle_size_class classify_triangle_size(const triangle_t *triangle, tile_t *pixel_bounds);
 
 bool is_top_left(vec2_t *start, vec2_t *end);
-bool is_point_inside_triangle(int w0, int w1, int w2, int bias0, int bias1, int bias2);
-void draw_filled_triangle(triangle_t triangle, color_t color);
-void draw_textured_triangle(triangle_t triangle, upng_t *texture);
+bool is_point_inside_triangle(int64_t w0, int64_t w1, int64_t w2, int bias0, int bias1, int bias2);
+void draw_filled_triangle(triangle_t triangle, color_t color, const tile_t *tile);
+void draw_textured_triangle(triangle_t triangle, texture_t *texture, const tile_t *tile);
+
+// Z-prepass: all triangles write only their depth first, then every pixel is textured once by the triangle whose
+// depth equals the z-buffer
+void draw_depth_triangle(triangle_t triangle, const tile_t *tile);
+void draw_textured_triangle_depth_equal(triangle_t triangle, texture_t *texture, const tile_t *tile);
+
+// Deferred texturing: triangles only write depth, their id and barycentrics, then each pixel is textured once
+void draw_visibility_triangle(triangle_t triangle, int triangle_id, const tile_t *tile);
+void resolve_visibility_buffer(const triangle_t *triangles, const tile_t *tile);
 
 void sort_three_vertices_uv_by_y(triangle_t *triangle);
 void fill_flat_bottom_triangle_scanline(triangle_t triangle, color_t color);
@@ -57,7 +217,7 @@ void fill_flat_top_triangle_scanline(triangle_t triangle, color_t color);
 void draw_filled_triangle_scanline(triangle_t triangle, color_t color);
 void draw_textured_triangle_scanline(
     triangle_t triangle,
-    upng_t *texture);
+    texture_t *texture);
 
 vec3_t compute_triangle_normal(vec4_t points[3]);
 vec3_t compute_barycentric_unnormalized(vec2_t v0, vec2_t v1, vec2_t v2, vec2_t p);
@@ -0,0 +1,670 @@
+#include "triangle.h"
+
+/**
+ * SIMD span kernels for the Pineda rasterizer in triangle.c.
+ * They evaluate 4 (SSE2) or 8 (AVX2) pixels per iteration and must match the scalar kernels bit for bit:
+ * the fixed-point edge functions are stepped exactly in 32-bit integers, every float operation is performed in
+ * the same order and precision as in the scalar kernels of triangle.c, and the pixels left over at the end of a
+ * span are handed to the scalar kernel.
+ */
+
+#if RASTER_HAS_X86_SIMD
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+//--------------------------------------------
+// SSE2: 4 pixels per iteration
+//--------------------------------------------
+
+// Shared by the filled and the depth-only kernels, like draw_filled_span in triangle.c
+static inline int draw_filled_span_sse2_impl(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                             int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered,
+                                             bool is_depth_only)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  float *z_row = get_z_buffer_span(x_start, y);
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 all_inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  // A pixel is inside when w + bias >= 0, i.e. w > -1 - bias
+  const __m128i threshold0 = _mm_set1_epi32(-1 - setup->bias[0]);
+  const __m128i threshold1 = _mm_set1_epi32(-1 - setup->bias[1]);
+  const __m128i threshold2 = _mm_set1_epi32(-1 - setup->bias[2]);
+  const int d0 = setup->delta_w0_col;
+  const int d1 = setup->delta_w1_col;
+  const int d2 = setup->delta_w2_col;
+  const __m128i step_w0 = _mm_set1_epi32(4 * d0);
+  const __m128i step_w1 = _mm_set1_epi32(4 * d1);
+  const __m128i step_w2 = _mm_set1_epi32(4 * d2);
+  __m128i w0 = _mm_add_epi32(_mm_set1_epi32((int)w0_start), _mm_set_epi32(3 * d0, 2 * d0, d0, 0));
+  __m128i w1 = _mm_add_epi32(_mm_set1_epi32((int)w1_start), _mm_set_epi32(3 * d1, 2 * d1, d1, 0));
+  __m128i w2 = _mm_add_epi32(_mm_set1_epi32((int)w2_start), _mm_set_epi32(3 * d2, 2 * d2, d2, 0));
+  const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+  const __m128 inv_w_row = _mm_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m128 inv_w_col = _mm_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m128i color = _mm_set1_epi32((int)setup->color);
+
+  int shaded = 0;
+  int xi = x_start;
+  for (; xi + 3 <= x_end; xi += 4, w0 = _mm_add_epi32(w0, step_w0), w1 = _mm_add_epi32(w1, step_w1), w2 = _mm_add_epi32(w2, step_w2))
+  {
+    __m128 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(w0, threshold0), _mm_cmpgt_epi32(w1, threshold1)), _mm_cmpgt_epi32(w2, threshold2)));
+      if (_mm_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m128 x_offset = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(xi - setup->x_ref), lanes));
+    __m128 inverse_w = _mm_add_ps(inv_w_row, _mm_mul_ps(inv_w_col, x_offset));
+    __m128 depth = _mm_sub_ps(one, inverse_w);
+
+    // Masked depth test and stores
+    __m128 z = _mm_loadu_ps(z_row + xi);
+    __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, z));
+    _mm_storeu_ps(z_row + xi, _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, z)));
+    if (is_depth_only)
+    {
+      continue;
+    }
+
+    __m128i pass_mask = _mm_castps_si128(pass);
+    __m128i old_color = _mm_loadu_si128((__m128i *)(color_row + xi));
+    _mm_storeu_si128((__m128i *)(color_row + xi), _mm_or_si128(_mm_and_si128(pass_mask, color), _mm_andnot_si128(pass_mask, old_color)));
+    shaded += __builtin_popcount(_mm_movemask_ps(pass));
+  }
+
+  int64_t offset = xi - x_start;
+  return shaded + setup->scalar_span(setup, y, xi, x_end,
+                                     w0_start + offset * setup->delta_w0_col,
+                                     w1_start + offset * setup->delta_w1_col,
+                                     w2_start + offset * setup->delta_w2_col,
+                                     is_covered);
+}
+
+int draw_filled_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                          int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_sse2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+int draw_depth_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                         int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_sse2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, true);
+}
+
+// Shared by the regular and the equal-depth textured kernels, like draw_textured_span in triangle.c
+static inline int draw_textured_span_sse2_impl(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                               int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered,
+                                               bool is_depth_equal)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  float *z_row = get_z_buffer_span(x_start, y);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 all_inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  // A pixel is inside when w + bias >= 0, i.e. w > -1 - bias
+  const __m128i threshold0 = _mm_set1_epi32(-1 - setup->bias[0]);
+  const __m128i threshold1 = _mm_set1_epi32(-1 - setup->bias[1]);
+  const __m128i threshold2 = _mm_set1_epi32(-1 - setup->bias[2]);
+  const int d0 = setup->delta_w0_col;
+  const int d1 = setup->delta_w1_col;
+  const int d2 = setup->delta_w2_col;
+  const __m128i step_w0 = _mm_set1_epi32(4 * d0);
+  const __m128i step_w1 = _mm_set1_epi32(4 * d1);
+  const __m128i step_w2 = _mm_set1_epi32(4 * d2);
+  __m128i w0 = _mm_add_epi32(_mm_set1_epi32((int)w0_start), _mm_set_epi32(3 * d0, 2 * d0, d0, 0));
+  __m128i w1 = _mm_add_epi32(_mm_set1_epi32((int)w1_start), _mm_set_epi32(3 * d1, 2 * d1, d1, 0));
+  __m128i w2 = _mm_add_epi32(_mm_set1_epi32((int)w2_start), _mm_set_epi32(3 * d2, 2 * d2, d2, 0));
+  const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+  const __m128 inv_w_row = _mm_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m128 inv_w_col = _mm_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m128 u_row = _mm_set1_ps(get_raster_plane_row(setup, &setup->u_over_w_plane, y));
+  const __m128 u_col = _mm_set1_ps((float)setup->u_over_w_plane.delta_col);
+  const __m128 v_row = _mm_set1_ps(get_raster_plane_row(setup, &setup->v_over_w_plane, y));
+  const __m128 v_col = _mm_set1_ps((float)setup->v_over_w_plane.delta_col);
+
+  int shaded = 0;
+  uintptr_t last_texel_line = 0;
+  int texel_lines = 0;
+  int xi = x_start;
+  for (; xi + 3 <= x_end; xi += 4, w0 = _mm_add_epi32(w0, step_w0), w1 = _mm_add_epi32(w1, step_w1), w2 = _mm_add_epi32(w2, step_w2))
+  {
+    __m128 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(w0, threshold0), _mm_cmpgt_epi32(w1, threshold1)), _mm_cmpgt_epi32(w2, threshold2)));
+      if (_mm_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m128 x_offset = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(xi - setup->x_ref), lanes));
+    __m128 inverse_w = _mm_add_ps(inv_w_row, _mm_mul_ps(inv_w_col, x_offset));
+    __m128 depth = _mm_sub_ps(one, inverse_w);
+
+    __m128 z = _mm_loadu_ps(z_row + xi);
+    __m128 pass = _mm_and_ps(inside, is_depth_equal ? _mm_cmpeq_ps(depth, z) : _mm_cmplt_ps(depth, z));
+    int pass_bits = _mm_movemask_ps(pass);
+    if (pass_bits == 0)
+    {
+      continue;
+    }
+
+    // Perspective-correct UVs
+    __m128 w = _mm_div_ps(one, inverse_w);
+    __m128 u = _mm_mul_ps(_mm_add_ps(u_row, _mm_mul_ps(u_col, x_offset)), w);
+    __m128 v = _mm_mul_ps(_mm_add_ps(v_row, _mm_mul_ps(v_col, x_offset)), w);
+    float lane_u[4];
+    float lane_v[4];
+    float lane_inverse_w[4];
+    _mm_storeu_ps(lane_u, u);
+    _mm_storeu_ps(lane_v, v);
+    _mm_storeu_ps(lane_inverse_w, inverse_w);
+
+    // SSE2 has no gather, so texels are fetched one lane at a time, each from its own mip level
+    color_t texels[4];
+    _mm_storeu_si128((__m128i *)texels, _mm_loadu_si128((__m128i *)(color_row + xi)));
+    for (int lane = 0; lane < 4; lane++)
+    {
+      if (pass_bits & (1 << lane))
+      {
+        const texture_level_t *level = get_pixel_texture_level(setup, lane_inverse_w[lane]);
+        int texel_index = get_texel_index_at(level, lane_u[lane], lane_v[lane]);
+        count_texel_line(get_texel_address(level, texel_index), &last_texel_line, &texel_lines);
+        texels[lane] = fetch_texel(level, texel_index);
+      }
+    }
+
+    // The equal pass marks the pixels it shades consumed, like depth_test()
+    __m128 written = is_depth_equal ? _mm_set1_ps(INFINITY) : depth;
+    _mm_storeu_ps(z_row + xi, _mm_or_ps(_mm_and_ps(pass, written), _mm_andnot_ps(pass, z)));
+    _mm_storeu_si128((__m128i *)(color_row + xi), _mm_loadu_si128((__m128i *)texels));
+    shaded += __builtin_popcount(pass_bits);
+  }
+  if (setup->texel_lines != NULL)
+  {
+    *setup->texel_lines += texel_lines;
+  }
+
+  int64_t offset = xi - x_start;
+  return shaded + draw_textured_span_scalar(setup, y, xi, x_end,
+                                            w0_start + offset * setup->delta_w0_col,
+                                            w1_start + offset * setup->delta_w1_col,
+                                            w2_start + offset * setup->delta_w2_col,
+                                            is_covered);
+}
+
+int draw_textured_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                            int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return setup->is_depth_equal ? draw_textured_span_sse2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, true)
+                               : draw_textured_span_sse2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+int draw_visibility_span_sse2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                              int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered)
+{
+  float *z_row = get_z_buffer_span(x_start, y);
+  int *triangle_id_row = get_triangle_id_buffer_row(y);
+  float *alpha_row = get_alpha_buffer_row(y);
+  float *beta_row = get_beta_buffer_row(y);
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 all_inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  // A pixel is inside when w + bias >= 0, i.e. w > -1 - bias
+  const __m128i threshold0 = _mm_set1_epi32(-1 - setup->bias[0]);
+  const __m128i threshold1 = _mm_set1_epi32(-1 - setup->bias[1]);
+  const __m128i threshold2 = _mm_set1_epi32(-1 - setup->bias[2]);
+  const int d0 = setup->delta_w0_col;
+  const int d1 = setup->delta_w1_col;
+  const int d2 = setup->delta_w2_col;
+  const __m128i step_w0 = _mm_set1_epi32(4 * d0);
+  const __m128i step_w1 = _mm_set1_epi32(4 * d1);
+  const __m128i step_w2 = _mm_set1_epi32(4 * d2);
+  __m128i w0 = _mm_add_epi32(_mm_set1_epi32((int)w0_start), _mm_set_epi32(3 * d0, 2 * d0, d0, 0));
+  __m128i w1 = _mm_add_epi32(_mm_set1_epi32((int)w1_start), _mm_set_epi32(3 * d1, 2 * d1, d1, 0));
+  __m128i w2 = _mm_add_epi32(_mm_set1_epi32((int)w2_start), _mm_set_epi32(3 * d2, 2 * d2, d2, 0));
+  const __m128 inv_area = _mm_set1_ps(setup->inv_area);
+  const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+  const __m128 inv_w_row = _mm_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m128 inv_w_col = _mm_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m128i triangle_id = _mm_set1_epi32(setup->triangle_id);
+
+  int xi = x_start;
+  for (; xi + 3 <= x_end; xi += 4, w0 = _mm_add_epi32(w0, step_w0), w1 = _mm_add_epi32(w1, step_w1), w2 = _mm_add_epi32(w2, step_w2))
+  {
+    __m128 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(w0, threshold0), _mm_cmpgt_epi32(w1, threshold1)), _mm_cmpgt_epi32(w2, threshold2)));
+      if (_mm_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m128 x_offset = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(xi - setup->x_ref), lanes));
+    __m128 inverse_w = _mm_add_ps(inv_w_row, _mm_mul_ps(inv_w_col, x_offset));
+    __m128 depth = _mm_sub_ps(one, inverse_w);
+
+    __m128 z = _mm_loadu_ps(z_row + xi);
+    __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, z));
+    if (_mm_movemask_ps(pass) == 0)
+    {
+      continue;
+    }
+    _mm_storeu_ps(z_row + xi, _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, z)));
+
+    __m128 alpha = _mm_mul_ps(_mm_cvtepi32_ps(w0), inv_area);
+    __m128 beta = _mm_mul_ps(_mm_cvtepi32_ps(w1), inv_area);
+    __m128i pass_mask = _mm_castps_si128(pass);
+    __m128i old_triangle_id = _mm_loadu_si128((__m128i *)(triangle_id_row + xi));
+    _mm_storeu_si128((__m128i *)(triangle_id_row + xi), _mm_or_si128(_mm_and_si128(pass_mask, triangle_id), _mm_andnot_si128(pass_mask, old_triangle_id)));
+    __m128 old_alpha = _mm_loadu_ps(alpha_row + xi);
+    _mm_storeu_ps(alpha_row + xi, _mm_or_ps(_mm_and_ps(pass, alpha), _mm_andnot_ps(pass, old_alpha)));
+    __m128 old_beta = _mm_loadu_ps(beta_row + xi);
+    _mm_storeu_ps(beta_row + xi, _mm_or_ps(_mm_and_ps(pass, beta), _mm_andnot_ps(pass, old_beta)));
+  }
+
+  int64_t offset = xi - x_start;
+  return draw_visibility_span_scalar(setup, y, xi, x_end,
+                                     w0_start + offset * setup->delta_w0_col,
+                                     w1_start + offset * setup->delta_w1_col,
+                                     w2_start + offset * setup->delta_w2_col,
+                                     is_covered);
+}
+
+//--------------------------------------------
+// AVX2: 8 pixels per iteration
+//--------------------------------------------
+
+// Vector version of abs((int)texel) & mask, the wrapping of sample_texture
+AVX2_TARGET static inline __m256i wrap_texel_coordinate_avx2(__m256 texel, __m256i mask)
+{
+  return _mm256_and_si256(_mm256_abs_epi32(_mm256_cvttps_epi32(texel)), mask);
+}
+
+// Vector version of get_texel_index
+AVX2_TARGET static inline __m256i get_texel_index_avx2(const texture_level_t *level, __m256i x, __m256i y)
+{
+  const __m256i in_block_mask = _mm256_set1_epi32(TEXTURE_BLOCK_SIZE - 1);
+  __m256i block = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srli_epi32(y, TEXTURE_BLOCK_SHIFT), _mm_cvtsi32_si128(level->blocks_per_row_shift)),
+                                   _mm256_srli_epi32(x, TEXTURE_BLOCK_SHIFT));
+  __m256i in_block = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, in_block_mask), TEXTURE_BLOCK_SHIFT),
+                                      _mm256_and_si256(x, in_block_mask));
+  return _mm256_add_epi32(_mm256_slli_epi32(block, 2 * TEXTURE_BLOCK_SHIFT), in_block);
+}
+
+// Vector version of expand_rgb565
+AVX2_TARGET static inline __m256i expand_rgb565_avx2(__m256i color)
+{
+  __m256i r = _mm256_and_si256(_mm256_srli_epi32(color, 11), _mm256_set1_epi32(0x1F));
+  __m256i g = _mm256_and_si256(_mm256_srli_epi32(color, 5), _mm256_set1_epi32(0x3F));
+  __m256i b = _mm256_and_si256(color, _mm256_set1_epi32(0x1F));
+  r = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+  g = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4));
+  b = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+  return _mm256_or_si256(_mm256_or_si256(_mm256_set1_epi32((int)0xFF000000), _mm256_slli_epi32(b, 16)),
+                         _mm256_or_si256(_mm256_slli_epi32(g, 8), r));
+}
+
+// x / 3 == (x * 43691) >> 17 for every x up to 3 * 255
+#define BC1_DIVIDE_BY_3_MULTIPLIER 43691
+#define BC1_DIVIDE_BY_3_SHIFT 17
+
+// Texels of the lanes that pass, decoded from any format, and the old colors of the others.
+// The 16- and 8-bit formats gather 32 bits at every texel's byte and keep its low bits, hence TEXTURE_GATHER_PADDING.
+AVX2_TARGET static inline __m256i fetch_texels_avx2(const texture_level_t *level, __m256i texel_index, __m256i pass_mask,
+                                                    __m256i old_color)
+{
+  switch (level->format)
+  {
+  case TEXTURE_FORMAT_RGBA8888:
+    return _mm256_mask_i32gather_epi32(old_color, (const int *)level->texels, texel_index, pass_mask, 4);
+  case TEXTURE_FORMAT_RGB565:
+  {
+    __m256i packed = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)level->texels, texel_index, pass_mask, 2);
+    return _mm256_blendv_epi8(old_color, expand_rgb565_avx2(packed), pass_mask);
+  }
+  case TEXTURE_FORMAT_PALETTE8:
+  {
+    __m256i packed = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)level->texels, texel_index, pass_mask, 1);
+    __m256i palette_index = _mm256_and_si256(packed, _mm256_set1_epi32(0xFF));
+    return _mm256_mask_i32gather_epi32(old_color, (const int *)level->palette, palette_index, pass_mask, 4);
+  }
+  case TEXTURE_FORMAT_BC1:
+  {
+    // Both endpoints, then the indices, of every texel's block
+    __m256i block_word = _mm256_slli_epi32(_mm256_srli_epi32(texel_index, 2 * TEXTURE_BLOCK_SHIFT), 1);
+    __m256i endpoints = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)level->texels, block_word, pass_mask, 4);
+    __m256i indices = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)level->texels,
+                                                  _mm256_add_epi32(block_word, _mm256_set1_epi32(1)), pass_mask, 4);
+    __m256i in_block = _mm256_and_si256(texel_index, _mm256_set1_epi32(TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE - 1));
+    __m256i selector = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(in_block, 1)), _mm256_set1_epi32(3));
+
+    // Every color is (weight0 * color0 + weight1 * color1) / 3, as in decode_bc1_texel
+    __m256i weight1 = _mm256_permutevar8x32_epi32(_mm256_setr_epi32(0, 3, 1, 2, 0, 0, 0, 0), selector);
+    __m256i weight0 = _mm256_sub_epi32(_mm256_set1_epi32(3), weight1);
+    __m256i color0 = expand_rgb565_avx2(_mm256_and_si256(endpoints, _mm256_set1_epi32(0xFFFF)));
+    __m256i color1 = expand_rgb565_avx2(_mm256_srli_epi32(endpoints, 16));
+    __m256i color = _mm256_set1_epi32((int)0xFF000000);
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+      __m256i channel0 = _mm256_and_si256(_mm256_srli_epi32(color0, shift), _mm256_set1_epi32(0xFF));
+      __m256i channel1 = _mm256_and_si256(_mm256_srli_epi32(color1, shift), _mm256_set1_epi32(0xFF));
+      __m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(weight0, channel0), _mm256_mullo_epi32(weight1, channel1));
+      __m256i channel = _mm256_srli_epi32(_mm256_mullo_epi32(sum, _mm256_set1_epi32(BC1_DIVIDE_BY_3_MULTIPLIER)), BC1_DIVIDE_BY_3_SHIFT);
+      color = _mm256_or_si256(color, _mm256_slli_epi32(channel, shift));
+    }
+    return _mm256_blendv_epi8(old_color, color, pass_mask);
+  }
+  default:
+    return old_color;
+  }
+}
+
+// The mip level of all 8 pixels when they share one, as in most triangles, or NULL
+AVX2_TARGET static inline const texture_level_t *get_uniform_texture_level_avx2(const raster_setup_t *setup, __m256 inverse_w)
+{
+  if (setup->min_texture_level == setup->max_texture_level)
+  {
+    return &setup->texture->levels[setup->min_texture_level];
+  }
+  // Counts the thresholds each pixel is under, like get_pixel_texture_level
+  __m256i levels = _mm256_set1_epi32(setup->min_texture_level);
+  for (int level = setup->min_texture_level + 1; level <= setup->max_texture_level; level++)
+  {
+    __m256 is_under = _mm256_cmp_ps(inverse_w, _mm256_set1_ps(setup->texture_level_thresholds[level]), _CMP_LE_OQ);
+    levels = _mm256_sub_epi32(levels, _mm256_castps_si256(is_under));
+  }
+  __m256i first_level = _mm256_permutevar8x32_epi32(levels, _mm256_setzero_si256());
+  if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(levels, first_level)) != -1)
+  {
+    return NULL;
+  }
+  return &setup->texture->levels[_mm256_cvtsi256_si32(levels)];
+}
+
+AVX2_TARGET static inline int draw_filled_span_avx2_impl(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                                         int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered,
+                                                         bool is_depth_only)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  float *z_row = get_z_buffer_span(x_start, y);
+
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 all_inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const __m256i threshold0 = _mm256_set1_epi32(-1 - setup->bias[0]);
+  const __m256i threshold1 = _mm256_set1_epi32(-1 - setup->bias[1]);
+  const __m256i threshold2 = _mm256_set1_epi32(-1 - setup->bias[2]);
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i step_w0 = _mm256_set1_epi32(8 * setup->delta_w0_col);
+  const __m256i step_w1 = _mm256_set1_epi32(8 * setup->delta_w1_col);
+  const __m256i step_w2 = _mm256_set1_epi32(8 * setup->delta_w2_col);
+  __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32((int)w0_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w0_col)));
+  __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32((int)w1_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w1_col)));
+  __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32((int)w2_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w2_col)));
+  const __m256 inv_w_row = _mm256_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m256 inv_w_col = _mm256_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m256i color = _mm256_set1_epi32((int)setup->color);
+
+  int shaded = 0;
+  int xi = x_start;
+  for (; xi + 7 <= x_end; xi += 8, w0 = _mm256_add_epi32(w0, step_w0), w1 = _mm256_add_epi32(w1, step_w1), w2 = _mm256_add_epi32(w2, step_w2))
+  {
+    __m256 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(w0, threshold0), _mm256_cmpgt_epi32(w1, threshold1)), _mm256_cmpgt_epi32(w2, threshold2)));
+      if (_mm256_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m256 x_offset = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(xi - setup->x_ref), lanes));
+    __m256 inverse_w = _mm256_add_ps(inv_w_row, _mm256_mul_ps(inv_w_col, x_offset));
+    __m256 depth = _mm256_sub_ps(one, inverse_w);
+
+    __m256 z = _mm256_loadu_ps(z_row + xi);
+    __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(depth, z, _CMP_LT_OQ));
+    _mm256_storeu_ps(z_row + xi, _mm256_blendv_ps(z, depth, pass));
+    if (is_depth_only)
+    {
+      continue;
+    }
+
+    __m256i old_color = _mm256_loadu_si256((__m256i *)(color_row + xi));
+    _mm256_storeu_si256((__m256i *)(color_row + xi), _mm256_blendv_epi8(old_color, color, _mm256_castps_si256(pass)));
+    shaded += __builtin_popcount(_mm256_movemask_ps(pass));
+  }
+
+  int64_t offset = xi - x_start;
+  return shaded + setup->scalar_span(setup, y, xi, x_end,
+                                     w0_start + offset * setup->delta_w0_col,
+                                     w1_start + offset * setup->delta_w1_col,
+                                     w2_start + offset * setup->delta_w2_col,
+                                     is_covered);
+}
+
+AVX2_TARGET int draw_filled_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                      int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_avx2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+AVX2_TARGET int draw_depth_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                     int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return draw_filled_span_avx2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, true);
+}
+
+AVX2_TARGET static inline int draw_textured_span_avx2_impl(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                                           int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered,
+                                                           bool is_depth_equal)
+{
+  color_t *color_row = get_color_buffer_span(x_start, y);
+  float *z_row = get_z_buffer_span(x_start, y);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 all_inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const __m256i threshold0 = _mm256_set1_epi32(-1 - setup->bias[0]);
+  const __m256i threshold1 = _mm256_set1_epi32(-1 - setup->bias[1]);
+  const __m256i threshold2 = _mm256_set1_epi32(-1 - setup->bias[2]);
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i step_w0 = _mm256_set1_epi32(8 * setup->delta_w0_col);
+  const __m256i step_w1 = _mm256_set1_epi32(8 * setup->delta_w1_col);
+  const __m256i step_w2 = _mm256_set1_epi32(8 * setup->delta_w2_col);
+  __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32((int)w0_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w0_col)));
+  __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32((int)w1_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w1_col)));
+  __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32((int)w2_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w2_col)));
+  const __m256 inv_w_row = _mm256_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m256 inv_w_col = _mm256_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m256 u_row = _mm256_set1_ps(get_raster_plane_row(setup, &setup->u_over_w_plane, y));
+  const __m256 u_col = _mm256_set1_ps((float)setup->u_over_w_plane.delta_col);
+  const __m256 v_row = _mm256_set1_ps(get_raster_plane_row(setup, &setup->v_over_w_plane, y));
+  const __m256 v_col = _mm256_set1_ps((float)setup->v_over_w_plane.delta_col);
+
+  int shaded = 0;
+  uintptr_t last_texel_line = 0;
+  int texel_lines = 0;
+  int xi = x_start;
+  for (; xi + 7 <= x_end; xi += 8, w0 = _mm256_add_epi32(w0, step_w0), w1 = _mm256_add_epi32(w1, step_w1), w2 = _mm256_add_epi32(w2, step_w2))
+  {
+    __m256 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(w0, threshold0), _mm256_cmpgt_epi32(w1, threshold1)), _mm256_cmpgt_epi32(w2, threshold2)));
+      if (_mm256_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m256 x_offset = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(xi - setup->x_ref), lanes));
+    __m256 inverse_w = _mm256_add_ps(inv_w_row, _mm256_mul_ps(inv_w_col, x_offset));
+    __m256 depth = _mm256_sub_ps(one, inverse_w);
+
+    __m256 z = _mm256_loadu_ps(z_row + xi);
+    __m256 pass = _mm256_and_ps(inside, (is_depth_equal ? _mm256_cmp_ps(depth, z, _CMP_EQ_OQ) : _mm256_cmp_ps(depth, z, _CMP_LT_OQ)));
+    int pass_bits = _mm256_movemask_ps(pass);
+    if (pass_bits == 0)
+    {
+      continue;
+    }
+
+    __m256 w = _mm256_div_ps(one, inverse_w);
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(u_row, _mm256_mul_ps(u_col, x_offset)), w);
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(v_row, _mm256_mul_ps(v_col, x_offset)), w);
+
+    // Lanes that fail the depth test keep the color already in the buffer
+    __m256i pass_mask = _mm256_castps_si256(pass);
+    __m256i old_color = _mm256_loadu_si256((__m256i *)(color_row + xi));
+    __m256i texels;
+    const texture_level_t *level = get_uniform_texture_level_avx2(setup, inverse_w);
+    if (level != NULL)
+    {
+      __m256i texture_x = wrap_texel_coordinate_avx2(_mm256_mul_ps(_mm256_set1_ps((float)level->width), u), _mm256_set1_epi32(level->width_mask));
+      __m256i texture_y = wrap_texel_coordinate_avx2(_mm256_mul_ps(_mm256_set1_ps((float)level->height), v), _mm256_set1_epi32(level->height_mask));
+      __m256i texel_index = get_texel_index_avx2(level, texture_x, texture_y);
+      texels = fetch_texels_avx2(level, texel_index, pass_mask, old_color);
+      if (setup->texel_lines != NULL)
+      {
+        int lane_index[8];
+        _mm256_storeu_si256((__m256i *)lane_index, texel_index);
+        for (int lane = 0; lane < 8; lane++)
+        {
+          if (pass_bits & (1 << lane))
+          {
+            count_texel_line(get_texel_address(level, lane_index[lane]), &last_texel_line, &texel_lines);
+          }
+        }
+      }
+    }
+    else
+    {
+      // The lanes straddle mip levels, so they are fetched one at a time like in the SSE2 kernel
+      float lane_u[8];
+      float lane_v[8];
+      float lane_inverse_w[8];
+      color_t lane_texels[8];
+      _mm256_storeu_ps(lane_u, u);
+      _mm256_storeu_ps(lane_v, v);
+      _mm256_storeu_ps(lane_inverse_w, inverse_w);
+      _mm256_storeu_si256((__m256i *)lane_texels, old_color);
+      for (int lane = 0; lane < 8; lane++)
+      {
+        if (pass_bits & (1 << lane))
+        {
+          const texture_level_t *level = get_pixel_texture_level(setup, lane_inverse_w[lane]);
+          int texel_index = get_texel_index_at(level, lane_u[lane], lane_v[lane]);
+          count_texel_line(get_texel_address(level, texel_index), &last_texel_line, &texel_lines);
+          lane_texels[lane] = fetch_texel(level, texel_index);
+        }
+      }
+      texels = _mm256_loadu_si256((__m256i *)lane_texels);
+    }
+
+    // The equal pass marks the pixels it shades consumed, like depth_test()
+    __m256 written = is_depth_equal ? _mm256_set1_ps(INFINITY) : depth;
+    _mm256_storeu_ps(z_row + xi, _mm256_blendv_ps(z, written, pass));
+    _mm256_storeu_si256((__m256i *)(color_row + xi), texels);
+    shaded += __builtin_popcount(pass_bits);
+  }
+  if (setup->texel_lines != NULL)
+  {
+    *setup->texel_lines += texel_lines;
+  }
+
+  int64_t offset = xi - x_start;
+  return shaded + draw_textured_span_scalar(setup, y, xi, x_end,
+                                            w0_start + offset * setup->delta_w0_col,
+                                            w1_start + offset * setup->delta_w1_col,
+                                            w2_start + offset * setup->delta_w2_col,
+                                            is_covered);
+}
+
+AVX2_TARGET int draw_textured_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                        int64_t w0, int64_t w1, int64_t w2, bool is_covered)
+{
+  return setup->is_depth_equal ? draw_textured_span_avx2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, true)
+                               : draw_textured_span_avx2_impl(setup, y, x_start, x_end, w0, w1, w2, is_covered, false);
+}
+
+AVX2_TARGET int draw_visibility_span_avx2(const raster_setup_t *setup, int y, int x_start, int x_end,
+                                          int64_t w0_start, int64_t w1_start, int64_t w2_start, bool is_covered)
+{
+  float *z_row = get_z_buffer_span(x_start, y);
+  int *triangle_id_row = get_triangle_id_buffer_row(y);
+  float *alpha_row = get_alpha_buffer_row(y);
+  float *beta_row = get_beta_buffer_row(y);
+
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 all_inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const __m256i threshold0 = _mm256_set1_epi32(-1 - setup->bias[0]);
+  const __m256i threshold1 = _mm256_set1_epi32(-1 - setup->bias[1]);
+  const __m256i threshold2 = _mm256_set1_epi32(-1 - setup->bias[2]);
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i step_w0 = _mm256_set1_epi32(8 * setup->delta_w0_col);
+  const __m256i step_w1 = _mm256_set1_epi32(8 * setup->delta_w1_col);
+  const __m256i step_w2 = _mm256_set1_epi32(8 * setup->delta_w2_col);
+  __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32((int)w0_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w0_col)));
+  __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32((int)w1_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w1_col)));
+  __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32((int)w2_start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(setup->delta_w2_col)));
+  const __m256 inv_area = _mm256_set1_ps(setup->inv_area);
+  const __m256 inv_w_row = _mm256_set1_ps(get_raster_plane_row(setup, &setup->inv_w_plane, y));
+  const __m256 inv_w_col = _mm256_set1_ps((float)setup->inv_w_plane.delta_col);
+  const __m256i triangle_id = _mm256_set1_epi32(setup->triangle_id);
+
+  int xi = x_start;
+  for (; xi + 7 <= x_end; xi += 8, w0 = _mm256_add_epi32(w0, step_w0), w1 = _mm256_add_epi32(w1, step_w1), w2 = _mm256_add_epi32(w2, step_w2))
+  {
+    __m256 inside = all_inside;
+    if (!is_covered)
+    {
+      inside = _mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(w0, threshold0), _mm256_cmpgt_epi32(w1, threshold1)), _mm256_cmpgt_epi32(w2, threshold2)));
+      if (_mm256_movemask_ps(inside) == 0)
+      {
+        continue;
+      }
+    }
+
+    __m256 x_offset = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(xi - setup->x_ref), lanes));
+    __m256 inverse_w = _mm256_add_ps(inv_w_row, _mm256_mul_ps(inv_w_col, x_offset));
+    __m256 depth = _mm256_sub_ps(one, inverse_w);
+
+    __m256 z = _mm256_loadu_ps(z_row + xi);
+    __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(depth, z, _CMP_LT_OQ));
+    if (_mm256_movemask_ps(pass) == 0)
+    {
+      continue;
+    }
+    _mm256_storeu_ps(z_row + xi, _mm256_blendv_ps(z, depth, pass));
+
+    __m256 alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(w0), inv_area);
+    __m256 beta = _mm256_mul_ps(_mm256_cvtepi32_ps(w1), inv_area);
+    __m256i old_triangle_id = _mm256_loadu_si256((__m256i *)(triangle_id_row + xi));
+    _mm256_storeu_si256((__m256i *)(triangle_id_row + xi), _mm256_blendv_epi8(old_triangle_id, triangle_id, _mm256_castps_si256(pass)));
+    _mm256_storeu_ps(alpha_row + xi, _mm256_blendv_ps(_mm256_loadu_ps(alpha_row + xi), alpha, pass));
+    _mm256_storeu_ps(beta_row + xi, _mm256_blendv_ps(_mm256_loadu_ps(beta_row + xi), beta, pass));
+  }
+
+  int64_t offset = xi - x_start;
+  return draw_visibility_span_scalar(setup, y, xi, x_end,
+                                     w0_start + offset * setup->delta_w0_col,
+                                     w1_start + offset * setup->delta_w1_col,
+                                     w2_start + offset * setup->delta_w2_col,
+                                     is_covered);
+}
+
+#endif